@@ -2,8 +2,11 @@
 #include <cstdio>
 #include <cstring>
 #include <csignal>
+#include <memory>
+#include <vector>
 #include <unistd.h>
 #include <Synth/Synth.hpp>
+#include <Synth/SampleBank.hpp>
 
 static bool progRunning = true;
 
@@ -19,69 +22,29 @@ sigint (int sig_num)
     fflush(stdout);
 }
 
-typedef void (*Preset) (Synth &synth);
-
-void
-preset_default (Synth &synth)
-{
-    synth.setAttack(0.01);
-    synth.setDecay(0.5);
-    synth.setSustain(1.0);
-    synth.setRelease(1.0);
-
-    synth.setFilterAttack(0.01);
-    synth.setFilterDecay(0.5);
-    synth.setFilterSustain(1.0);
-    synth.setFilterRelease(1.0);
-
-    synth.setCutoff(0.99);
-    synth.setResonance(0.0);
-}
-
-void
-preset_acid (Synth &synth)
-{
-    synth.setAttack(0.01);
-    synth.setDecay(0.4);
-    synth.setSustain(0.5);
-    synth.setRelease(0.4);
-
-    synth.setFilterAttack(0.35);
-    synth.setFilterDecay(0.40);
-    synth.setFilterSustain(0.01);
-    synth.setFilterRelease(0.01);
-
-    synth.setCutoff(0.15);
-    synth.setResonance(0.90);
-}
-
-void
-preset_pluck (Synth &synth)
-{
-    synth.setAttack(0.01);
-    synth.setDecay(1.5);
-    synth.setSustain(0.01);
-    synth.setRelease(1.5);
-
-    synth.setFilterAttack(0.5);
-    synth.setFilterDecay(1.5);
-    synth.setFilterSustain(0.01);
-    synth.setFilterRelease(1.5);
-
-    synth.setCutoff(0.85);
-    synth.setResonance(0.85);
-}
-
 void
 usage (int argc, char **argv)
 {
     fprintf(stderr,
-            "Usage: %s [-h] [-p <preset>] [-d <midi device>]\n"
+            "Usage: %s [-h] [-p <preset>] [-s <samples>] [-t <scale>] [-k <map>]\n"
+            "       [-d <midi device>] [-l <address>]\n"
             "   -p <preset>\n"
-            "       Use one of the presets: default, acid, pluck\n"
+            "       Use one of the presets: default, acid, pluck, or the\n"
+            "       path to a preset file\n"
+            "   -s <samples>\n"
+            "       Play a sample bank file or a WAV file instead of the\n"
+            "       oscillator\n"
+            "   -t <scale>\n"
+            "       Tune to a Scala .scl scale\n"
+            "   -k <map>\n"
+            "       Map the scale to the keyboard with a Scala .kbm file\n"
             "   -d <midi device>\n"
             "      Connect to a midi device. Expects a string name\n"
-            "      from `aconnect -o`\n"
+            "      from `aconnect -o`, optionally with `:<port>'. May be\n"
+            "      given more than once.\n"
+            "   -l <address>\n"
+            "      Also play events sent to a socket, unix:<path> or\n"
+            "      udp:[<host>:]<port>, e.g. by synth-send\n"
             "   -h\n"
             "      Display this help menu and exit.\n"
             , argv[0]);
@@ -89,9 +52,12 @@ usage (int argc, char **argv)
 }
 
 Preset
-handle_args (int argc, char **argv, const char **device)
+handle_args (int argc, char **argv, std::vector<const char*> &devices,
+        const char **samples,
+        const char **scale, const char **keyboard, const char **address)
 {
-    Preset preset = preset_default;
+    Preset preset;
+    Preset::builtin("default", preset);
 
     if (argc == 1)
         return preset;
@@ -103,19 +69,33 @@ handle_args (int argc, char **argv, const char **device)
         else if (strcmp(argv[i], "-p") == 0) {
             if (++i >= argc)
                 usage(argc, argv);
-            if (strcmp(argv[i], "default") == 0)
-                preset = preset_default;
-            else if (strcmp(argv[i], "acid") == 0)
-                preset = preset_acid;
-            else if (strcmp(argv[i], "pluck") == 0)
-                preset = preset_pluck;
-            else
+            if (!Preset::builtin(argv[i], preset) && !preset.load(argv[i]))
                 usage(argc, argv);
         }
         else if (strcmp(argv[i], "-d") == 0) {
             if (++i >= argc)
                 usage(argc, argv);
-            *device = argv[i];
+            devices.push_back(argv[i]);
+        }
+        else if (strcmp(argv[i], "-s") == 0) {
+            if (++i >= argc)
+                usage(argc, argv);
+            *samples = argv[i];
+        }
+        else if (strcmp(argv[i], "-t") == 0) {
+            if (++i >= argc)
+                usage(argc, argv);
+            *scale = argv[i];
+        }
+        else if (strcmp(argv[i], "-k") == 0) {
+            if (++i >= argc)
+                usage(argc, argv);
+            *keyboard = argv[i];
+        }
+        else if (strcmp(argv[i], "-l") == 0) {
+            if (++i >= argc)
+                usage(argc, argv);
+            *address = argv[i];
         }
     }
 
@@ -127,12 +107,38 @@ main (int argc, char **argv)
 {
     signal(SIGINT, sigint);
 
-    const char *midiDevice = NULL;
+    std::vector<const char*> midiDevices;
+    const char *samples = NULL;
+    const char *scale = NULL;
+    const char *keyboard = NULL;
+    const char *address = NULL;
+
+    Preset preset = handle_args(argc, argv, midiDevices, &samples, &scale,
+            &keyboard, &address);
+    preset.volume = 0.8;
+
+    Tuning tuning;
+    if (scale && !tuning.load(scale, keyboard))
+        return 1;
+
+    /* declared before the synth so it outlives it */
+    std::unique_ptr<SampleBank> bank;
+    if (samples) {
+        bank.reset(new SampleBank(samples));
+        if (!bank->isOpen()) {
+            fprintf(stderr, "%s: %s\n", samples, bank->error());
+            return 1;
+        }
+    }
 
-    Preset preset = handle_args(argc, argv, &midiDevice);
-    Synth synth(midiDevice);
-    synth.setVolume(0.8);
-    preset(synth);
+    Synth synth(midiDevices.empty() ? NULL : midiDevices[0]);
+    for (size_t i = 1; i < midiDevices.size(); i++)
+        synth.connectMidi(midiDevices[i]);
+    synth.setPreset(preset);
+    synth.setSampleBank(bank.get());
+    synth.setTuning(tuning);
+    if (address && !synth.listen(address))
+        return 1;
 
     /* how hard the note is played (how loud it will be) in range [0.0, 1.0] */
     const double velocity = 1.0;
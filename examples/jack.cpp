@@ -0,0 +1,277 @@
+#include <cmath>
+#include <cstdlib>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <atomic>
+#include <unistd.h>
+#include <jack/jack.h>
+#include <jack/midiport.h>
+#include <Synth/Synth.hpp>
+#include <Synth/Definitions.hpp>
+
+/*
+ * Checks a SYNTH_DRIVER_JACK synth against a running JACK server, which
+ * needs no sound card:
+ *
+ *     jackd -d dummy -r 48000 -p 256 &
+ *     ./synth-jack
+ *
+ * A second client sends notes to the synth's `midi_in' port at random frames
+ * within a period and listens to its `out_left' and `out_right' ports. Each
+ * note must sound on both, on the frame it was sent for: as far after it as
+ * the same note rendered by a SYNTH_DRIVER_NONE synth sounds after its
+ * event, plus any whole periods JACK holds it back by, depending on which
+ * client it runs first. Exits non-zero if the synth couldn't connect or any
+ * note was late, early or never sounded.
+ */
+
+/* the synth's client; a second synth would be renamed by the server */
+static const char *synth_client = "synth";
+/* level a sample must reach to count as the note's first */
+static const float onset_level = 1e-6f;
+/* longest wait for a note to sound before the trial is counted as missed */
+static const useconds_t trial_timeout_us = 1000000;
+/* most whole periods a note may be held back by */
+static const jack_nframes_t max_periods_late = 2;
+
+enum TrialState {
+    TRIAL_IDLE,
+    /* the note is to be sent in the next period */
+    TRIAL_SEND,
+    /* the note was sent and its first sample is awaited */
+    TRIAL_LISTEN,
+    /* the note was heard, or time ran out */
+    TRIAL_DONE
+};
+
+struct Checker {
+    jack_client_t *client;
+    jack_port_t *midiOut;
+    jack_port_t *inputs[2];
+    std::atomic<int> state;
+    /* frame into the period to send the note at */
+    jack_nframes_t offset;
+    /* frame the note was sent for and the frame each channel sounded on */
+    jack_nframes_t sent;
+    jack_nframes_t heard[2];
+    bool found[2];
+};
+
+/* A note that's loud from its first sample and gone as soon as it's off */
+static void
+set_patch (Synth &synth)
+{
+    synth.setWaveform(OSCILLATOR_WAVE_SQUARE);
+    synth.setAttack(0.0);
+    synth.setSustain(1.0);
+    synth.setRelease(0.0);
+    synth.setCutoff(0.99);
+}
+
+/*
+ * Frames from a note's event to its first sample reaching onset_level, as a
+ * synth rendering by itself at `rate' plays it, or -1 if it never does.
+ */
+static int
+reference_onset (unsigned int rate)
+{
+    static const size_t frames = 1024;
+    static const size_t at = 100;
+    float left[frames], right[frames];
+    float *out[2] = { left, right };
+
+    Synth synth(SYNTH_DRIVER_NONE, rate);
+    set_patch(synth);
+    MidiEvent note(MIDI_NOTEON, 60, 0.0, 1.0, 0.0);
+    note.frame = at;
+    synth.render(out, frames, &note, 1);
+    for (size_t i = at; i < frames; i++) {
+        if (fabsf(left[i]) >= onset_level || fabsf(right[i]) >= onset_level)
+            return i - at;
+    }
+    return -1;
+}
+
+static int
+process (jack_nframes_t frames, void *data)
+{
+    Checker *checker = (Checker*) data;
+    jack_nframes_t start = jack_last_frame_time(checker->client);
+
+    void *midi = jack_port_get_buffer(checker->midiOut, frames);
+    jack_midi_clear_buffer(midi);
+
+    int state = checker->state;
+    if (state == TRIAL_SEND) {
+        jack_midi_data_t note[3] = { 0x90, 60, 127 };
+        jack_nframes_t offset = checker->offset % frames;
+        if (jack_midi_event_write(midi, offset, note, sizeof(note)) == 0) {
+            checker->sent = start + offset;
+            checker->found[0] = checker->found[1] = false;
+            checker->state = state = TRIAL_LISTEN;
+        }
+    }
+    if (state != TRIAL_LISTEN)
+        return 0;
+
+    for (int c = 0; c < 2; c++) {
+        float *in = (float*) jack_port_get_buffer(checker->inputs[c], frames);
+        for (jack_nframes_t i = 0; i < frames && !checker->found[c]; i++) {
+            if (fabsf(in[i]) < onset_level)
+                continue;
+            checker->heard[c] = start + i;
+            checker->found[c] = true;
+        }
+    }
+    if (checker->found[0] && checker->found[1])
+        checker->state = TRIAL_DONE;
+    return 0;
+}
+
+static bool
+connect (jack_client_t *client, const char *from, const char *to)
+{
+    int err = jack_connect(client, from, to);
+    if (err != 0) {
+        fprintf(stderr, "Could not connect %s to %s (error %d)\n", from, to, err);
+        return false;
+    }
+    return true;
+}
+
+void
+usage (int argc, char **argv)
+{
+    fprintf(stderr,
+            "Usage: %s [-h] [-n <trials>]\n"
+            "   -n <trials>\n"
+            "       Notes to send. Default is 20.\n"
+            "   -h\n"
+            "      Display this help menu and exit.\n"
+            , argv[0]);
+    exit(1);
+}
+
+int
+main (int argc, char **argv)
+{
+    int trials = 20;
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-h") == 0) {
+            usage(argc, argv);
+        }
+        else if (strcmp(argv[i], "-n") == 0) {
+            if (++i >= argc)
+                usage(argc, argv);
+            trials = atoi(argv[i]);
+        }
+        else {
+            usage(argc, argv);
+        }
+    }
+    if (trials <= 0)
+        usage(argc, argv);
+
+    Synth synth(SYNTH_DRIVER_JACK);
+    if (synth.audioStatus() != DEVICE_STATUS_OK) {
+        fprintf(stderr, "%s\n", synth.deviceError().c_str());
+        return 1;
+    }
+    set_patch(synth);
+
+    Checker checker;
+    checker.state = TRIAL_IDLE;
+    jack_status_t status;
+    checker.client = jack_client_open("synth-check", JackNoStartServer, &status);
+    if (!checker.client) {
+        fprintf(stderr, "Could not connect to the JACK server (status 0x%x)\n", status);
+        return 1;
+    }
+    jack_client_t *client = checker.client;
+    checker.midiOut = jack_port_register(client, "midi_out",
+            JACK_DEFAULT_MIDI_TYPE, JackPortIsOutput, 0);
+    checker.inputs[0] = jack_port_register(client, "in_left",
+            JACK_DEFAULT_AUDIO_TYPE, JackPortIsInput, 0);
+    checker.inputs[1] = jack_port_register(client, "in_right",
+            JACK_DEFAULT_AUDIO_TYPE, JackPortIsInput, 0);
+    if (!checker.midiOut || !checker.inputs[0] || !checker.inputs[1]) {
+        fprintf(stderr, "Could not register the checker's ports\n");
+        return 1;
+    }
+    jack_set_process_callback(client, process, &checker);
+    if (jack_activate(client) != 0) {
+        fprintf(stderr, "Could not activate the checker\n");
+        return 1;
+    }
+
+    char synthPort[3][64];
+    snprintf(synthPort[0], sizeof(synthPort[0]), "%s:midi_in", synth_client);
+    snprintf(synthPort[1], sizeof(synthPort[1]), "%s:out_left", synth_client);
+    snprintf(synthPort[2], sizeof(synthPort[2]), "%s:out_right", synth_client);
+    if (!connect(client, jack_port_name(checker.midiOut), synthPort[0])
+            || !connect(client, synthPort[1], jack_port_name(checker.inputs[0]))
+            || !connect(client, synthPort[2], jack_port_name(checker.inputs[1])))
+        return 1;
+
+    jack_nframes_t rate = jack_get_sample_rate(client);
+    jack_nframes_t period = jack_get_buffer_size(client);
+    printf("JACK at %u Hz, %u frames a period, %d notes\n", rate, period, trials);
+    if (synth.getRate() != rate) {
+        printf("FAIL: the synth runs at %u Hz\n", synth.getRate());
+        return 1;
+    }
+    int lead = reference_onset(rate);
+    if (lead < 0) {
+        printf("FAIL: the note never sounds when rendered by itself\n");
+        return 1;
+    }
+
+    srand(time(NULL));
+    int failed = 0;
+    useconds_t periodUs = period * 1000000ULL / rate;
+    for (int i = 0; i < trials; i++) {
+        /* let the last note clear the graph before listening again */
+        while (synth.noteActive(60))
+            usleep(1000);
+        usleep(periodUs * (max_periods_late + 2));
+
+        checker.offset = rand() % period;
+        checker.state = TRIAL_SEND;
+        useconds_t waited = 0;
+        while (checker.state != TRIAL_DONE && waited < trial_timeout_us) {
+            usleep(1000);
+            waited += 1000;
+        }
+        int state = checker.state;
+        checker.state = TRIAL_IDLE;
+        synth.noteOff(60);
+
+        if (state != TRIAL_DONE) {
+            printf("FAIL: note %d, sent %u frames into a period, never sounded\n",
+                   i, checker.offset);
+            failed++;
+            continue;
+        }
+        for (int c = 0; c < 2; c++) {
+            /* wraps around if the note sounded early, failing the check */
+            jack_nframes_t late = checker.heard[c] - checker.sent - lead;
+            if (late % period == 0 && late / period <= max_periods_late)
+                continue;
+            printf("FAIL: note %d, sent %u frames into a period, sounded on "
+                   "the %s %d frames after it\n", i, checker.offset,
+                   c ? "right" : "left", (int) late);
+            failed++;
+            break;
+        }
+    }
+
+    jack_client_close(client);
+    if (failed) {
+        printf("%d of %d notes off their frame\n", failed, trials);
+        return 1;
+    }
+    printf("all %d notes sounded on their frame\n", trials);
+    return 0;
+}
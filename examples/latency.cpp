@@ -0,0 +1,368 @@
+#include <cmath>
+#include <cstdlib>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <algorithm>
+#include <atomic>
+#include <vector>
+#include <pthread.h>
+#include <unistd.h>
+#include <Synth/Synth.hpp>
+#include <Synth/Definitions.hpp>
+
+/*
+ * Measures how long a note takes from Synth::noteOn to sound, over a range
+ * of period and buffer sizes. Each trial plays a note and finds its first
+ * sample in the output as the sound card takes it, timing two things:
+ *
+ *     to writei: noteOn until snd_pcm_writei returned with that sample
+ *     to DAC:    noteOn until the card gets round to playing it, from the
+ *                frames it still had queued when writei returned
+ *
+ * By default no sound card is used. A stand-in takes each period the way
+ * ALSA would, blocking while its buffer is full and draining it in real
+ * time once it's filled to the start threshold, so the results show what
+ * the synth and the buffering cost without the card's own delays. `-a'
+ * plays through the real card instead.
+ */
+
+/* level a sample must reach to count as the note's first */
+static const float onset_level = 1e-4f;
+/* longest wait for a note to sound before the trial is counted as missed */
+static const uint64_t trial_timeout_ns = 1000000000ULL;
+/* most extra time left between trials, so notes land anywhere in a period */
+static const unsigned long max_gap_us = 50000;
+
+static const char *default_configs[] = {
+    "64:128", "64:256", "64:1024", "128:256", "128:512",
+    "256:512", "256:1024", "512:2048", NULL
+};
+
+/* Watches the output for the note of the trial in progress */
+struct Probe {
+    unsigned int rate;
+    /* the first frame the note may be in, or UINT64_MAX between trials */
+    std::atomic<uint64_t> armed;
+    std::atomic<bool> found;
+    /* filled in by the monitor before `found' is set */
+    uint64_t written;
+    uint64_t played;
+};
+
+struct Stats {
+    size_t period;
+    size_t buffer;
+    size_t missed;
+    std::vector<double> toWrite;
+    std::vector<double> toDac;
+};
+
+/*
+ * Plays the part of the sound card for a SYNTH_DRIVER_NONE synth: renders a
+ * period at a time and hands each to a device with `buffer' frames which
+ * starts once (buffer / period) * period are queued, like AudioDevice sets
+ * it up, and then plays one frame every 1 / rate seconds. Running dry
+ * stops it until it's filled up again, as an underrun would.
+ */
+struct StandIn {
+    Synth *synth;
+    size_t period;
+    size_t buffer;
+    unsigned int rate;
+    OutputMonitor monitor;
+    void *data;
+    std::atomic<bool> running;
+    pthread_t thread;
+};
+
+static double
+now ()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void
+on_block (const OutputBlock &block, void *data)
+{
+    Probe *probe = (Probe*) data;
+    uint64_t armed = probe->armed;
+    if (armed == UINT64_MAX || probe->found)
+        return;
+
+    for (size_t i = 0; i < block.frames; i++) {
+        if (block.frame + i < armed)
+            continue;
+        if (fabsf(block.samples[i * 2]) < onset_level
+                && fabsf(block.samples[i * 2 + 1]) < onset_level)
+            continue;
+
+        probe->written = block.written;
+        /* the frames queued ahead of this one play first */
+        probe->played = 0;
+        if (block.queued >= 0) {
+            long ahead = block.queued - (long) (block.frames - i);
+            probe->played = block.written
+                + (uint64_t) (std::max(ahead, 0L) * 1e9 / probe->rate);
+        }
+        probe->found = true;
+        return;
+    }
+}
+
+static void*
+stand_in_thread (void *data)
+{
+    StandIn *device = (StandIn*) data;
+    size_t threshold = (device->buffer / device->period) * device->period;
+    std::vector<float> mix(device->period * 2);
+    /* frames taken and frames played since the device last started */
+    uint64_t written = 0;
+    uint64_t started = 0;
+
+    while (device->running) {
+        device->synth->render(&mix[0], device->period);
+
+        uint64_t t = monotonic_ns();
+        uint64_t played = 0;
+        for (;;) {
+            played = started ? (t - started) * device->rate / 1000000000ULL : 0;
+            if (started && played >= written) {
+                /* ran dry: stop until the start threshold is queued again */
+                started = 0;
+                written = played = 0;
+            }
+            if (written + device->period - played <= device->buffer)
+                break;
+            size_t wait = written + device->period - played - device->buffer;
+            usleep(wait * 1000000UL / device->rate + 1);
+            t = monotonic_ns();
+        }
+
+        written += device->period;
+        if (!started && written >= threshold) {
+            started = t;
+            played = 0;
+        }
+
+        OutputBlock block;
+        block.written = t;
+        block.samples = &mix[0];
+        block.frames = device->period;
+        block.frame = device->synth->frame() - device->period;
+        block.queued = written - played;
+        device->monitor(block, device->data);
+    }
+    return NULL;
+}
+
+static double
+percentile (const std::vector<double> &sorted, double p)
+{
+    if (sorted.empty())
+        return 0.0;
+    size_t i = (size_t) ceil(p * sorted.size());
+    return sorted[std::min(std::max(i, (size_t) 1), sorted.size()) - 1];
+}
+
+static void
+print_distribution (const char *name, std::vector<double> values)
+{
+    if (values.empty()) {
+        printf("  %-9s  no onsets found\n", name);
+        return;
+    }
+    std::sort(values.begin(), values.end());
+    double sum = 0.0;
+    for (size_t i = 0; i < values.size(); i++)
+        sum += values[i];
+    printf("  %-9s  min %7.2f  p50 %7.2f  p95 %7.2f  p99 %7.2f  max %7.2f"
+           "  mean %7.2f ms\n",
+           name, values.front(), percentile(values, 0.5),
+           percentile(values, 0.95), percentile(values, 0.99), values.back(),
+           sum / values.size());
+}
+
+/* Plays `trials' notes on `synth', timing each with `probe' */
+static void
+run_trials (Synth &synth, Probe &probe, Stats &stats, int trials, FILE *raw)
+{
+    unsigned long periodUs = stats.period * 1000000UL / probe.rate;
+    for (int i = 0; i < trials; i++) {
+        /*
+         * Leave the last note's release a couple of periods to clear the
+         * output, then start at a random point within a period.
+         */
+        while (synth.noteActive(60))
+            usleep(1000);
+        usleep(periodUs * 2 + rand() % max_gap_us);
+
+        probe.found = false;
+        probe.armed = synth.frame();
+        uint64_t start = monotonic_ns();
+        synth.noteOn(60, 1.0);
+        while (!probe.found && monotonic_ns() - start < trial_timeout_ns)
+            usleep(100);
+        probe.armed = UINT64_MAX;
+        synth.noteOff(60);
+
+        if (!probe.found) {
+            stats.missed++;
+            continue;
+        }
+        double toWrite = (probe.written - start) / 1e6;
+        stats.toWrite.push_back(toWrite);
+        if (probe.played)
+            stats.toDac.push_back((probe.played - start) / 1e6);
+        if (raw)
+            fprintf(raw, "%zu,%zu,%d,%.3f,%.3f\n", stats.period, stats.buffer,
+                    i, toWrite, probe.played ? (probe.played - start) / 1e6 : -1.0);
+    }
+}
+
+void
+usage (int argc, char **argv)
+{
+    fprintf(stderr,
+            "Usage: %s [-h] [-a] [-n <trials>] [-c <period>:<buffer>]... [-o <csv>]\n"
+            "   -a\n"
+            "       Play through the sound card rather than a stand-in for it.\n"
+            "   -n <trials>\n"
+            "       Notes timed for each configuration. Default is 200.\n"
+            "   -c <period>:<buffer>\n"
+            "       Period and buffer size in frames to try, e.g. 64:256. May\n"
+            "       be given more than once. Defaults to a range from 64:128\n"
+            "       to 512:2048.\n"
+            "   -o <csv>\n"
+            "       Also write every trial to <csv>: period, buffer, trial and\n"
+            "       its milliseconds to writei and to the DAC (-1 if unknown).\n"
+            "   -h\n"
+            "      Display this help menu and exit.\n"
+            , argv[0]);
+    exit(1);
+}
+
+int
+main (int argc, char **argv)
+{
+    bool card = false;
+    int trials = 200;
+    const char *rawPath = NULL;
+    std::vector<Stats> configs;
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-h") == 0) {
+            usage(argc, argv);
+        }
+        else if (strcmp(argv[i], "-a") == 0) {
+            card = true;
+        }
+        else if (strcmp(argv[i], "-n") == 0) {
+            if (++i >= argc)
+                usage(argc, argv);
+            trials = atoi(argv[i]);
+        }
+        else if (strcmp(argv[i], "-c") == 0) {
+            Stats stats = Stats();
+            if (++i >= argc || sscanf(argv[i], "%zu:%zu", &stats.period, &stats.buffer) != 2
+                    || stats.period == 0 || stats.buffer < stats.period)
+                usage(argc, argv);
+            configs.push_back(stats);
+        }
+        else if (strcmp(argv[i], "-o") == 0) {
+            if (++i >= argc)
+                usage(argc, argv);
+            rawPath = argv[i];
+        }
+        else {
+            usage(argc, argv);
+        }
+    }
+    if (trials <= 0)
+        usage(argc, argv);
+    if (configs.empty()) {
+        for (int i = 0; default_configs[i]; i++) {
+            Stats stats = Stats();
+            sscanf(default_configs[i], "%zu:%zu", &stats.period, &stats.buffer);
+            configs.push_back(stats);
+        }
+    }
+
+    FILE *raw = NULL;
+    if (rawPath && !(raw = fopen(rawPath, "w"))) {
+        perror(rawPath);
+        return 1;
+    }
+    if (raw)
+        fprintf(raw, "period,buffer,trial,writei_ms,dac_ms\n");
+
+    Synth synth(card ? SYNTH_DRIVER_ALSA : SYNTH_DRIVER_NONE);
+    if (card && synth.audioStatus() != DEVICE_STATUS_OK) {
+        fprintf(stderr, "%s\n", synth.deviceError().c_str());
+        return 1;
+    }
+    /* a note that's loud from its first sample and gone as soon as it's off */
+    synth.setWaveform(OSCILLATOR_WAVE_SQUARE);
+    synth.setAttack(0.0);
+    synth.setSustain(1.0);
+    synth.setRelease(0.0);
+    synth.setCutoff(0.99);
+
+    Probe probe;
+    probe.rate = synth.getRate();
+    probe.armed = UINT64_MAX;
+    probe.found = false;
+    srand(time(NULL));
+
+    printf("%s, %u Hz, %d notes each\n",
+           card ? "sound card" : "stand-in device", probe.rate, trials);
+    for (size_t c = 0; c < configs.size(); c++) {
+        Stats &stats = configs[c];
+        printf("period %zu, buffer %zu (%.2f ms buffered)\n", stats.period,
+               stats.buffer, stats.buffer * 1000.0 / probe.rate);
+
+        double started = now();
+        StandIn device;
+        if (card) {
+            if (!synth.setAudioBuffer(stats.period, stats.buffer)) {
+                printf("  could not open the card: %s\n",
+                       synth.deviceError().c_str());
+                continue;
+            }
+            synth.setOutputMonitor(on_block, &probe);
+        } else {
+            device.synth = &synth;
+            device.period = stats.period;
+            device.buffer = stats.buffer;
+            device.rate = probe.rate;
+            device.monitor = on_block;
+            device.data = &probe;
+            device.running = true;
+            if (pthread_create(&device.thread, NULL, stand_in_thread, &device) != 0) {
+                fprintf(stderr, "Could not create the stand-in device's thread\n");
+                return 1;
+            }
+        }
+
+        run_trials(synth, probe, stats, trials, raw);
+
+        if (card) {
+            synth.setOutputMonitor(NULL);
+        } else {
+            device.running = false;
+            pthread_join(device.thread, NULL);
+        }
+
+        print_distribution("to writei", stats.toWrite);
+        print_distribution("to DAC", stats.toDac);
+        if (stats.missed)
+            printf("  %zu notes never sounded\n", stats.missed);
+        printf("  (%.1f s)\n", now() - started);
+    }
+
+    if (raw)
+        fclose(raw);
+    return 0;
+}
@@ -0,0 +1,420 @@
+#include <cmath>
+#include <cstdlib>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <atomic>
+#include <map>
+#include <string>
+#include <vector>
+#include <pthread.h>
+#include <unistd.h>
+#include <Synth/Synth.hpp>
+#include <Synth/MidiPlayer.hpp>
+
+/*
+ * Renders a batch of MIDI files to audio files in parallel. Each job gets its
+ * own Synth, and a synth keeps all of its state, sample rate included, to
+ * itself, so the jobs share nothing and scale across all cores. Rendering is
+ * deterministic, so outputs can be checked against golden files from an
+ * earlier run.
+ */
+
+/*
+ * Each distinct preset named in the job list is loaded once: either one of the
+ * built-in presets or a preset file.
+ */
+static bool
+find_preset (const char *name, std::map<std::string, Preset> &cache, Preset &preset)
+{
+    auto it = cache.find(name);
+    if (it != cache.end()) {
+        preset = it->second;
+        return true;
+    }
+    if (!Preset::builtin(name, preset) && !preset.load(name))
+        return false;
+    cache[name] = preset;
+    return true;
+}
+
+struct Job {
+    std::string midi;
+    std::string output;
+    Preset preset;
+
+    /* filled in by the worker */
+    bool ok;
+    double audioSeconds;
+    double wallSeconds;
+    /* largest difference from the golden file, if comparing */
+    double error;
+};
+
+struct Batch {
+    std::vector<Job> jobs;
+    std::atomic<size_t> next;
+    RecorderFormat format;
+    OutputClip clip;
+    double tail;
+    double volume;
+    /* directory of golden files to compare against, or NULL */
+    const char *golden;
+    double tolerance;
+    pthread_mutex_t printLock;
+};
+
+static double
+now ()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static uint32_t
+get_le (const unsigned char *p, int bytes)
+{
+    uint32_t v = 0;
+    for (int i = bytes - 1; i >= 0; i--)
+        v = (v << 8) | p[i];
+    return v;
+}
+
+/*
+ * Reads a 16 bit, 24 bit or float WAV file as written by Recorder into
+ * interleaved floats. Returns false if it isn't one.
+ */
+static bool
+read_wav (const char *path, std::vector<float> &samples, unsigned &channels)
+{
+    FILE *file = fopen(path, "rb");
+    if (!file)
+        return false;
+    std::vector<unsigned char> data;
+    unsigned char buf[65536];
+    size_t n;
+    while ((n = fread(buf, 1, sizeof(buf), file)) > 0)
+        data.insert(data.end(), buf, buf + n);
+    fclose(file);
+
+    if (data.size() < 12 || memcmp(&data[0], "RIFF", 4) != 0
+            || memcmp(&data[8], "WAVE", 4) != 0)
+        return false;
+
+    unsigned format = 0, bits = 0;
+    channels = 0;
+    size_t pos = 12;
+    while (pos + 8 <= data.size()) {
+        const unsigned char *chunk = &data[pos];
+        size_t length = get_le(chunk + 4, 4);
+        size_t end = std::min(pos + 8 + length, data.size());
+        if (memcmp(chunk, "fmt ", 4) == 0 && length >= 16) {
+            format = get_le(chunk + 8, 2);
+            channels = get_le(chunk + 10, 2);
+            bits = get_le(chunk + 22, 2);
+        } else if (memcmp(chunk, "data", 4) == 0 && channels > 0) {
+            size_t bytes = bits / 8;
+            samples.clear();
+            for (size_t i = pos + 8; i + bytes <= end; i += bytes) {
+                uint32_t v = get_le(&data[i], bytes);
+                if (format == 3 && bits == 32) {
+                    float x;
+                    memcpy(&x, &v, sizeof(x));
+                    samples.push_back(x);
+                } else if (format == 1 && bits == 16) {
+                    samples.push_back((int16_t) v / 32767.0f);
+                } else if (format == 1 && bits == 24) {
+                    /* sign extend from 24 bits */
+                    int32_t s = (int32_t) (v << 8) >> 8;
+                    samples.push_back(s / 8388607.0f);
+                } else {
+                    return false;
+                }
+            }
+            return true;
+        }
+        pos += 8 + length + (length & 1);
+    }
+    return false;
+}
+
+/* Compares a job's output with its golden file, returning the largest error */
+static double
+compare_golden (Batch *batch, Job &job)
+{
+    std::string name = job.output;
+    size_t slash = name.rfind('/');
+    if (slash != std::string::npos)
+        name = name.substr(slash + 1);
+    std::string golden = std::string(batch->golden) + "/" + name;
+
+    std::vector<float> a, b;
+    unsigned ca, cb;
+    if (!read_wav(job.output.c_str(), a, ca) || !read_wav(golden.c_str(), b, cb))
+        return -1.0;
+    if (ca != cb || a.size() != b.size())
+        return -1.0;
+
+    double error = 0.0;
+    for (size_t i = 0; i < a.size(); i++)
+        error = std::max(error, (double) fabsf(a[i] - b[i]));
+    return error;
+}
+
+static void
+render_job (Batch *batch, Job &job)
+{
+    double start = now();
+    job.ok = false;
+
+    MidiFile file(job.midi.c_str());
+    if (!file.isOpen()) {
+        pthread_mutex_lock(&batch->printLock);
+        fprintf(stderr, "%s: %s\n", job.midi.c_str(), file.error());
+        pthread_mutex_unlock(&batch->printLock);
+        return;
+    }
+
+    {
+        Synth synth(SYNTH_DRIVER_NONE);
+        synth.setDeterministic(true);
+        Preset preset = job.preset;
+        preset.volume = batch->volume;
+        synth.setPreset(preset);
+        synth.setOutputClip(batch->clip);
+
+        Recorder recorder(job.output.c_str(), batch->format, RECORDER_WAV,
+                          synth.getRate(), 2);
+        if (!recorder.isOpen())
+            return;
+
+        MidiPlayer player(&synth, file);
+        uint64_t frames = player.render(&recorder, batch->tail);
+        job.audioSeconds = (double) frames / synth.getRate();
+    }
+
+    job.ok = true;
+    job.wallSeconds = now() - start;
+    if (batch->golden) {
+        job.error = compare_golden(batch, job);
+        job.ok = job.error >= 0.0 && job.error <= batch->tolerance;
+    }
+
+    pthread_mutex_lock(&batch->printLock);
+    printf("%s: %.1fs of audio in %.2fs (%.1fx real time)",
+            job.output.c_str(), job.audioSeconds, job.wallSeconds,
+            job.audioSeconds / job.wallSeconds);
+    if (!batch->golden)
+        printf("\n");
+    else if (job.error < 0.0)
+        printf(", golden file missing or a different length\n");
+    else
+        printf(", max error %g from golden: %s\n", job.error,
+                job.ok ? "ok" : "FAILED");
+    pthread_mutex_unlock(&batch->printLock);
+}
+
+static void*
+worker (void *data)
+{
+    Batch *batch = (Batch*) data;
+    size_t i;
+    while ((i = batch->next++) < batch->jobs.size())
+        render_job(batch, batch->jobs[i]);
+    return NULL;
+}
+
+/*
+ * Reads jobs, one per line: `<midi file> <preset> <output file>'. Blank lines
+ * and lines starting with `#' are ignored.
+ */
+static bool
+read_jobs (const char *path, std::vector<Job> &jobs)
+{
+    FILE *file = strcmp(path, "-") == 0 ? stdin : fopen(path, "r");
+    if (!file) {
+        fprintf(stderr, "Could not open job list `%s'\n", path);
+        return false;
+    }
+
+    std::map<std::string, Preset> presets;
+    char line[4096];
+    int lineno = 0;
+    bool ok = true;
+    while (fgets(line, sizeof(line), file)) {
+        lineno++;
+        char midi[1024], preset[256], output[1024];
+        char *p = line;
+        while (*p == ' ' || *p == '\t')
+            p++;
+        if (*p == '#' || *p == '\n' || *p == '\0')
+            continue;
+        if (sscanf(p, "%1023s %255s %1023s", midi, preset, output) != 3) {
+            fprintf(stderr, "%s:%d: expected `<midi> <preset> <output>'\n",
+                    path, lineno);
+            ok = false;
+            continue;
+        }
+        Job job;
+        job.midi = midi;
+        job.output = output;
+        job.ok = false;
+        job.audioSeconds = job.wallSeconds = 0.0;
+        job.error = 0.0;
+        if (!find_preset(preset, presets, job.preset)) {
+            fprintf(stderr, "%s:%d: unknown preset `%s'\n", path, lineno, preset);
+            ok = false;
+            continue;
+        }
+        jobs.push_back(job);
+    }
+
+    if (file != stdin)
+        fclose(file);
+    return ok;
+}
+
+void
+usage (int argc, char **argv)
+{
+    fprintf(stderr,
+            "Usage: %s [-h] [-j <threads>] [-f <format>] [-c <clip>] [-t <tail>]\n"
+            "          [-v <volume>] [-g <dir> [-e <tolerance>]] <jobs>\n"
+            "   <jobs>\n"
+            "       File listing one job per line: <midi file> <preset> <output.wav>\n"
+            "       Presets are default, acid, pluck or a preset file.\n"
+            "       Use `-' to read the jobs from stdin.\n"
+            "   -j <threads>\n"
+            "       Number of jobs rendered at once. Defaults to one per core.\n"
+            "   -f <format>\n"
+            "       Output sample format: s16 (default), s24 or float\n"
+            "   -c <clip>\n"
+            "       Keep the output within full scale by hard (default) or soft\n"
+            "       clipping, a lookahead limiter, or none (float output only).\n"
+            "   -t <tail>\n"
+            "       Seconds rendered after the last event. Default is 2.\n"
+            "   -v <volume>\n"
+            "       Synth volume, from 0.0 to 1.5. Default is 0.8.\n"
+            "   -g <dir>\n"
+            "       Compare each output with the file of the same name in <dir>,\n"
+            "       failing any job which differs. Renders are deterministic, so\n"
+            "       by default any difference at all fails.\n"
+            "   -e <tolerance>\n"
+            "       Largest difference from the golden file to allow, as a\n"
+            "       fraction of full scale. Default is 0.\n"
+            "   -h\n"
+            "      Display this help menu and exit.\n"
+            , argv[0]);
+    exit(1);
+}
+
+int
+main (int argc, char **argv)
+{
+    Batch batch;
+    batch.next = 0;
+    batch.format = RECORDER_S16;
+    batch.clip = OUTPUT_CLIP_HARD;
+    batch.tail = 2.0;
+    batch.volume = 0.8;
+    batch.golden = NULL;
+    batch.tolerance = 0.0;
+    pthread_mutex_init(&batch.printLock, NULL);
+
+    long threads = sysconf(_SC_NPROCESSORS_ONLN);
+    const char *jobList = NULL;
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-h") == 0) {
+            usage(argc, argv);
+        }
+        else if (strcmp(argv[i], "-j") == 0) {
+            if (++i >= argc)
+                usage(argc, argv);
+            threads = atol(argv[i]);
+        }
+        else if (strcmp(argv[i], "-f") == 0) {
+            if (++i >= argc)
+                usage(argc, argv);
+            if (strcmp(argv[i], "s16") == 0)
+                batch.format = RECORDER_S16;
+            else if (strcmp(argv[i], "s24") == 0)
+                batch.format = RECORDER_S24;
+            else if (strcmp(argv[i], "float") == 0)
+                batch.format = RECORDER_FLOAT;
+            else
+                usage(argc, argv);
+        }
+        else if (strcmp(argv[i], "-c") == 0) {
+            if (++i >= argc)
+                usage(argc, argv);
+            if (strcmp(argv[i], "hard") == 0)
+                batch.clip = OUTPUT_CLIP_HARD;
+            else if (strcmp(argv[i], "soft") == 0)
+                batch.clip = OUTPUT_CLIP_SOFT;
+            else if (strcmp(argv[i], "limit") == 0)
+                batch.clip = OUTPUT_CLIP_LIMIT;
+            else if (strcmp(argv[i], "none") == 0)
+                batch.clip = OUTPUT_CLIP_NONE;
+            else
+                usage(argc, argv);
+        }
+        else if (strcmp(argv[i], "-t") == 0) {
+            if (++i >= argc)
+                usage(argc, argv);
+            batch.tail = atof(argv[i]);
+        }
+        else if (strcmp(argv[i], "-v") == 0) {
+            if (++i >= argc)
+                usage(argc, argv);
+            batch.volume = atof(argv[i]);
+        }
+        else if (strcmp(argv[i], "-g") == 0) {
+            if (++i >= argc)
+                usage(argc, argv);
+            batch.golden = argv[i];
+        }
+        else if (strcmp(argv[i], "-e") == 0) {
+            if (++i >= argc)
+                usage(argc, argv);
+            batch.tolerance = atof(argv[i]);
+        }
+        else {
+            jobList = argv[i];
+        }
+    }
+
+    if (!jobList)
+        usage(argc, argv);
+    if (!read_jobs(jobList, batch.jobs))
+        return 1;
+    if (threads < 1)
+        threads = 1;
+    if ((size_t) threads > batch.jobs.size())
+        threads = batch.jobs.size();
+
+    double start = now();
+
+    std::vector<pthread_t> pool(threads);
+    for (long i = 0; i < threads; i++)
+        pthread_create(&pool[i], NULL, worker, &batch);
+    for (long i = 0; i < threads; i++)
+        pthread_join(pool[i], NULL);
+
+    double wall = now() - start;
+    double audio = 0.0;
+    int failed = 0;
+    for (size_t i = 0; i < batch.jobs.size(); i++) {
+        audio += batch.jobs[i].audioSeconds;
+        if (!batch.jobs[i].ok)
+            failed++;
+    }
+
+    printf("%lu jobs (%d failed) on %ld threads: %.1fs of audio in %.2fs "
+           "(%.1fx real time)\n",
+           (unsigned long) batch.jobs.size(), failed, threads, audio, wall,
+           wall > 0.0 ? audio / wall : 0.0);
+
+    return failed ? 1 : 0;
+}
@@ -0,0 +1,112 @@
+#include <cstdlib>
+#include <cstdio>
+#include <cstring>
+#include <vector>
+#include <unistd.h>
+#include <Synth/SocketInput.hpp>
+
+/*
+ * Sends events to a synth listening on a socket, e.g. `synth -l <address>',
+ * read from stdin one per line:
+ *
+ *     on <note> [velocity 0-127] [@<frames>]
+ *     off <note> [@<frames>]
+ *     bend <-8192 to 8191> [@<frames>]
+ *     cc <controller> <value 0-127> [@<frames>]
+ *     wait <milliseconds>
+ *
+ * Events up to each `wait' (or the end of the input) go out together, each
+ * played `frames' after the batch arrives.
+ */
+
+void
+usage (int argc, char **argv)
+{
+    fprintf(stderr,
+            "Usage: %s [-h] [-c <channel>] <address> < events\n"
+            "   -c <channel>\n"
+            "       MIDI channel of the events, 0 through 15\n"
+            "   -h\n"
+            "      Display this help menu and exit.\n"
+            "   <address> is unix:<path> or udp:[<host>:]<port>\n"
+            , argv[0]);
+    exit(1);
+}
+
+/* Parses one line into `event', returning false if it isn't an event */
+static bool
+parse (const char *line, MidiEvent &event)
+{
+    char cmd[16];
+    int a = 0, b = 100, n;
+    if (sscanf(line, "%15s%n", cmd, &n) != 1)
+        return false;
+    line += n;
+
+    /* an optional `@frames' may follow the values */
+    const char *at = strchr(line, '@');
+    uint64_t offset = at ? strtoull(at + 1, NULL, 10) : 0;
+
+    int values = sscanf(line, "%d %d", &a, &b);
+    if (strcmp(cmd, "on") == 0 && values >= 1)
+        event = MidiEvent(MIDI_NOTEON, a, 0.0, b / 127.0, 0.0);
+    else if (strcmp(cmd, "off") == 0 && values >= 1)
+        event = MidiEvent(MIDI_NOTEOFF, a, 0.0, 0.0, 0.0);
+    else if (strcmp(cmd, "bend") == 0 && values >= 1)
+        event = MidiEvent(MIDI_PITCHBEND, 0, 0.0, 0.0, a / 8192.0);
+    else if (strcmp(cmd, "cc") == 0 && values == 2)
+        event = MidiEvent(MIDI_CONTROL, a, b / 127.0, 0.0, 0.0);
+    else
+        return false;
+
+    event.frame = offset;
+    return true;
+}
+
+int
+main (int argc, char **argv)
+{
+    int channel = 0;
+    const char *address = NULL;
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-h") == 0) {
+            usage(argc, argv);
+        }
+        else if (strcmp(argv[i], "-c") == 0) {
+            if (++i >= argc)
+                usage(argc, argv);
+            channel = atoi(argv[i]) & 0x0f;
+        }
+        else {
+            address = argv[i];
+        }
+    }
+    if (!address)
+        usage(argc, argv);
+
+    SocketClient client(address);
+    if (!client.isOpen())
+        return 1;
+
+    std::vector<MidiEvent> batch;
+    char line[256];
+    while (fgets(line, sizeof(line), stdin)) {
+        int ms;
+        MidiEvent event;
+        if (sscanf(line, " wait %d", &ms) == 1) {
+            if (!client.send(batch.data(), batch.size()))
+                return 1;
+            batch.clear();
+            usleep(ms * 1000);
+        } else if (parse(line, event)) {
+            event.channel = channel;
+            batch.push_back(event);
+        } else if (line[strspn(line, " \t\r\n")] != '\0') {
+            fprintf(stderr, "Ignoring `%.*s'\n",
+                    (int) strcspn(line, "\r\n"), line);
+        }
+    }
+
+    return client.send(batch.data(), batch.size()) ? 0 : 1;
+}
@@ -1,14 +1,59 @@
 #ifndef AUDIO_DEVICE_HPP
 #define AUDIO_DEVICE_HPP
 
+#include <atomic>
+#include <string>
 #include <inttypes.h>
-#include <cassert>
+#include <pthread.h>
+#include "DeviceStatus.hpp"
 
+/* The period and buffer sizes asked for unless told otherwise, in frames */
+#define AUDIO_PERIOD_FRAMES 64
+#define AUDIO_BUFFER_FRAMES 1024
+
+/* A period of output as the device took it, see Synth::setOutputMonitor */
+struct OutputBlock {
+    /* interleaved stereo */
+    const float *samples;
+    size_t frames;
+    /* the synth's frame count at the first of them */
+    uint64_t frame;
+    /* when snd_pcm_writei returned with them, CLOCK_MONOTONIC in ns */
+    uint64_t written;
+    /* frames the device had left to play then, these included, or -1 */
+    long queued;
+};
+
+typedef void (*OutputMonitor) (const OutputBlock &block, void *data);
+
+/*
+ * The sound card. A device which can't be opened, or goes away while
+ * playing (e.g. a USB interface being unplugged), is reported through
+ * `status' and `error' rather than ending the process; it can be reopened
+ * with `open'.
+ */
 class AudioDevice {
 public:
-    AudioDevice ();
+    /*
+     * Opens the default device, asking for periods of `periodFrames' in a
+     * buffer of `bufferFrames', which the card may round. Smaller is less
+     * latency but less slack before an underrun. See `status' for whether
+     * that worked.
+     */
+    AudioDevice (size_t periodFrames = AUDIO_PERIOD_FRAMES,
+                 size_t bufferFrames = AUDIO_BUFFER_FRAMES);
     ~AudioDevice ();
 
+    /* (Re)open the device, returning false if it can't be */
+    bool open ();
+    void close ();
+
+    /* DEVICE_STATUS_OK while open, otherwise DEVICE_STATUS_RECONNECTING */
+    DeviceStatus status () const;
+
+    /* Description of the last failure, empty if there hasn't been one */
+    std::string error () const;
+
     /* 
      * Returns the number of samples per period, i.e. the number of samples to
      * give to the buffer at any one time.
@@ -18,12 +63,17 @@ public:
     /* get the sound rate in Hz, e.g. 44100 */
     unsigned int getRate ();
 
-    /* 
-     * Given a buffer of length divisible by the number of samples per period,
-     * convert each period size of the buffer into correct bit format, place it
-     * in the samples buffer and then play.
+    /*
+     * Frames written but not played yet, i.e. how long until a frame
+     * written now is heard, or -1 if the device can't say.
+     */
+    long queued ();
+
+    /*
+     * Play `length' interleaved samples. Returns false if the device has
+     * been lost and needs reopening.
      */
-    void play (int16_t *buffer, size_t length);
+    bool play (const int16_t *buffer, size_t length);
 
     /* Return the internal samples buffer */
     int16_t* getSamplesBuffer ();
@@ -32,7 +82,7 @@ public:
     /* Return the length of the internal samples buffer in bytes */
     size_t getSamplesBytes ();
     /* attempt to play the samples in the samples buffer */
-    void playSamples ();
+    bool playSamples ();
 
 private:
     int16_t* samples;
@@ -44,12 +94,20 @@ private:
     size_t buffer_size;
     /* number of samples per play period */
     size_t period_size;
+    /* the sizes asked for each time the device is opened */
+    size_t period_request;
+    size_t buffer_request;
 
-    void initDevice ();
-    void setupHardware ();
-    void setupSoftware ();
+    int initDevice ();
+    int setupHardware ();
+    int setupSoftware ();
+    bool write (const int16_t *buffer, size_t frames);
+    void setError (const char *format, ...);
 
     void *device_handle;
+    std::atomic<DeviceStatus> device_status;
+    std::string error_message;
+    mutable pthread_mutex_t error_lock;
 };
 
 #endif
@@ -0,0 +1,148 @@
+#ifndef SYNTH_CONTROLMAP_HPP
+#define SYNTH_CONTROLMAP_HPP
+
+#include <atomic>
+#include <pthread.h>
+#include "RingBuffer.hpp"
+
+#define MIDI_CHANNELS 16
+#define MIDI_CONTROLS 128
+/* map a control on every channel */
+#define MIDI_OMNI -1
+
+/* Everything a MIDI controller can be mapped to */
+typedef enum _SynthParam {
+    PARAM_NONE = 0,
+    PARAM_ATTACK,
+    PARAM_DECAY,
+    PARAM_SUSTAIN,
+    PARAM_RELEASE,
+    PARAM_CUTOFF,
+    PARAM_RESONANCE,
+    PARAM_FILTER_ATTACK,
+    PARAM_FILTER_DECAY,
+    PARAM_FILTER_SUSTAIN,
+    PARAM_FILTER_RELEASE,
+    PARAM_VOLUME,
+    /* the modulation matrix's MOD_SOURCE_CONTROL */
+    PARAM_MOD_CONTROL,
+    NUM_PARAMS,
+} SynthParam;
+
+/* How a controller's travel is spread across the parameter's range */
+typedef enum _ControlCurve {
+    CONTROL_CURVE_LINEAR = 0,
+    /* fine control at the bottom of the range, e.g. for times */
+    CONTROL_CURVE_EXPONENTIAL,
+    /* fine control at the top of the range */
+    CONTROL_CURVE_LOGARITHMIC,
+    NUM_CONTROL_CURVES,
+} ControlCurve;
+
+struct ControlMapping {
+    SynthParam param;
+    double min;
+    double max;
+    ControlCurve curve;
+
+    ControlMapping ()
+        : param (PARAM_NONE)
+        , min (0.0)
+        , max (1.0)
+        , curve (CONTROL_CURVE_LINEAR)
+    { }
+
+    ControlMapping (SynthParam p, double lo, double hi, ControlCurve c)
+        : param (p)
+        , min (lo)
+        , max (hi)
+        , curve (c)
+    { }
+
+    /* Scale a controller value in [0.0, 1.0] into the parameter's range */
+    double scale (double value) const;
+};
+
+/*
+ * The table from (channel, control number) to synth parameter. Any thread may
+ * change the table; the changes are queued, one thread at a time, and the
+ * audio thread applies them at the start of its next block, so lookups on the
+ * audio thread are a single array access and never take a lock. A whole
+ * table's worth of changes can wait for it, e.g. before a synth renders its
+ * first block; past that, changes fail rather than wait.
+ */
+class ControlMap {
+public:
+    /* Starts with CCs 1-10 mapped on every channel as they always have been */
+    ControlMap ();
+    ~ControlMap ();
+
+    /*
+     * Map `control' on `channel' (0-15, or MIDI_OMNI for all channels) to a
+     * parameter, scaling the controller's travel from `min' to `max'.
+     * Returns false if the channel or control is out of range, or if the
+     * change couldn't be queued because the audio thread hasn't caught up
+     * with the changes before it.
+     */
+    bool map (int channel, int control, const ControlMapping &mapping);
+
+    /* Remove a mapping, likewise */
+    bool unmap (int channel, int control);
+
+    /* Remove every mapping, likewise */
+    bool clear ();
+
+    /*
+     * Learn mode: the next controller moved, on any channel, is mapped to
+     * the given parameter. Returns false if it couldn't be queued.
+     */
+    bool learn (const ControlMapping &mapping);
+
+    /* True while waiting for a controller to learn */
+    bool learning () const;
+
+    /*
+     * The channel and control of the last learned mapping. Returns false if
+     * nothing has been learned yet.
+     */
+    bool learned (int &channel, int &control) const;
+
+    /* Audio thread: apply queued changes to the table */
+    void update ();
+
+    /*
+     * Audio thread: the mapping for a controller, or one with PARAM_NONE if
+     * it's unmapped. In learn mode this first maps the controller.
+     */
+    const ControlMapping& find (int channel, int control);
+
+protected:
+    typedef enum _ChangeType {
+        CHANGE_MAP,
+        CHANGE_CLEAR,
+        CHANGE_LEARN,
+    } ChangeType;
+
+    struct Change {
+        ChangeType type;
+        int channel;
+        int control;
+        ControlMapping mapping;
+    };
+
+    /* Queue a change for the audio thread, false if the ring is full */
+    bool queue (const Change &change);
+    void set (int channel, int control, const ControlMapping &mapping);
+
+private:
+    ControlMapping _table[MIDI_CHANNELS][MIDI_CONTROLS];
+    RingBuffer<Change> _changes;
+    /* the ring takes one producer, so threads changing the table take turns */
+    pthread_mutex_t _changesLock;
+
+    ControlMapping _learnMapping;
+    std::atomic<bool> _learning;
+    std::atomic<int> _learned;
+};
+
+#endif
@@ -1,13 +1,13 @@
 #ifndef DEFINITIONS_HPP
 #define DEFINITIONS_HPP
 
-#define CHK(stmt, msg) if((stmt) < 0) {puts("ERROR: "#msg); exit(1);}
-
 #define DEBUG false
 #define PI    3.1415926535897932384626433832795029L
 #define TWOPI 6.2831853071795864769252867665590058L
 
 #include <algorithm>
+#include <inttypes.h>
+#include <time.h>
 
 inline double
 clamp (const double v, const double min, const double max)
@@ -15,4 +15,13 @@ clamp (const double v, const double min, const double max)
     return std::max(min, std::min(v, max));
 }
 
+/* Nanoseconds on CLOCK_MONOTONIC, the clock event arrival times are kept on */
+inline uint64_t
+monotonic_ns ()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
 #endif
@@ -0,0 +1,15 @@
+#ifndef SYNTH_DEVICESTATUS_HPP
+#define SYNTH_DEVICESTATUS_HPP
+
+typedef enum _DeviceStatus {
+    /* the synth doesn't use a device of this kind */
+    DEVICE_STATUS_NONE = 0,
+    /* open and working */
+    DEVICE_STATUS_OK,
+    /* lost or not there yet; being retried in the background */
+    DEVICE_STATUS_RECONNECTING,
+    /* couldn't be set up and won't be retried */
+    DEVICE_STATUS_FAILED,
+} DeviceStatus;
+
+#endif
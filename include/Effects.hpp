@@ -0,0 +1,157 @@
+#ifndef SYNTH_EFFECTS_HPP
+#define SYNTH_EFFECTS_HPP
+
+#include <cstddef>
+#include <vector>
+
+/*
+ * A circular buffer of past samples. Its storage is allocated once up front
+ * so the audio thread never allocates.
+ */
+class DelayLine {
+public:
+    DelayLine ();
+
+    /* Make room for delays of up to `frames' samples, clearing the line */
+    void allocate (size_t frames);
+    void clear ();
+
+    /* Push the newest sample */
+    inline void
+    write (double x)
+    {
+        _buffer[_pos] = x;
+        _pos = (_pos + 1) & _mask;
+    }
+
+    /* The sample written `delay' samples ago, delay >= 1 */
+    inline double
+    read (size_t delay) const
+    {
+        return _buffer[(_pos - delay) & _mask];
+    }
+
+    /* As read, linearly interpolated between samples */
+    inline double
+    read (double delay) const
+    {
+        size_t d = (size_t) delay;
+        double frac = delay - d;
+        double a = read(d);
+        return a + frac * (read(d + 1) - a);
+    }
+
+private:
+    std::vector<double> _buffer;
+    size_t _mask;
+    size_t _pos;
+};
+
+/*
+ * Stereo feedback delay with a lowpass in the feedback path so the repeats
+ * darken as they fade.
+ */
+class Delay {
+public:
+    Delay (unsigned long rate);
+
+    /* time in seconds, up to 2; feedback [0.0, 0.95]; mix [0.0, 1.0] */
+    void set (double time, double feedback, double mix);
+    bool enabled () const;
+    void process (double *left, double *right, size_t frames);
+
+private:
+    unsigned long _rate;
+    double _time;
+    double _feedback;
+    double _mix;
+    double _dampLeft;
+    double _dampRight;
+    DelayLine _left;
+    DelayLine _right;
+};
+
+/*
+ * Stereo chorus: a short delay swept by a sine LFO, the two channels a
+ * quarter cycle apart.
+ */
+class Chorus {
+public:
+    Chorus (unsigned long rate);
+
+    /* rate in Hz; depth and mix [0.0, 1.0] */
+    void set (double rate, double depth, double mix);
+    bool enabled () const;
+    void process (double *left, double *right, size_t frames);
+
+private:
+    unsigned long _rate;
+    double _depth;
+    double _mix;
+    /* the LFO as a rotating phasor: (cos, sin) rotated by (_cosStep, _sinStep) */
+    double _cos;
+    double _sin;
+    double _cosStep;
+    double _sinStep;
+    DelayLine _left;
+    DelayLine _right;
+};
+
+/*
+ * Schroeder-Moorer reverb after Jezar's Freeverb: eight damped feedback combs
+ * in parallel followed by four allpasses in series, per channel.
+ */
+class Reverb {
+public:
+    Reverb (unsigned long rate);
+
+    /* size, damping and mix [0.0, 1.0] */
+    void set (double size, double damping, double mix);
+    bool enabled () const;
+    void process (double *left, double *right, size_t frames);
+
+private:
+    struct Comb {
+        DelayLine line;
+        size_t length;
+        double store;
+    };
+
+    struct Allpass {
+        DelayLine line;
+        size_t length;
+    };
+
+    static const int num_combs = 8;
+    static const int num_allpasses = 4;
+
+    double _feedback;
+    double _damping;
+    double _mix;
+    Comb _combs[2][num_combs];
+    Allpass _allpasses[2][num_allpasses];
+};
+
+/*
+ * The post-mix effects bus: chorus, then delay, then reverb, run once over
+ * the summed stereo output rather than per voice. Each effect is skipped
+ * while its mix is zero, which is how they all start out.
+ */
+class Effects {
+public:
+    Effects (unsigned long rate);
+
+    void setChorus (double rate, double depth, double mix);
+    void setDelay (double time, double feedback, double mix);
+    void setReverb (double size, double damping, double mix);
+
+    /* Process a block in place */
+    void process (double *left, double *right, size_t frames);
+
+private:
+    Chorus _chorus;
+    Delay _delay;
+    Reverb _reverb;
+};
+
+#endif
@@ -9,9 +9,33 @@ typedef enum _EnvelopeStage {
     NUM_STAGES,
 } EnvelopeStage;
 
+/*
+ * The times of the attack, decay and release stages, in seconds, and the
+ * sustain level, with the sample rate the times are counted in. One is
+ * shared by every envelope of a patch rather than copied into each, and must
+ * outlive them.
+ */
+struct EnvelopeShape {
+    double values[NUM_STAGES];
+    /* counts the changes made with `set' */
+    unsigned long version;
+    /* the version each stage last changed in */
+    unsigned long changed[NUM_STAGES];
+    /* samples per second, 44100 by default; set before any envelope uses it */
+    unsigned long rate;
+
+    EnvelopeShape ();
+
+    /*
+     * Change a stage's value. Envelopes already in that stage carry on with
+     * it from their next `update', the rest when they reach it.
+     */
+    void set (EnvelopeStage stage, double value);
+};
+
 class Envelope {
 public:
-    Envelope (double ADSR[4]);
+    Envelope (const EnvelopeShape *shape);
 
     /* Place envelope in ATTACK stage or reset to ATTACK if already on */
     void noteOn ();
@@ -27,11 +51,17 @@ public:
     /* Next sample's envelope level */
     double next ();
 
-    /* update a particular stage's value */
-    void setValue (EnvelopeStage stage, double value);
+    /* The current level without advancing */
+    double level () const;
 
-    /* Set the sample rate for all envelopes created */
-    static void setRate (unsigned long rate);
+    /* The stage the envelope is in */
+    EnvelopeStage stage () const;
+
+    /*
+     * Catch up with changes to the shape, redoing the current stage if its
+     * value changed. Only a comparison when nothing has.
+     */
+    inline void update ();
 
 protected:
     EnvelopeStage getNextStage () const;
@@ -47,21 +77,30 @@ protected:
 
     void enterStage (EnvelopeStage stage);
 
+    /* Carry on with the current stage's new value */
+    void reshape ();
+
 private:
-    const double _minLevel;
+    /* what `next' touches every sample first, then the shared shape */
     double _level;
     double _multiplier;
-
-    EnvelopeStage _currStage;
-
-    double _values[NUM_STAGES];
-    EnvelopeStage _next[NUM_STAGES];
-
     unsigned long _currSample;
     unsigned long _nextStageAt;
+    EnvelopeStage _currStage;
 
-    /* Sample rate for all envelopes */
-    static unsigned long rate;
+    const EnvelopeShape *_shape;
+    /* the shape's version the envelope is up to date with */
+    unsigned long _version;
 };
 
+inline void
+Envelope::update ()
+{
+    if (_version == _shape->version)
+        return;
+    if (_shape->changed[_currStage] > _version)
+        reshape();
+    _version = _shape->version;
+}
+
 #endif
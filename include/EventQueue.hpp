@@ -0,0 +1,89 @@
+#ifndef SYNTH_EVENTQUEUE_HPP
+#define SYNTH_EVENTQUEUE_HPP
+
+#include <functional>
+#include <queue>
+#include <vector>
+#include <inttypes.h>
+#include <pthread.h>
+#include "MidiController.hpp"
+
+/*
+ * The queue of MidiEvents waiting to be played. Any thread may insert events
+ * and the audio thread removes them in bulk once per block. Events come out
+ * in frame order, those due on the same frame in the order they went in, so
+ * an event scheduled far ahead never holds up the ones after it.
+ */
+class EventQueue {
+public:
+    EventQueue ();
+    ~EventQueue ();
+
+    /* Lock the queue and insert the event. */
+    void input (MidiEvent event);
+
+    /* Insert `count' events in order, taking the lock once */
+    void input (const MidiEvent *events, size_t count);
+
+    /*
+     * Returns an Event from the queue if available. Otherwise, returns an
+     * event with type MIDI_EMPTY indicating queue is empty.
+     */
+    MidiEvent nextEvent ();
+
+    /*
+     * Move up to `max' events which are due before the frame `before' into
+     * `events' in the order they play, taking the lock once. Returns the
+     * number of events moved.
+     */
+    size_t drain (MidiEvent *events, size_t max, uint64_t before);
+
+    /*
+     * Relate arrival times to the synth's clock: frame 0 was rendered at
+     * `origin', in nanoseconds on CLOCK_MONOTONIC, and `rate' frames follow
+     * each second. From then on an event with a `time' is inserted to play
+     * `latency' frames, plus its own `frame', after the frame it arrived
+     * during, so live input keeps its spacing wherever the blocks fall.
+     * Until there is a clock such events are timed from the start of the
+     * next block. Both take the lock, so an event is never timed with half
+     * of a change.
+     */
+    void setClock (uint64_t origin, unsigned int rate);
+    void setLatency (uint64_t frames);
+
+protected:
+    /* The frame an event arriving at `time' plays on, with the lock held */
+    uint64_t frameAt (uint64_t time) const;
+
+private:
+    /* An event with where it goes in the queue */
+    struct Entry {
+        MidiEvent event;
+        /* the frame it plays on, no earlier than the next block */
+        uint64_t frame;
+        uint64_t sequence;
+
+        bool operator> (const Entry &other) const
+        {
+            if (frame != other.frame)
+                return frame > other.frame;
+            return sequence > other.sequence;
+        }
+    };
+
+    /* Queue `event' with the lock held, timing it if it has a `time' */
+    void push (const MidiEvent &event);
+
+    std::priority_queue<Entry, std::vector<Entry>, std::greater<Entry> > _queue;
+    pthread_mutex_t _lock;
+    uint64_t _sequence;
+    /* the first frame of the next block, where overdue events play */
+    uint64_t _next;
+
+    /* the clock, guarded by the lock like the queue */
+    uint64_t _origin;
+    unsigned int _rate;
+    uint64_t _latency;
+};
+
+#endif
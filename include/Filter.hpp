@@ -5,41 +5,186 @@ typedef enum _FilterMode {
     FILTER_LOWPASS = 0,
     FILTER_HIGHPASS,
     FILTER_BANDPASS,
+    NUM_FILTER_MODES,
 } FilterMode;
 
+typedef enum _FilterType {
+    /* the original four one-pole cascade */
+    FILTER_TYPE_CASCADE = 0,
+    /* 2-pole zero-delay-feedback state variable filter */
+    FILTER_TYPE_SVF,
+    /* 4-pole zero-delay-feedback ladder */
+    FILTER_TYPE_LADDER,
+    NUM_FILTER_TYPES,
+} FilterType;
+
+/* points in the cutoff -> coefficient table */
+#define FILTER_TABLE_SIZE 1024
+
 /*
- * Low/Hi/Bandpass filter
+ * The zero-delay-feedback filters need tan(pi * hz / rate) for every cutoff
+ * change, so it's tabulated over the normalized cutoff for a sample rate and
+ * interpolated. A synth's filters all share its table.
+ */
+class FilterCoefficients {
+public:
+    FilterCoefficients (unsigned long rate = 44100);
+
+    double lookup (double cutoff) const;
+
+private:
+    double _g[FILTER_TABLE_SIZE + 1];
+};
+
+/*
+ * Low/Hi/Bandpass filter.
+ *
+ * The cutoff is normalized, [0.0, 1.0]. The zero-delay-feedback types map it
+ * exponentially onto 20Hz-20kHz; see `cutoffToHz'.
  */
 class Filter {
 public:
-    Filter (const double cutoff, const double resonance);
+    /* `coefficients' must outlive the filter */
+    Filter (const double cutoff, const double resonance,
+            const FilterCoefficients *coefficients);
 
     double process (const double input);
+
+    /*
+     * As process, with the type and mode fixed at compile time so a render
+     * loop built on it has no branches on them.
+     */
+    template <FilterType Type, FilterMode Mode>
+    inline double process (const double input);
+
     void setCutoff (const double cutoff);
     void setCutoffMod (const double cutoffMod);
     void setResonance (const double resonance);
+    double resonance () const;
     void setMode (FilterMode mode);
+    FilterMode mode () const;
+    void setType (FilterType type);
+    FilterType type () const;
+
+    /* Conversion between normalized cutoffs and Hz */
+    static double cutoffToHz (double cutoff);
+    static double hzToCutoff (double hz);
 
 protected:
+    /* process for a type, dispatching on the mode */
+    template <FilterType Type>
+    double processType (const double input);
+
     void inline updateCutoff ();
     void inline updateFeedback ();
 
 private:
-    FilterMode _mode;
-
+    /* the per-sample state and coefficients first, to share cache lines */
     /* actual cutoff used when filtering */
     double _cutoff;
-    /* used as the cutoff threshold when adding the modulation */
-    double _cutoffThresh;
-    /* modulation from an envelope or whatever else */
-    double _cutoffMod;
-    double _resonance;
     double _feedback;
-    /* four filter accumulators in series */
+    /* four filter accumulators in series, the ladder's stage states */
     double _buf0;
     double _buf1;
     double _buf2;
     double _buf3;
+    /* zero-delay-feedback coefficients, only updated with the cutoff */
+    double _a1;
+    double _a2;
+    double _a3;
+    /* the SVF's two integrator states */
+    double _ic1;
+    double _ic2;
+
+    FilterMode _mode;
+    FilterType _type;
+    /* used as the cutoff threshold when adding the modulation */
+    double _cutoffThresh;
+    /* modulation from an envelope or whatever else */
+    double _cutoffMod;
+    double _resonance;
+    double _g;
+    const FilterCoefficients *_coefficients;
 };
 
+template <FilterType Type, FilterMode Mode>
+inline double
+Filter::process (const double input)
+{
+    switch (Type) {
+        case FILTER_TYPE_SVF: {
+            /* trapezoidal integrators with the feedback loop solved */
+            double v3 = input - _ic2;
+            double v1 = _a1 * _ic1 + _a2 * v3;
+            double v2 = _ic2 + _a2 * _ic1 + _a3 * v3;
+            _ic1 = 2.0 * v1 - _ic1;
+            _ic2 = 2.0 * v2 - _ic2;
+            switch (Mode) {
+                case FILTER_LOWPASS:
+                    return v2;
+                case FILTER_HIGHPASS:
+                    return input - _feedback * v1 - v2;
+                case FILTER_BANDPASS:
+                    return v1;
+                default:
+                    return 0.0;
+            }
+        }
+
+        case FILTER_TYPE_LADDER: {
+            /*
+             * Each stage is y = G*x + s/(1+g), so the output of the four is
+             * G^4 * u + S. Solving u = x - k*y4 for the feedback gives the
+             * input to the first stage without a unit delay. The input is
+             * boosted by 1+k/2, making up half of the passband level lost
+             * to resonance so it sits close to the cascade's level.
+             */
+            double G = _a1;
+            double S = ((_buf0 * G + _buf1) * G + _buf2) * G + _buf3;
+            S *= _a2;
+            double G2 = G * G;
+            double x = input * (1.0 + 0.5 * _feedback);
+            double y4 = (G2 * G2 * x + S) * _a3;
+            double u = x - _feedback * y4;
+
+            double v, y1, y2, y3;
+            v = (u - _buf0) * G;  y1 = v + _buf0;  _buf0 = y1 + v;
+            v = (y1 - _buf1) * G; y2 = v + _buf1;  _buf1 = y2 + v;
+            v = (y2 - _buf2) * G; y3 = v + _buf2;  _buf2 = y3 + v;
+            v = (y3 - _buf3) * G; y4 = v + _buf3;  _buf3 = y4 + v;
+
+            switch (Mode) {
+                case FILTER_LOWPASS:
+                    return y4;
+                case FILTER_HIGHPASS:
+                    return u - 4.0 * y1 + 6.0 * y2 - 4.0 * y3 + y4;
+                case FILTER_BANDPASS:
+                    return 4.0 * (y2 - 2.0 * y3 + y4);
+                default:
+                    return 0.0;
+            }
+        }
+
+        default:
+            break;
+    }
+
+    if (input == 0.0)
+        return input;
+    _buf0 += _cutoff * (input - _buf0 + _feedback * (_buf0 - _buf1));
+    _buf1 += _cutoff * (_buf0 - _buf1);
+    _buf2 += _cutoff * (_buf1 - _buf2);
+    _buf3 += _cutoff * (_buf2 - _buf3);
+    switch (Mode) {
+        case FILTER_LOWPASS:
+            return _buf3;
+        case FILTER_HIGHPASS:
+            return input - _buf3;
+        case FILTER_BANDPASS:
+            return _buf0 - _buf3;
+        default:
+            return 0.0;
+    }
+}
+
 #endif
@@ -0,0 +1,77 @@
+#ifndef SYNTH_JACKDEVICE_HPP
+#define SYNTH_JACKDEVICE_HPP
+
+#include <atomic>
+#include <cstddef>
+#include <string>
+#include <inttypes.h>
+#include <pthread.h>
+#include "DeviceStatus.hpp"
+#include "MidiController.hpp"
+
+/*
+ * Renders a period into `out[0]' and `out[1]', playing each of the `count'
+ * events `frame' frames into it.
+ */
+typedef void (*JackRender) (float **out, size_t frames,
+                            const MidiEvent *events, size_t count, void *data);
+
+/*
+ * A client of a JACK server, with a stereo audio output and a MIDI input.
+ * Each period is rendered from the server's process callback and copied into
+ * its port buffers, and MIDI arriving on the input plays on the exact frame
+ * the server timestamped it with.
+ *
+ * Only available when the library is built with JACK support (`make
+ * JACK=1'); otherwise the device always reports DEVICE_STATUS_FAILED.
+ */
+class JackDevice {
+public:
+    /*
+     * Register as the client `name' with the server, which must be running
+     * already. See `status' for whether that worked.
+     */
+    JackDevice (const char *name, JackRender render, void *data);
+    ~JackDevice ();
+
+    /*
+     * Start rendering, connecting the outputs to the system's playback
+     * ports. Returns false if the client couldn't be activated.
+     */
+    bool start ();
+
+    /*
+     * DEVICE_STATUS_OK while registered with the server,
+     * DEVICE_STATUS_FAILED if it couldn't be or the server has shut down.
+     */
+    DeviceStatus status () const;
+
+    /* Description of the last failure, empty if there hasn't been one */
+    std::string error () const;
+
+    /* The server's sample rate in Hz and frames per period */
+    unsigned int getRate () const;
+    size_t getPeriodSize () const;
+
+protected:
+    static int process_callback (uint32_t frames, void *data);
+    static void shutdown_callback (void *data);
+    int process (uint32_t frames);
+
+    void setError (const char *format, ...);
+
+private:
+    void *_client;
+    void *_outputs[2];
+    void *_midiInput;
+    JackRender _render;
+    void *_data;
+    /* the MIDI of the period being rendered */
+    MidiEvent *_events;
+
+    std::atomic<DeviceStatus> _status;
+    std::string _error;
+    mutable pthread_mutex_t _errorLock;
+};
+
+#endif
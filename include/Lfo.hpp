@@ -0,0 +1,52 @@
+#ifndef SYNTH_LFO_HPP
+#define SYNTH_LFO_HPP
+
+#include <inttypes.h>
+
+enum LfoWave {
+    LFO_WAVE_SINE,
+    LFO_WAVE_TRIANGLE,
+    LFO_WAVE_SAW,
+    LFO_WAVE_SQUARE,
+    /* a new random level every cycle */
+    LFO_WAVE_RANDOM,
+};
+
+/*
+ * A low-frequency oscillator used as a modulation source. It only needs to be
+ * evaluated at control rate, so it is advanced a whole control block at a
+ * time rather than per sample. Output is in the range [-1.0, 1.0].
+ */
+class Lfo {
+public:
+    Lfo ();
+
+    void setWave (enum LfoWave wave);
+    /* frequency in Hz */
+    void setRate (double rate);
+
+    /* Restart the cycle */
+    void reset ();
+
+    /* The current value */
+    double value () const;
+
+    /* Advance by `frames' samples and return the new value */
+    double advance (unsigned long frames);
+
+    /* Set the sample rate it's advanced at, 44100Hz by default */
+    void setSampleRate (unsigned long rate);
+
+private:
+    enum LfoWave _wave;
+    double _rate;
+    /* phase in cycles, [0.0, 1.0) */
+    double _phase;
+    double _value;
+    /* state for the random wave */
+    uint32_t _seed;
+    double _held;
+    unsigned long _sampleRate;
+};
+
+#endif
@@ -1,9 +1,17 @@
 #ifndef MIDICONTROLLER_HPP
 #define MIDICONTROLLER_HPP
 
+#include <atomic>
+#include <cstddef>
 #include <map>
-#include <queue>
+#include <string>
+#include <utility>
+#include <vector>
+#include <inttypes.h>
 #include <pthread.h>
+#include "DeviceStatus.hpp"
+
+class EventQueue;
 
 typedef enum _MidiEventType {
     MIDI_PITCHBEND,
@@ -16,41 +24,107 @@ typedef enum _MidiEventType {
 
 struct MidiEvent {
     MidiEventType type;
+    /* MIDI channel, 0 through 15 */
+    int channel;
     int note;
     double control;
     double velocity;
     double pitch;
+    /*
+     * The sample frame, on the Synth's clock, at which the event should take
+     * effect. Events which are already due (such as the default 0) are
+     * played at the start of the next block. For an event with a `time',
+     * how many frames after its arrival it plays instead.
+     */
+    uint64_t frame;
+    /*
+     * When a live event arrived, in nanoseconds on CLOCK_MONOTONIC, or 0 if
+     * it wasn't timestamped. The event queue turns it into a `frame'.
+     */
+    uint64_t time;
 
     MidiEvent (MidiEventType t, int n, double c, double v, double p)
         : type (t)
+        , channel (0)
         , note (n)
         , control (c)
         , velocity (v)
         , pitch (p)
+        , frame (0)
+        , time (0)
     { }
 
     MidiEvent (MidiEventType t)
         : type (t)
+        , channel (0)
         , note (0)
         , control (0.0)
         , velocity (0.0)
         , pitch (0.0)
+        , frame (0)
+        , time (0)
     { }
 
     MidiEvent ()
         : type (MIDI_UNHANDLED)
+        , channel (0)
         , note (0)
         , control (0.0)
         , velocity (0.0)
         , pitch (0.0)
+        , frame (0)
+        , time (0)
     { }
 };
 
+/*
+ * Decode a raw MIDI message, e.g. from a socket or a JACK port, into `event'.
+ * Returns false for messages the synth doesn't play.
+ */
+bool midi_decode (const unsigned char *message, size_t length, MidiEvent &event);
+
+/*
+ * Reads events from the ALSA sequencer, merging in any number of MIDI
+ * devices. Devices are named as in `aconnect -l', optionally with a port,
+ * e.g. `MPKmini2' for all of its ports or `MPKmini2:0' for just the first.
+ *
+ * The controller listens to the sequencer's announcements, so a device
+ * which isn't plugged in yet, or is unplugged and plugged back in, is
+ * connected to as soon as its ports appear. Errors are reported through
+ * `status' and `error' rather than ending the process.
+ *
+ * Events are stamped by an ALSA queue as they reach the sequencer, so the
+ * synth can play them with the spacing they were played with rather than
+ * whenever the next block happens to start.
+ */
 class MidiController {
 public:
-    MidiController (const char *midiDevice);
+    /*
+     * Events read from the sequencer are inserted into `events'. If
+     * `midiDevice' isn't NULL, it is added as with `addDevice'.
+     */
+    MidiController (const char *midiDevice, EventQueue *events);
     ~MidiController ();
 
+    /*
+     * Connect to a device now and whenever it appears. Takes effect in the
+     * background within a fraction of a second.
+     */
+    void addDevice (const char *device);
+
+    /* Disconnect from a device added before and stop looking for it */
+    void removeDevice (const char *device);
+
+    /*
+     * DEVICE_STATUS_OK while listening and connected to every device added,
+     * DEVICE_STATUS_RECONNECTING while any of them is missing,
+     * DEVICE_STATUS_FAILED if the sequencer couldn't be opened.
+     */
+    DeviceStatus status () const;
+
+    /* Description of the last failure, empty if there hasn't been one */
+    std::string error () const;
+
     double frequency () const;
     double velocity () const;
     double pitch () const;
@@ -71,19 +145,63 @@ public:
     MidiEvent nextEvent ();
 
 protected:
+    /* A device asked for: a client name and a port, or -1 for all ports */
+    struct Device {
+        std::string name;
+        int port;
+    };
+
+    /* A port connected to, and the name of the device it belongs to */
+    struct Connection {
+        int client;
+        int port;
+        std::string name;
+    };
+
+    static void* event_thread (void *data);
+    void collectEvents ();
+
+    /* Apply the devices added and removed since last time */
+    void updateDevices ();
+    /* Connect to every port of every client which matches a device */
+    void scan ();
+    /* Connect to a port if it belongs to a device asked for */
+    void connectPort (int client, int port);
+    /* Measure where the queue's clock started on CLOCK_MONOTONIC */
+    void syncQueue ();
+    /* Handle an announcement of a client or port coming or going */
+    void announce (const void *event);
+    void updateStatus ();
+
+    void setError (const char *format, ...);
 
 private:
     void *_sequencer; 
+    int _port;
+    /* the queue stamping events with their arrival time, or -1 */
+    int _queue;
+    /* the CLOCK_MONOTONIC time at which the queue's clock read zero */
+    uint64_t _queueOrigin;
+
+    /* changes to the devices wanted, handed to the event thread */
+    std::vector<std::pair<Device, bool> > _deviceChanges;
+    pthread_mutex_t _devicesLock;
+    /* only touched by the event thread once it's running */
+    std::vector<Device> _devices;
+    std::vector<Connection> _connections;
 
     double _frequency;
     double _velocity;
     double _pitch;
     int    _note;
 
-    std::queue<MidiEvent> _queue;
+    EventQueue *_events;
     pthread_t _eventThread;
-    pthread_mutex_t _eventQueueLock;
-    bool _eventThreadWorking;
+    std::atomic<bool> _eventThreadWorking;
+
+    std::atomic<DeviceStatus> _status;
+    std::string _error;
+    mutable pthread_mutex_t _errorLock;
 
     std::map<int, bool> _notes;
 };
@@ -0,0 +1,67 @@
+#ifndef SYNTH_MIDIFILE_HPP
+#define SYNTH_MIDIFILE_HPP
+
+#include <string>
+#include <vector>
+#include <inttypes.h>
+#include "MidiController.hpp"
+
+/*
+ * A Standard MIDI File (format 0 or 1). The file is parsed once when it is
+ * constructed; `events' then converts the tempo-mapped ticks of all tracks
+ * into a single time-ordered list of MidiEvents stamped with sample frames.
+ */
+class MidiFile {
+public:
+    MidiFile (const char *path);
+
+    /* Returns false if the file couldn't be read or parsed */
+    bool isOpen () const;
+
+    /* Description of why the file failed to parse */
+    const char* error () const;
+
+    /* SMF format: 0 (single track) or 1 (parallel tracks) */
+    int format () const;
+    int tracks () const;
+
+    /*
+     * All channel events of every track merged in time order, with `frame'
+     * set to the event's offset from the start of the file at `rate' Hz.
+     */
+    std::vector<MidiEvent> events (unsigned int rate) const;
+
+    /* Length of the file in frames at `rate' Hz, i.e. the last event */
+    uint64_t frames (unsigned int rate) const;
+
+protected:
+    struct TimedEvent {
+        uint64_t tick;
+        MidiEvent event;
+    };
+
+    struct Tempo {
+        uint64_t tick;
+        /* microseconds per quarter note */
+        uint32_t tempo;
+    };
+
+    bool parse (const std::vector<unsigned char> &data);
+    bool parseTrack (const unsigned char *p, const unsigned char *end);
+
+    /* convert ticks to seconds using the tempo map */
+    double seconds (uint64_t tick) const;
+
+private:
+    std::string _error;
+    int _format;
+    int _tracks;
+    /* ticks per quarter note, or ticks per second for SMPTE timing */
+    unsigned int _division;
+    bool _smpte;
+
+    std::vector<TimedEvent> _events;
+    std::vector<Tempo> _tempos;
+};
+
+#endif
@@ -0,0 +1,62 @@
+#ifndef SYNTH_MIDIPLAYER_HPP
+#define SYNTH_MIDIPLAYER_HPP
+
+#include <atomic>
+#include <vector>
+#include <pthread.h>
+#include "MidiFile.hpp"
+#include "Recorder.hpp"
+#include "Synth.hpp"
+
+/*
+ * Plays a MidiFile through a Synth. Events are scheduled on the synth's
+ * sample clock so they land on the exact frame the file asks for, whether
+ * played live in real time or rendered offline as fast as possible.
+ */
+class MidiPlayer {
+public:
+    MidiPlayer (Synth *synth, const MidiFile &file);
+    ~MidiPlayer ();
+
+    /*
+     * Start playing in real time from a background thread. Events are
+     * scheduled a little ahead of the synth's clock so they are
+     * sample-accurate despite the thread's own timing jitter.
+     */
+    void play ();
+
+    /* Stop real time playback and release any held notes */
+    void stop ();
+
+    /* True while real time playback has events left to schedule */
+    bool isPlaying () const;
+
+    /*
+     * Render the whole file, plus `tail' seconds for notes to ring out, as
+     * fast as possible, handing each block to `recorder' if given.
+     * The synth must have been created with SYNTH_DRIVER_NONE. Returns the
+     * number of frames rendered.
+     */
+    uint64_t render (Recorder *recorder, double tail = 2.0);
+
+    /* Length of the file in frames */
+    uint64_t length () const;
+
+protected:
+    static void* player_thread (void *data);
+
+    /* schedule events due before `until', relative to `start' */
+    void scheduleUntil (uint64_t start, uint64_t until);
+
+private:
+    Synth *_synth;
+    std::vector<MidiEvent> _events;
+    uint64_t _length;
+    size_t _next;
+
+    std::atomic<bool> _playing;
+    bool _threadStarted;
+    pthread_t _thread;
+};
+
+#endif
@@ -0,0 +1,77 @@
+#ifndef SYNTH_MODULATION_HPP
+#define SYNTH_MODULATION_HPP
+
+#include <cstddef>
+
+/* Voices are keyed by note, so there can never be more than this */
+#define MAX_VOICES 128
+#define NUM_LFOS 2
+#define NUM_MOD_SLOTS 8
+
+/* How often, in samples, modulation is evaluated */
+#define CONTROL_RATE 32
+
+typedef enum _ModSource {
+    MOD_SOURCE_NONE = 0,
+    /* the amplitude and filter envelopes, [0.0, 1.0] */
+    MOD_SOURCE_AMP_ENV,
+    MOD_SOURCE_FILTER_ENV,
+    /* the global LFOs, [-1.0, 1.0] */
+    MOD_SOURCE_LFO1,
+    MOD_SOURCE_LFO2,
+    /* the velocity the note was played at, [0.0, 1.0] */
+    MOD_SOURCE_VELOCITY,
+    /* the note's distance from middle C, about [-1.0, 1.0] */
+    MOD_SOURCE_NOTE,
+    /* PARAM_MOD_CONTROL, usually mapped to a controller, [0.0, 1.0] */
+    MOD_SOURCE_CONTROL,
+    NUM_MOD_SOURCES,
+} ModSource;
+
+typedef enum _ModDest {
+    MOD_DEST_NONE = 0,
+    /* in semitones */
+    MOD_DEST_PITCH,
+    /* added to the normalized cutoff */
+    MOD_DEST_CUTOFF,
+    /* added to the resonance */
+    MOD_DEST_RESONANCE,
+    /* added to the voice's gain of 1.0 */
+    MOD_DEST_AMP,
+    /* -1.0 is hard left, 1.0 is hard right */
+    MOD_DEST_PAN,
+    NUM_MOD_DESTS,
+} ModDest;
+
+struct ModSlot {
+    ModSource source;
+    ModDest dest;
+    double amount;
+};
+
+/*
+ * Routes modulation sources to destinations. The sources of every voice are
+ * gathered into one array per source, so applying a slot is a single
+ * multiply-add loop across all voices.
+ */
+class ModMatrix {
+public:
+    /* Starts with the filter envelope sweeping the cutoff */
+    ModMatrix ();
+
+    void setSlot (int slot, ModSource source, ModDest dest, double amount);
+    const ModSlot& slot (int slot) const;
+
+    /*
+     * Compute every destination for `voices' voices. `sources' and `dests'
+     * hold one row of MAX_VOICES values per source and destination.
+     */
+    void process (const double sources[NUM_MOD_SOURCES][MAX_VOICES],
+                  double dests[NUM_MOD_DESTS][MAX_VOICES],
+                  size_t voices) const;
+
+private:
+    ModSlot _slots[NUM_MOD_SLOTS];
+};
+
+#endif
@@ -1,6 +1,9 @@
 #ifndef OSCILLATOR_HPP
 #define OSCILLATOR_HPP
 
+#include <cmath>
+#include "Definitions.hpp"
+
 /*
  * A PolyBLEP oscillator. Graciously borrowed from:
  * http://www.martin-finke.de/blog/articles/audio-plugins-018-polyblep-oscillator/
@@ -15,16 +18,22 @@ enum OscillatorWave {
 
 class Oscillator {
 public:
-    static unsigned long rate;
-
     Oscillator ();
     Oscillator (bool);
 
     /* get the next sample from the oscillator */
     double next ();
 
+    /*
+     * As next, with the wave and naive setting fixed at compile time so a
+     * render loop built on it has no branches on them. Ignores muting.
+     */
+    template <enum OscillatorWave Wave, bool Naive>
+    inline double next ();
+
     void setMode  (enum OscillatorWave);
     void setFreq  (double);
+    /* multiplies the frequency, e.g. by a pitch bend's ratio */
     void setPitch (double);
     void mute ();
     void unmute ();
@@ -32,36 +41,121 @@ public:
     /* use Naive waveforms when calling 'next' instead of polyBlep */
     void useNaive (bool);
 
-    /* Set the sample rate for all oscillators */
-    static void setRate (unsigned long);
+    enum OscillatorWave mode () const;
+    bool naive () const;
+    bool muted () const;
+
+    /* Set the sample rate the oscillator plays at, 44100Hz by default */
+    void setRate (unsigned long);
 
 protected:
     /* set the phase increment using the current values */
     void setIncrement ();
 
     /* approximates the sinc function with a triangle */
-    double polyBlep (double);
+    inline double polyBlep (double);
 
-    /* produce a naive (non-BLIT) wave using the current mode */
-    double naiveWave ();
+    /* produce a naive (non-BLIT) wave */
+    template <enum OscillatorWave Wave>
+    inline double naiveWave () const;
 
 private:
     enum OscillatorWave _mode;
+    /* is muted? */
+    bool _muted;
+    /* generate naive waves instead of PolyBlep waves */
+    bool _useNaive;
+    unsigned long _rate;
 
     /* frequency */
     double _freq;
-    /* pitch modulation value */
+    /* pitch modulation as a frequency ratio */
     double _pitch;
     /* current phase */
     double _phase;
     /* phase increment */
     double _phaseIncrement;
-    /* is muted? */
-    bool _muted;
     /* holds delay value from leak intregator */
     double _lastOut;
-    /* generate naive waves instead of PolyBlep waves */
-    bool _useNaive;
 };
 
+inline double
+Oscillator::polyBlep (double t)
+{
+    double dt = _phaseIncrement / TWOPI;
+    /* 0 <= t < 1 */
+    if (t < dt) {
+        t /= dt;
+        return t + t - t * t - 1.0;
+    }
+    /* -1 < t < 0 */
+    else if (t > 1.0 - dt) {
+        t = (t - 1.0) / dt;
+        return t * t + t + t + 1.0;
+    }
+    /* 0 otherwise */
+    else {
+        return 0.0;
+    }
+}
+
+template <enum OscillatorWave Wave>
+inline double
+Oscillator::naiveWave () const
+{
+    double value = 0.0;
+    switch (Wave) {
+        case OSCILLATOR_WAVE_SINE:
+            value = sin(_phase);
+            break;
+
+        case OSCILLATOR_WAVE_SAW:
+            value = (2.0 * _phase / TWOPI) - 1.0;
+            break;
+
+        case OSCILLATOR_WAVE_SQUARE:
+            if (_phase < PI) {
+                value = 1.0;
+            } else {
+                value = -1.0;
+            }
+            break;
+
+        case OSCILLATOR_WAVE_TRIANGLE:
+            value = -1.0 + (2.0 * _phase / TWOPI);
+            value = 2.0 * (fabs(value) - 0.5);
+            break;
+    }
+    return value;
+}
+
+template <enum OscillatorWave Wave, bool Naive>
+inline double
+Oscillator::next ()
+{
+    double value = naiveWave<Wave>();
+    double t = _phase / TWOPI;
+
+    if (Naive || Wave == OSCILLATOR_WAVE_SINE) {
+        /* nothing to correct */
+    }
+    else if (Wave == OSCILLATOR_WAVE_SAW) {
+        value -= polyBlep(t);
+    }
+    else {
+        value += polyBlep(t);
+        value -= polyBlep(fmod(t + 0.5, 1.0));
+        if (Wave == OSCILLATOR_WAVE_TRIANGLE) {
+            // Leaky integrator: y[n] = A * x[n] + (1 - A) * y[n-1]
+            value = _phaseIncrement * value + (1 - _phaseIncrement) * _lastOut;
+            _lastOut = value;
+        }
+    }
+
+    _phase += _phaseIncrement;
+    while (_phase >= TWOPI)
+        _phase -= TWOPI;
+    return value;
+}
+
 #endif
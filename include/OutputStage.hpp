@@ -0,0 +1,69 @@
+#ifndef SYNTH_OUTPUTSTAGE_HPP
+#define SYNTH_OUTPUTSTAGE_HPP
+
+#include <cstddef>
+#include <cstdint>
+
+typedef enum _OutputClip {
+    /* leave the signal alone, e.g. for float files */
+    OUTPUT_CLIP_NONE = 0,
+    /* clamp to [-1.0, 1.0] */
+    OUTPUT_CLIP_HARD,
+    /* tanh-style saturation, smooth all the way to full scale */
+    OUTPUT_CLIP_SOFT,
+    /* lookahead peak limiter, delaying the output by a couple of ms */
+    OUTPUT_CLIP_LIMIT,
+} OutputClip;
+
+/*
+ * The last stage before the speakers or a file: keeps the interleaved float
+ * mix within full scale and converts whole blocks of it to integer samples,
+ * with TPDF dither if asked. Clipping and conversion use SSE2 where
+ * available.
+ */
+class OutputStage {
+public:
+    OutputStage (unsigned long rate, unsigned int channels);
+    ~OutputStage ();
+
+    void setClip (OutputClip clip);
+    OutputClip clip () const;
+
+    /* Dither integer conversions. The noise is seeded so it repeats. */
+    void setDither (bool dither);
+
+    /* Clip or limit `frames' interleaved frames in place */
+    void process (float *buffer, size_t frames);
+
+    /* Convert `samples' samples to native 16 bit or packed little-endian 24 bit */
+    void toS16 (const float *in, int16_t *out, size_t samples);
+    void toS24 (const float *in, unsigned char *out, size_t samples);
+
+protected:
+    void limit (float *buffer, size_t frames);
+
+    /* Triangular noise in [-1.0, 1.0), in LSBs */
+    inline float noise ();
+
+private:
+    OutputClip _clip;
+    bool _dither;
+    uint32_t _seed;
+    unsigned int _channels;
+
+    /* limiter: the delayed signal and the gain each frame needs */
+    size_t _lookahead;
+    float *_delay;
+    size_t _delayPos;
+    /* ascending minimum of the needed gains over the lookahead window */
+    float *_minGain;
+    uint64_t *_minFrame;
+    size_t _minHead;
+    size_t _minCount;
+    uint64_t _count;
+    float _gain;
+    float _attack;
+    float _release;
+};
+
+#endif
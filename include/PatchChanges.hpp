@@ -0,0 +1,106 @@
+#ifndef SYNTH_PATCHCHANGES_HPP
+#define SYNTH_PATCHCHANGES_HPP
+
+#include <atomic>
+#include <pthread.h>
+#include "Polyphonic.hpp"
+#include "Preset.hpp"
+#include "RingBuffer.hpp"
+#include "TripleBuffer.hpp"
+
+/*
+ * Changes to the patch made from any thread, waiting for the audio thread to
+ * apply them to the voices at the start of its next block, so only the audio
+ * thread ever touches a voice. Only the newest value of each setting is
+ * kept: setting one never blocks or fails however long it is until the next
+ * block, and the audio thread never takes a lock.
+ */
+class PatchChanges {
+public:
+    PatchChanges ();
+    ~PatchChanges ();
+
+    /* As Polyphonic's setters of the same names */
+    void setWaveForm (enum OscillatorWave wave);
+    void setADSR (EnvelopeStage stage, double value);
+    void setFilterADSR (EnvelopeStage stage, double value);
+    void setFilterCutoff (double value);
+    void setFilterResonance (double value);
+    void setFilterType (FilterType type);
+    void setBendRange (double semitones);
+    void setSampleBank (const SampleBank *bank);
+    void setLfo (int lfo, enum LfoWave wave, double rate);
+    void setModulation (int slot, ModSource source, ModDest dest, double amount);
+
+    /*
+     * Apply a whole preset at once. Its settings replace any of the same
+     * still waiting, so an older change can't undo part of it.
+     */
+    void setPreset (const Preset &preset);
+
+    /*
+     * Use a voice cache of `entries' recordings, each at most `limit'
+     * samples long. It's allocated here, and the one it replaces is freed
+     * on a later call or with this, never on the audio thread.
+     */
+    void setVoiceCache (size_t entries, size_t limit);
+
+    /*
+     * Audio thread: apply whatever changed since the last update to
+     * `polyphonic', and set `volume' to a new preset's.
+     */
+    void update (Polyphonic &polyphonic, double &volume);
+
+protected:
+    /* Each setting that changes independently of the others */
+    typedef enum _Setting {
+        SETTING_PRESET = 0,
+        SETTING_WAVEFORM,
+        SETTING_ADSR,
+        SETTING_FILTER_ADSR = SETTING_ADSR + NUM_STAGES,
+        SETTING_CUTOFF = SETTING_FILTER_ADSR + NUM_STAGES,
+        SETTING_RESONANCE,
+        SETTING_FILTER_TYPE,
+        SETTING_BEND_RANGE,
+        SETTING_SAMPLE_BANK,
+        SETTING_LFO,
+        SETTING_MODULATION = SETTING_LFO + NUM_LFOS,
+        NUM_SETTINGS = SETTING_MODULATION + NUM_MOD_SLOTS,
+    } Setting;
+
+    struct Settings {
+        /* the waveform, envelopes, filter and volume */
+        Preset patch;
+        double bendRange;
+        const SampleBank *bank;
+        enum LfoWave lfoWave[NUM_LFOS];
+        double lfoRate[NUM_LFOS];
+        ModSlot modulation[NUM_MOD_SLOTS];
+        /* how many times each setting has been changed */
+        unsigned long changes[NUM_SETTINGS];
+
+        Settings ();
+    };
+
+    /* Count a change to `setting' and hand the settings over. Lock held. */
+    void publish (Setting setting);
+
+    /* Free the voice caches the audio thread has swapped out. Lock held. */
+    void freeOldCaches ();
+
+private:
+    /* serializes the threads changing settings */
+    pthread_mutex_t _lock;
+    Settings _settings;
+    TripleBuffer<Settings> _published;
+
+    /* audio thread: the newest settings read, and the changes applied */
+    Settings _latest;
+    unsigned long _applied[NUM_SETTINGS];
+
+    /* a voice cache waiting to be put in place, and those it replaced */
+    std::atomic<VoiceCache*> _cache;
+    RingBuffer<VoiceCache*> _oldCaches;
+};
+
+#endif
@@ -1,43 +1,143 @@
 #ifndef SYNTH_POLYPHONIC_HPP
 #define SYNTH_POLYPHONIC_HPP
 
-#include <unordered_map>
 #include "Oscillator.hpp"
 #include "Envelope.hpp"
 #include "Filter.hpp"
+#include "Lfo.hpp"
+#include "Modulation.hpp"
+#include "Profile.hpp"
+#include "Sampler.hpp"
+#include "Tuning.hpp"
+#include "VoiceCache.hpp"
 
 /*
- * A singlular note.
+ * A singlular note. Each one starts on a cache line of its own, see
+ * Polyphonic's arena.
  */
-class Voice {
+class alignas(64) Voice {
 public:
+    /*
+     * The envelope shapes are the patch's and the filter coefficients the
+     * synth's, shared with the other voices
+     */
     Voice (enum OscillatorWave wave,
+              const int note,
               const double frequency,
               const double velocity,
-              double ADSR[4],
+              const EnvelopeShape *envShape,
               const double cutoff,
               const double resonance,
-              double filterADSR[4]);
+              const EnvelopeShape *filterEnvShape,
+              unsigned long rate,
+              const FilterCoefficients *coefficients);
 
     /* See Polyphonic class */
     void noteOn (const double velocity);
     void noteOff ();
     bool isActive () const;
     void setWave (enum OscillatorWave wave);
-    void setPitch (double value);
-    void setADSR (EnvelopeStage stage, double value);
+    /* The pitch bend as a frequency ratio */
+    void setPitch (double ratio);
+    /* Retune the note */
+    void setFrequency (double frequency);
     void setFilterCutoff (double value);
     void setFilterResonance (double value);
-    void setFilterADSR (EnvelopeStage stage, double value);
-    double next ();
+    void setFilterType (FilterType type);
+
+    /* Play a sample zone instead of the oscillator, from its start */
+    void setSample (const SampleZone *zone);
+
+    /* Go back to playing the oscillator, letting go of any sample zone */
+    void clearSample ();
+
+    /* Modulation sources, see ModSource */
+    int note () const;
+    double velocity () const;
+    double envLevel () const;
+    double filterEnvLevel () const;
+
+    /*
+     * Apply the modulation for the next control block. Gain and pan glide
+     * to their new values over the block to avoid zipper noise.
+     */
+    void modulate (double pitch, double cutoff, double resonance,
+                   double amp, double pan);
+
+    /* Render `frames' samples, adding them into the stereo buffers */
+    void render (double *left, double *right, size_t frames);
+
+    /*
+     * Record the note into `recording' as it plays, or play it back from a
+     * finished one with the same key. Only for a voice that hasn't been
+     * modulated or rendered yet. See VoiceCache.
+     */
+    void record (VoiceRecording *recording);
+    void play (VoiceRecording *recording);
+
+    /*
+     * Stop recording or playing back, carrying on live from exactly where
+     * the recording had got to. Done before anything changes the voice.
+     */
+    void diverge ();
+
+protected:
+    /*
+     * render, built for one sound source (see Polyphonic.cpp) and filter
+     * type and mode, and whether to record the voice's output. render picks
+     * the one for the voice once per block.
+     */
+    template <int Source, FilterType Type, FilterMode Mode, bool Record = false>
+    void render (double *left, double *right, size_t frames);
+
+    /* The next sample before the gains */
+    template <int Source, FilterType Type, FilterMode Mode>
+    inline double next ();
+
+    /* Add the voice's state to the recording, and go back to one */
+    void snapshot ();
+    void restore (const VoiceSnapshot &state);
 
 private:
-    bool _isActive;
+    /*
+     * What the render loop touches every sample comes first, so it spans
+     * as few cache lines as it can, and what's only used once a control
+     * block or once a note after it.
+     */
     double _velocity;
-    Filter _filter;
+    /* stereo gains now, and their steps over the control block */
+    double _gainLeft;
+    double _gainRight;
+    double _stepLeft;
+    double _stepRight;
+    size_t _rampFrames;
+    /* where the next sample is recorded to or played back from */
+    double *_tap;
     Envelope _env;
     Envelope _filterEnv;
     Oscillator _oscillator;
+    Filter _filter;
+
+    /* the stereo gains at the end of the control block */
+    double _targetLeft;
+    double _targetRight;
+    bool _isActive;
+    /* play the sampler rather than the oscillator */
+    bool _sampled;
+    int _note;
+    double _freq;
+    double _resonance;
+    /* last pitch modulation applied, in semitones */
+    double _pitchMod;
+    Sampler _sampler;
+
+    /* samples rendered since the voice was created */
+    size_t _age;
+    /* the recording being made or played back, if any */
+    VoiceRecording *_recording;
+    bool _playing;
+    /* the snapshot the playback restores next */
+    size_t _snapshot;
 };
 
 /*
@@ -46,13 +146,17 @@ private:
  */
 class Polyphonic {
 public:
-    /* ADSR and Filter's ADSR + filter's cutoff and resonance */
+    /*
+     * ADSR and Filter's ADSR + filter's cutoff and resonance, playing at
+     * `rate' samples per second
+     */
     Polyphonic (double a,  double d,  double s,  double r,
                 double fa, double fd, double fs, double fr,
-                double cutoff, double resonance);
+                double cutoff, double resonance, unsigned long rate);
+    ~Polyphonic ();
 
     /* Turn a note on and off */
-    void noteOn (const int note, const double velocity);
+    void noteOn (const int note, double velocity);
     void noteOff (const int note);
 
     /* Returns whether a note is currently playing or not */
@@ -61,13 +165,26 @@ public:
     /* Update the waveform for current and future notes */
     void setWaveForm (enum OscillatorWave wave);
 
-    /* Update the pitch for current and future notes */
+    /*
+     * Bend the pitch of current and future notes, [-1.0, 1.0] covering the
+     * bend range either way.
+     */
     void setPitch (double value);
 
-    /* Update the ADSR for current and future notes */
+    /* How far a full pitch bend goes, in semitones. Defaults to 2. */
+    void setBendRange (double semitones);
+
+    /* Retune current and future notes */
+    void setTuning (const Tuning &tuning);
+
+    /*
+     * Update the ADSR for current and future notes. The patch's envelope
+     * shape changes once, whatever the number of voices; notes in that
+     * stage carry on with the new value from their next control block.
+     */
     void setADSR (EnvelopeStage stage, double value);
 
-    /* Update the filter's ADSR for current and future notes */
+    /* Update the filter's ADSR for current and future notes, likewise */
     void setFilterADSR (EnvelopeStage stage, double value);
     
     /* Update the filter's cutoff for current and future notes */
@@ -76,16 +193,123 @@ public:
     /* Update the filter's resonance for current and future notes */
     void setFilterResonance (double value);
 
-    /* Get the next sample */
-    double next ();
+    /* Switch filter design for current and future notes */
+    void setFilterType (FilterType type);
+
+    /*
+     * Play future notes from a sample bank instead of the oscillator, or
+     * from the oscillator again if NULL. Notes without a zone are silent.
+     */
+    void setSampleBank (const SampleBank *bank);
+
+    /*
+     * Update every parameter at once for current and future notes, visiting
+     * each voice a single time.
+     */
+    void setPatch (enum OscillatorWave wave,
+                   const double ADSR[4],
+                   const double filterADSR[4],
+                   double cutoff,
+                   double resonance,
+                   FilterType filterType);
+
+    /* Set the waveform and rate of one of the LFOs */
+    void setLfo (int lfo, enum LfoWave wave, double rate);
+
+    /* Route a modulation source to a destination. See ModMatrix */
+    void setModulation (int slot, ModSource source, ModDest dest, double amount);
+
+    /* Set the value of MOD_SOURCE_CONTROL, [0.0, 1.0] */
+    void setModControl (double value);
+
+    /*
+     * Play notes back from the recordings of `cache' when they would sound
+     * the same, or turn that off with an empty one, trading it for the
+     * cache in use so that can be freed off the audio thread. See
+     * VoiceCache.
+     *
+     * While it's on, velocities are rounded to MIDI's 127 steps, and a new
+     * note is modulated on its own as it starts instead of every voice
+     * being modulated again then, so a note sounds the same however the
+     * notes around it fall.
+     */
+    void setVoiceCache (VoiceCache &cache);
+
+    /*
+     * Render `frames' stereo samples of every playing note into `left' and
+     * `right', replacing their contents.
+     */
+    void render (double *left, double *right, size_t frames);
+
+    /* Fill in the voice count and lifetimes of a profiled block */
+    void profile (ProfileBlock &block) const;
+
+protected:
+    /* Drop the voice at `index' of the arena, moving the last into its place */
+    void removeVoice (size_t index);
+
+    /* Have every voice playing from or recording to the cache go live */
+    void divergeVoices ();
+
+    /* Evaluate the modulation matrix for every voice */
+    void updateModulation ();
+
+    /* Evaluate it for just `voice', with the LFOs where they are */
+    void modulateVoice (Voice &voice);
+
+    /* Put the sources of `voice' in column `column' of the source table */
+    void gatherSources (Voice &voice, size_t column, double lfo1, double lfo2);
+
+    /*
+     * Whether new notes can be played from the cache: oscillator notes
+     * whose pitch and filter aren't modulated by anything outside them.
+     */
+    bool cacheable () const;
+
+    /* What a new note sounds like, see VoiceKey */
+    VoiceKey voiceKey (int note, double frequency, double velocity,
+                       size_t phase) const;
 
 private:
-    double _noteADSR[4];
-    double _filterADSR[4];
+    unsigned long _rate;
+    FilterCoefficients _filterCoefficients;
+    EnvelopeShape _envShape;
+    EnvelopeShape _filterEnvShape;
     double _filterResonance;
     double _filterCutoff;
+    FilterType _filterType;
+    const SampleBank *_bank;
+    Tuning _tuning;
+    double _bendRange;
+    /* the pitch bend as a ratio, shared by every voice */
+    double _bendValue;
+    double _bend;
     enum OscillatorWave _waveform;
-    std::unordered_map<int, Voice> _notes;
+    /*
+     * The playing voices, packed at the start of a cache-line aligned arena
+     * of MAX_VOICES so rendering walks them in order through memory, and
+     * each note's voice, if it has one.
+     */
+    Voice *_voices;
+    size_t _voiceCount;
+    Voice *_noteVoices[MAX_VOICES];
+
+    ModMatrix _matrix;
+    Lfo _lfos[NUM_LFOS];
+    double _modControl;
+    /* samples left until modulation is next evaluated */
+    size_t _controlCountdown;
+    /* samples since modulation was last evaluated */
+    size_t _controlElapsed;
+    double _sources[NUM_MOD_SOURCES][MAX_VOICES];
+    double _dests[NUM_MOD_DESTS][MAX_VOICES];
+
+    VoiceCache _cache;
+
+    /* voice lifetimes, only counted when profiling */
+    unsigned long _spawned;
+    unsigned long _stolen;
+    unsigned long _retired;
 };
 
 #endif
@@ -0,0 +1,56 @@
+#ifndef SYNTH_PRESET_HPP
+#define SYNTH_PRESET_HPP
+
+#include <cstddef>
+#include "Oscillator.hpp"
+#include "Envelope.hpp"
+#include "Filter.hpp"
+
+typedef enum _PresetFormat {
+    /* `key = value' lines, for editing by hand */
+    PRESET_TEXT = 0,
+    /* fixed-size little-endian record, for loading quickly */
+    PRESET_BINARY,
+} PresetFormat;
+
+/*
+ * A complete patch: everything needed to make a Synth sound a certain way.
+ * Applied to a Synth all at once with `Synth::setPreset'.
+ */
+struct Preset {
+    enum OscillatorWave waveform;
+    double adsr[NUM_STAGES];
+    double filterADSR[NUM_STAGES];
+    double cutoff;
+    double resonance;
+    FilterType filter;
+    double volume;
+
+    /* The Synth's default sound */
+    Preset ();
+
+    /*
+     * Load a preset from a file in either format; binary files are detected
+     * by their header. Keys missing from a text file keep their current
+     * value. Returns false and leaves the preset untouched on failure.
+     */
+    bool load (const char *path);
+
+    /* Save the preset in the given format. Returns false on failure. */
+    bool save (const char *path, PresetFormat format) const;
+
+    /*
+     * Look up one of the built-in presets by name: default, acid or pluck.
+     * Returns false if there's no such preset.
+     */
+    static bool builtin (const char *name, Preset &preset);
+
+    /* Clamp every value to the ranges the Synth setters accept */
+    void clampValues ();
+
+protected:
+    bool loadText (const char *text);
+    bool loadBinary (const unsigned char *data, size_t length);
+};
+
+#endif
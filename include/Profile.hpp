@@ -0,0 +1,92 @@
+#ifndef SYNTH_PROFILE_HPP
+#define SYNTH_PROFILE_HPP
+
+#include <cstddef>
+#include <inttypes.h>
+#ifdef SYNTH_PROFILE
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#else
+#include <time.h>
+#endif
+#endif
+
+/*
+ * Where the audio thread's time goes, block by block, for deciding which
+ * patches a host can afford. Only measured when the library is built with
+ * SYNTH_PROFILE defined (`make PROFILE=1'); otherwise none of it is compiled
+ * into the render loop.
+ */
+typedef enum _ProfileStage {
+    /* per voice and sample: the oscillator or the sampler */
+    PROFILE_SOURCE = 0,
+    /* per voice and sample: the amplitude and filter envelopes */
+    PROFILE_ENVELOPES,
+    /* per voice and sample */
+    PROFILE_FILTER,
+    /* per control block: dropping finished voices, the LFOs and matrix */
+    PROFILE_MODULATION,
+    PROFILE_EFFECTS,
+    /* the volume, clipping and dither */
+    PROFILE_OUTPUT,
+    NUM_PROFILE_STAGES,
+} ProfileStage;
+
+struct ProfileBlock {
+    /* the block's first frame and length */
+    uint64_t frame;
+    size_t frames;
+    /* voices sounding at the end of the block */
+    size_t voices;
+    /*
+     * Cycles spent in each stage and in the whole block, which also covers
+     * mixing and events. Timestamp counter ticks on x86, nanoseconds
+     * elsewhere. Timing each sample adds its own cost to the voice stages.
+     */
+    uint64_t cycles[NUM_PROFILE_STAGES];
+    uint64_t total;
+    /*
+     * Voices started for a new note, restarted while still sounding, and
+     * finished, since the synth was created.
+     */
+    unsigned long spawned;
+    unsigned long stolen;
+    unsigned long retired;
+};
+
+/*
+ * Called on the rendering thread after every block. It must return quickly
+ * and not block, as it holds up the audio.
+ */
+typedef void (*ProfileCallback) (const ProfileBlock &block, void *data);
+
+#ifdef SYNTH_PROFILE
+/* the stage tallies of the block being rendered on this thread */
+extern thread_local uint64_t profile_cycles[NUM_PROFILE_STAGES];
+
+inline uint64_t
+profile_clock ()
+{
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+#endif
+}
+
+#define PROFILE_START(t) uint64_t t = profile_clock()
+#define PROFILE_LAP(t, stage) do { \
+        uint64_t lap_ = profile_clock(); \
+        profile_cycles[stage] += lap_ - t; \
+        t = lap_; \
+    } while (0)
+#define PROFILE_COUNT(counter) ((counter)++)
+#else
+#define PROFILE_START(t)
+#define PROFILE_LAP(t, stage)
+#define PROFILE_COUNT(counter)
+#endif
+
+#endif
@@ -0,0 +1,90 @@
+#ifndef SYNTH_RECORDER_HPP
+#define SYNTH_RECORDER_HPP
+
+#include <atomic>
+#include <cstdio>
+#include <pthread.h>
+#include "OutputStage.hpp"
+#include "RingBuffer.hpp"
+
+typedef enum _RecorderFormat {
+    RECORDER_S16 = 0,
+    RECORDER_S24,
+    RECORDER_FLOAT,
+} RecorderFormat;
+
+typedef enum _RecorderContainer {
+    RECORDER_WAV = 0,
+    RECORDER_RAW,
+} RecorderContainer;
+
+/*
+ * Streams interleaved float audio to disk. Blocks are handed over from the
+ * audio thread through a lock-free ring and a background thread converts
+ * them to the requested format and writes them in large chunks, so no file
+ * I/O ever happens on the real-time thread.
+ */
+class Recorder {
+public:
+    Recorder (const char *path,
+              RecorderFormat format,
+              RecorderContainer container,
+              unsigned int rate,
+              unsigned int channels);
+
+    /* Drains anything left in the ring, finalizes the header and closes */
+    ~Recorder ();
+
+    /* Returns false if the output file could not be opened */
+    bool isOpen () const;
+
+    /*
+     * Queue `frames' interleaved frames for writing. Never blocks: if the I/O
+     * thread has fallen behind the frames which do not fit are dropped and
+     * counted. Returns the number of frames queued.
+     */
+    size_t write (const float *buffer, size_t frames);
+
+    /*
+     * Queue all `frames' frames, waiting for the I/O thread to make room
+     * rather than dropping any. For offline rendering only.
+     */
+    void writeAll (const float *buffer, size_t frames);
+
+    /* Number of frames dropped because the ring was full */
+    unsigned long dropped () const;
+
+    /* Number of frames written to disk so far */
+    unsigned long written () const;
+
+protected:
+    static void* io_thread (void *data);
+
+    /* Convert and write up to a chunk's worth of the ring. Returns frames. */
+    size_t flush ();
+    void writeHeader ();
+
+private:
+    FILE *_file;
+    RecorderFormat _format;
+    RecorderContainer _container;
+    unsigned int _rate;
+    unsigned int _channels;
+    unsigned int _bytesPerSample;
+    /* dithered block conversion to the integer formats */
+    OutputStage _output;
+
+    RingBuffer<float> *_ring;
+    /* float samples pulled off the ring and their converted bytes */
+    float *_chunk;
+    unsigned char *_bytes;
+    size_t _chunkFrames;
+
+    std::atomic<unsigned long> _dropped;
+    std::atomic<unsigned long> _written;
+
+    std::atomic<bool> _running;
+    pthread_t _thread;
+};
+
+#endif
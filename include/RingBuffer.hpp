@@ -0,0 +1,95 @@
+#ifndef SYNTH_RINGBUFFER_HPP
+#define SYNTH_RINGBUFFER_HPP
+
+#include <atomic>
+#include <cstddef>
+
+/*
+ * A single-producer, single-consumer lock-free ring buffer. One thread may
+ * call `write' while another calls `read' without any locking, which makes it
+ * safe to hand data off from the audio thread. The capacity is rounded up to
+ * a power of two and all storage is allocated up front.
+ */
+template <typename T>
+class RingBuffer {
+public:
+    RingBuffer (size_t capacity)
+        : _head (0)
+        , _tail (0)
+    {
+        _size = 1;
+        while (_size < capacity)
+            _size <<= 1;
+        _mask = _size - 1;
+        _buffer = new T[_size];
+    }
+
+    ~RingBuffer ()
+    {
+        delete[] _buffer;
+    }
+
+    /* Number of elements which can be read */
+    size_t readable () const
+    {
+        return _tail.load(std::memory_order_acquire)
+             - _head.load(std::memory_order_relaxed);
+    }
+
+    /* Number of elements which can be written */
+    size_t writable () const
+    {
+        return _size - (_tail.load(std::memory_order_relaxed)
+                      - _head.load(std::memory_order_acquire));
+    }
+
+    /*
+     * Copy up to `count' elements into the ring. Returns the number actually
+     * written, which is less than `count' when the ring is full. Producer only.
+     */
+    size_t write (const T *data, size_t count)
+    {
+        size_t tail = _tail.load(std::memory_order_relaxed);
+        size_t space = _size - (tail - _head.load(std::memory_order_acquire));
+        if (count > space)
+            count = space;
+        for (size_t i = 0; i < count; i++)
+            _buffer[(tail + i) & _mask] = data[i];
+        _tail.store(tail + count, std::memory_order_release);
+        return count;
+    }
+
+    /*
+     * Copy up to `count' elements out of the ring. Returns the number actually
+     * read. Consumer only.
+     */
+    size_t read (T *data, size_t count)
+    {
+        size_t head = _head.load(std::memory_order_relaxed);
+        size_t avail = _tail.load(std::memory_order_acquire) - head;
+        if (count > avail)
+            count = avail;
+        for (size_t i = 0; i < count; i++)
+            data[i] = _buffer[(head + i) & _mask];
+        _head.store(head + count, std::memory_order_release);
+        return count;
+    }
+
+    /* Convenience wrappers for single elements */
+    bool push (const T &value) { return write(&value, 1) == 1; }
+    bool pop (T &value) { return read(&value, 1) == 1; }
+
+private:
+    RingBuffer (const RingBuffer&);
+    RingBuffer& operator= (const RingBuffer&);
+
+    T *_buffer;
+    size_t _size;
+    size_t _mask;
+    /* read position, only modified by the consumer */
+    std::atomic<size_t> _head;
+    /* write position, only modified by the producer */
+    std::atomic<size_t> _tail;
+};
+
+#endif
@@ -0,0 +1,133 @@
+#ifndef SYNTH_SAMPLEBANK_HPP
+#define SYNTH_SAMPLEBANK_HPP
+
+#include <cstddef>
+#include <cstring>
+#include <map>
+#include <string>
+#include <vector>
+#include <inttypes.h>
+
+typedef enum _SampleFormat {
+    SAMPLE_S16 = 0,
+    SAMPLE_S24,
+    SAMPLE_FLOAT,
+} SampleFormat;
+
+/*
+ * One sample of a multi-sampled instrument and the notes and velocities it
+ * covers. The sample data points straight into the memory-mapped file.
+ */
+struct SampleZone {
+    const unsigned char *data;
+    SampleFormat format;
+    unsigned int channels;
+    unsigned int bytesPerFrame;
+    size_t frames;
+    unsigned int rate;
+
+    /* the note the sample plays at its recorded pitch */
+    int root;
+    /* inclusive ranges of notes and velocities (0-127) */
+    int lowKey;
+    int highKey;
+    int lowVelocity;
+    int highVelocity;
+    /* loop between these frames while the note plays, if end > start */
+    size_t loopStart;
+    size_t loopEnd;
+
+    /* A frame's channels mixed to mono, [-1.0, 1.0] */
+    inline double
+    value (size_t frame) const
+    {
+        const unsigned char *p = data + frame * bytesPerFrame;
+        double sum = 0.0;
+        for (unsigned int c = 0; c < channels; c++) {
+            switch (format) {
+                case SAMPLE_S16:
+                    sum += (int16_t) (p[0] | (p[1] << 8)) / 32768.0;
+                    p += 2;
+                    break;
+                case SAMPLE_S24:
+                    sum += ((int32_t) ((p[0] << 8) | (p[1] << 16)
+                                | ((uint32_t) p[2] << 24)) >> 8) / 8388608.0;
+                    p += 3;
+                    break;
+                case SAMPLE_FLOAT:
+                {
+                    float f;
+                    memcpy(&f, p, sizeof(f));
+                    sum += f;
+                    p += 4;
+                    break;
+                }
+            }
+        }
+        return channels > 1 ? sum / channels : sum;
+    }
+};
+
+/*
+ * A set of sample zones loaded from a bank file or a single WAV file. The
+ * WAV files are memory-mapped rather than read, so pages are only loaded as
+ * notes play them and any number of banks, in any number of synths, share
+ * the same memory through the page cache. The first moments of each sample
+ * are paged in when the bank loads so attacks never wait on the disk.
+ *
+ * A bank file has one zone per `sample' line, followed by its settings:
+ *
+ *     sample = piano/C4.wav
+ *     root = 60
+ *     low_key = 55
+ *     high_key = 65
+ *     low_velocity = 0
+ *     high_velocity = 127
+ *     loop_start = 10240
+ *     loop_end = 40960
+ *
+ * Paths are relative to the bank file. Root and loop points default to those
+ * in the WAV's `smpl' chunk, if any; a zone covers every note and velocity
+ * unless told otherwise. Banks can't be changed once loaded.
+ */
+class SampleBank {
+public:
+    SampleBank (const char *path);
+    ~SampleBank ();
+
+    /* Returns false if the bank or any of its samples couldn't be loaded */
+    bool isOpen () const;
+
+    /* Description of why the bank failed to load */
+    const char* error () const;
+
+    /*
+     * The first zone covering a note at a velocity in [0.0, 1.0], or NULL
+     * if none do.
+     */
+    const SampleZone* find (int note, double velocity) const;
+
+    size_t zones () const;
+
+    /* Total size of the mapped sample files */
+    size_t mappedBytes () const;
+
+protected:
+    struct Mapping {
+        void *address;
+        size_t length;
+    };
+
+    bool loadBank (const char *path);
+    bool loadSample (const std::string &path, SampleZone &zone);
+    const Mapping* map (const std::string &path);
+    void preload (const SampleZone &zone);
+
+private:
+    std::string _error;
+    std::vector<SampleZone> _zones;
+    /* each file is only mapped once, however many zones use it */
+    std::map<std::string, Mapping> _maps;
+};
+
+#endif
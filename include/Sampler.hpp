@@ -0,0 +1,41 @@
+#ifndef SYNTH_SAMPLER_HPP
+#define SYNTH_SAMPLER_HPP
+
+#include "SampleBank.hpp"
+
+/*
+ * Plays a sample zone as a voice's sound source in place of an Oscillator,
+ * resampling it with linear interpolation to the note's frequency.
+ */
+class Sampler {
+public:
+    Sampler ();
+
+    /* Start playing `zone' from the beginning. NULL stops playing. */
+    void start (const SampleZone *zone);
+
+    /* Same meanings as the Oscillator's */
+    void setFreq (double freq);
+    void setPitch (double pitch);
+    void setRate (unsigned long rate);
+
+    /* The next sample, silence once a sample without a loop has ended */
+    double next ();
+
+protected:
+    void setIncrement ();
+
+private:
+    const SampleZone *_zone;
+    /* position in frames of the zone */
+    double _position;
+    double _increment;
+    double _freq;
+    /* the frequency the zone plays at its recorded pitch */
+    double _rootFreq;
+    double _pitch;
+    /* the output's sample rate */
+    unsigned long _rate;
+};
+
+#endif
@@ -0,0 +1,84 @@
+#ifndef SYNTH_SOCKETINPUT_HPP
+#define SYNTH_SOCKETINPUT_HPP
+
+#include <atomic>
+#include <cstddef>
+#include <string>
+#include <inttypes.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include "MidiController.hpp"
+
+class EventQueue;
+
+/*
+ * Events sent over a socket, for driving a synth from another process or
+ * machine without the ALSA sequencer in between. Addresses are either
+ * `unix:<path>' for a Unix domain datagram socket or `udp:[<host>:]<port>'
+ * (the host defaulting to 127.0.0.1).
+ *
+ * Each datagram is the four bytes `SYN\1' followed by up to
+ * `socket_max_events' events of eight bytes each:
+ *
+ *     byte 0     MIDI status: 0x80 note off, 0x90 note on, 0xb0 control
+ *                change or 0xe0 pitch bend, with the channel in the low bits
+ *     bytes 1-2  the MIDI data bytes, e.g. note and velocity
+ *     byte 3     zero
+ *     bytes 4-7  little-endian frame offset
+ *
+ * An event plays `offset' frames after its datagram arrives, so a sender can
+ * batch a stretch of events and keep their relative timing exact however
+ * the network delays the batch.
+ */
+static const size_t socket_max_events = 128;
+static const size_t socket_event_size = 8;
+static const size_t socket_header_size = 4;
+
+/*
+ * Receives events on a socket in a thread of its own and inserts them into
+ * the synth's queue, stamped with when they arrived for the queue to time
+ * against the sample clock. Everything which arrived together is inserted
+ * under one lock.
+ */
+class SocketInput {
+public:
+    SocketInput (const char *address, EventQueue *events);
+    ~SocketInput ();
+
+    /* Returns false if the socket couldn't be opened */
+    bool isOpen () const;
+
+protected:
+    static void* receive_thread (void *data);
+    void receive ();
+
+private:
+    int _socket;
+    /* the socket's path, removed on close, for unix sockets */
+    std::string _path;
+    EventQueue *_events;
+    std::atomic<bool> _running;
+    pthread_t _thread;
+};
+
+/*
+ * The sending end, for test tools and client services. Each event's `frame'
+ * is sent as its offset rather than a time on the receiving synth's clock.
+ */
+class SocketClient {
+public:
+    SocketClient (const char *address);
+    ~SocketClient ();
+
+    bool isOpen () const;
+
+    /* Send `count' events, as few datagrams as it takes. */
+    bool send (const MidiEvent *events, size_t count);
+
+private:
+    int _socket;
+    struct sockaddr_storage _address;
+    socklen_t _addressLen;
+};
+
+#endif
@@ -1,10 +1,37 @@
 #ifndef SYNTH_HPP
 #define SYNTH_HPP
 
+#include <atomic>
+#include <string>
 #include <pthread.h>
 #include "AudioDevice.hpp"
+#include "ControlMap.hpp"
+#include "Effects.hpp"
+#include "EventQueue.hpp"
+#include "JackDevice.hpp"
 #include "MidiController.hpp"
+#include "OutputStage.hpp"
+#include "PatchChanges.hpp"
 #include "Polyphonic.hpp"
+#include "Preset.hpp"
+#include "Profile.hpp"
+#include "Recorder.hpp"
+#include "Tuning.hpp"
+#include "TripleBuffer.hpp"
+#include "SocketInput.hpp"
+
+typedef enum _SynthDriver {
+    /* audio thread playing through ALSA, MIDI from the ALSA sequencer */
+    SYNTH_DRIVER_ALSA = 0,
+    /* no thread, device or sequencer; audio is pulled with `render' */
+    SYNTH_DRIVER_NONE,
+    /*
+     * a client of a running JACK server, rendering from its process
+     * callback, with MIDI from its `midi_in' port. Needs the library built
+     * with `make JACK=1'.
+     */
+    SYNTH_DRIVER_JACK,
+} SynthDriver;
 
 class Synth {
 public:
@@ -15,6 +42,21 @@ public:
     Synth (const char *midiDevice);
     Synth (const std::string midiDevice);
 
+    /*
+     * Create a Synth using the given driver. With SYNTH_DRIVER_NONE nothing
+     * plays by itself: call `render' to produce audio, e.g. to render
+     * offline faster than real time. With SYNTH_DRIVER_JACK, see
+     * `audioStatus' for whether the server was there.
+     */
+    Synth (SynthDriver driver);
+
+    /*
+     * The same at a sample rate other than 44100Hz, e.g. a host's. Each
+     * synth keeps its own, so synths at different rates can play side by
+     * side.
+     */
+    Synth (SynthDriver driver, unsigned int rate);
+
     ~Synth ();
 
     /*
@@ -42,6 +84,13 @@ public:
      */
     void setCutoff (const double value) const;
 
+    /*
+     * Set the cutoff in Hz, 20Hz to 20kHz. Exact for the zero-delay-feedback
+     * filter types; the cascade filter maps it onto the same normalized
+     * cutoff as setCutoff, which only reaches about 21Hz to 18.7kHz.
+     */
+    void setCutoffHz (const double hz) const;
+
     /* 
      * Set the resonance of the lowpass filter. Clamps values to range
      * [0.0, 0.99]
@@ -57,6 +106,98 @@ public:
     void setFilterSustain (const double value) const;
     void setFilterRelease (const double value) const;
 
+    /*
+     * Choose the filter design: the original cascade, or the zero-delay-
+     * feedback state variable or ladder filters, which stay stable at high
+     * resonance and under fast cutoff modulation.
+     */
+    void setFilterType (FilterType type) const;
+
+    /*
+     * Play notes from a sample bank instead of the oscillator, through the
+     * same envelopes and filter, or go back to the oscillator with NULL.
+     * Applies to notes started from now on. The bank isn't copied and must
+     * outlive its use; one bank can be shared by any number of synths.
+     */
+    void setSampleBank (const SampleBank *bank) const;
+
+    /*
+     * Remember how the last `entries' distinct notes started and play them
+     * back from memory when they are played again with the same patch and
+     * velocity, instead of synthesizing them. Each recording is of the
+     * attack and decay, up to a second, and the note goes back to being
+     * synthesized from where it is once it reaches sustain, is released or
+     * anything about it changes. Notes whose pitch or filter an LFO or the
+     * mod control moves, and sample bank notes, are always synthesized.
+     * Percussive patches, which are all attack and decay, gain the most.
+     *
+     * With the cache on, velocities are rounded to MIDI's 127 steps and a
+     * new note doesn't restart the other voices' control block, so output
+     * differs very slightly from the same synth without it. Each entry
+     * takes about 1MB at 44.1kHz, all allocated here. 0, the default, turns
+     * it off. Set it before playing any notes.
+     */
+    void setVoiceCache (size_t entries) const;
+
+    /*
+     * Set the waveform and rate in Hz of LFO 0 or 1. The LFOs are
+     * modulation sources; route them with setModulation.
+     */
+    void setLfo (int lfo, LfoWave wave, double rate) const;
+
+    /*
+     * Route a modulation source to a destination in one of the
+     * NUM_MOD_SLOTS slots of the modulation matrix, scaled by `amount'.
+     * Modulation is evaluated every CONTROL_RATE samples. Slot 0 starts out
+     * routing the filter envelope to the cutoff. See Modulation.hpp
+     */
+    void setModulation (int slot, ModSource source, ModDest dest,
+                        double amount) const;
+
+    /*
+     * The effects bus, run over the mixed output of every note. Each effect
+     * is off while its mix is 0.0, as it is by default.
+     *
+     * Chorus: LFO rate in Hz, depth and mix [0.0, 1.0].
+     * Delay: time in seconds up to 2.0, feedback [0.0, 0.95], mix [0.0, 1.0].
+     * Reverb: room size, damping and mix [0.0, 1.0].
+     */
+    void setChorus (double rate, double depth, double mix) const;
+    void setDelay (double time, double feedback, double mix) const;
+    void setReverb (double size, double damping, double mix) const;
+
+    /*
+     * How the output is kept within full scale: hard clipping (the
+     * default), soft clipping, a lookahead limiter or not at all. Applies to
+     * recordings and rendered audio as well as what's played. Integer output
+     * is always dithered.
+     */
+    void setOutputClip (OutputClip clip) const;
+
+    /*
+     * Switch to a whole new patch at once. The audio thread picks it up at
+     * the start of its next block so every parameter changes together, and
+     * the volume glides to its new level rather than jumping. Call from one
+     * control thread at a time.
+     */
+    void setPreset (const Preset &preset);
+
+    /*
+     * Retune every note, playing or not. Like setPreset, the audio thread
+     * switches to the new table at the start of its next block. Call from
+     * one control thread at a time.
+     */
+    void setTuning (const Tuning &tuning);
+
+    /* How far a full pitch bend goes, in semitones. Defaults to 2. */
+    void setPitchBendRange (double semitones) const;
+
+    /*
+     * The table mapping MIDI controllers to parameters. Mappings may be
+     * changed, or learned, from any thread while the synth is playing.
+     */
+    ControlMap& controls ();
+
     /* 
      * Turn a single note on, playing it. Velocity is a value clamped to 
      * [0.0, 1.0] and reflects how loudly the note is played, i.e how hard it
@@ -77,17 +218,205 @@ public:
      */
     bool noteActive (const int note) const;
 
+    /*
+     * Start streaming everything the synth plays to a file, alongside the
+     * live output. The file is written by a background thread so the audio
+     * thread never touches the disk. Any recording already in progress is
+     * stopped first. Returns false if the file could not be opened.
+     */
+    bool startRecording (const char *path,
+                         RecorderFormat format = RECORDER_S16,
+                         RecorderContainer container = RECORDER_WAV);
+
+    /* Stop recording, flushing and closing the file. */
+    void stopRecording ();
+
+    /*
+     * Also play a MIDI device, merged with any others. Devices are named as
+     * in `aconnect -l', with an optional port, e.g. `MPKmini2' or
+     * `MPKmini2:0', and are connected to whenever they're plugged in. For
+     * SYNTH_DRIVER_ALSA synths.
+     */
+    void connectMidi (const char *device) const;
+    void disconnectMidi (const char *device) const;
+
+    /*
+     * The state of the sound card and the MIDI devices, DEVICE_STATUS_NONE
+     * for those the synth doesn't use. Device errors never stop the synth:
+     * a lost sound card is reopened, and missing MIDI devices connected to
+     * when they appear, in the background. See DeviceStatus.hpp.
+     */
+    DeviceStatus audioStatus () const;
+    DeviceStatus midiStatus () const;
+
+    /* Why a device isn't DEVICE_STATUS_OK, empty while they all are */
+    std::string deviceError () const;
+
+    /* The sample rate in Hz */
+    unsigned int getRate () const;
+
+    /*
+     * The synth's sample clock: the number of frames rendered so far. An
+     * event's `frame' is measured against this clock.
+     */
+    uint64_t frame () const;
+
+    /*
+     * Queue an event to be played at `event.frame', in any order and from
+     * any thread. An event which is already due plays at the start of the
+     * next block, after any others already waiting for that. noteOn and
+     * noteOff are shorthand for scheduling `now'.
+     */
+    void schedule (const MidiEvent &event) const;
+
+    /*
+     * How long after it arrives a note from a MIDI device is played, in
+     * seconds. Each event is delayed by exactly this much, so the spacing
+     * of fast passages is kept; a delay shorter than a period saves time at
+     * the cost of that. Defaults to one period, clamped to [0.0, 1.0].
+     */
+    void setInputLatency (double seconds) const;
+
+    /*
+     * Also take events from a socket, `unix:<path>' or `udp:[<host>:]<port>',
+     * e.g. sent by another service with a SocketClient. See SocketInput.hpp
+     * for the format. Replaces any socket listened to before. Returns false
+     * if the socket couldn't be opened.
+     */
+    bool listen (const char *address);
+
+    /*
+     * Render `frames' stereo frames into the interleaved `buffer', playing
+     * any scheduled events at their exact frame. Only for synths created
+     * with SYNTH_DRIVER_NONE; otherwise the audio thread or JACK calls it.
+     */
+    void render (float *buffer, size_t frames);
+
+    /*
+     * Render `frames' frames into the two channel buffers `out[0]' (left)
+     * and `out[1]' (right), for calling from a host's audio callback. Each
+     * of the `count' events plays `frame' frames into the call, so their
+     * frames are offsets rather than times on the synth's clock, and they
+     * must be in time order. Events past the end play on the last frame.
+     * Events scheduled or played from other threads are mixed in as
+     * usual. The audio is rendered interleaved, as the output stage and
+     * recorder take it, and copied out to the two channels. Like the other
+     * render, for SYNTH_DRIVER_NONE synths.
+     */
+    void render (float **out, size_t frames,
+                 const MidiEvent *events, size_t count);
+
+    /*
+     * Make rendering bit-exact: the same events, preset and sample rate
+     * always give byte-identical output, whichever thread renders and
+     * whatever block sizes it asks for. Each block is rendered with the
+     * floating point environment pinned (round to nearest, denormals
+     * flushed) rather than inheriting the calling thread's. Events and
+     * parameter changes must come from the thread calling `render', between
+     * blocks, or be scheduled with a frame. For SYNTH_DRIVER_NONE synths.
+     */
+    void setDeterministic (bool deterministic);
+
+    /*
+     * Have `callback' called with the profile of every block rendered, or
+     * stop with NULL. See Profile.hpp. Returns false, and never calls it,
+     * if the library wasn't built with SYNTH_PROFILE.
+     */
+    bool setProfiler (ProfileCallback callback, void *data = NULL);
+
+    /*
+     * Reopen the sound card asking for periods of `periodFrames' in a
+     * buffer of `bufferFrames', by default 64 and 1024. The audio thread
+     * stops while it does, and the input latency goes back to one period.
+     * Returns false if the card couldn't be opened like that, see
+     * `deviceError'. For SYNTH_DRIVER_ALSA synths.
+     */
+    bool setAudioBuffer (size_t periodFrames, size_t bufferFrames);
+
+    /*
+     * Have `monitor' called with every period as soon as the sound card has
+     * taken it, or stop with NULL. Runs on the audio thread, so like the
+     * profiler it mustn't block. See OutputBlock in AudioDevice.hpp. For
+     * SYNTH_DRIVER_ALSA synths.
+     */
+    void setOutputMonitor (OutputMonitor monitor, void *data = NULL);
+
 protected:
-    void init (const char *midiDevice);
+    void init (SynthDriver driver, const char *midiDevice, unsigned int rate);
+    /* Open the sound card and size the period buffers to match */
+    void openAudio (size_t periodFrames, size_t bufferFrames);
+    void startAudio ();
     static void* audio_thread (void *data);
+    static void jack_render (float **out, size_t frames,
+                             const MidiEvent *events, size_t count, void *data);
+
+    /*
+     * Render a block of at most max_block_frames into the interleaved
+     * `buffer', playing the queued events and `events', whose frames are
+     * relative to `base', each on its frame.
+     */
+    void renderBlock (float *buffer, size_t frames,
+                      const MidiEvent *events, size_t eventCount, uint64_t base);
+
+    /* Fill in the gain for part of the block being rendered */
+    void glideVolume (size_t from, size_t to);
+
+    /* Apply a single event to the voices */
+    void dispatch (const MidiEvent &event);
+
+    /* Set a parameter from the audio thread, e.g. from a controller */
+    void setParam (SynthParam param, double value);
 
 private:
+    SynthDriver     _driver;
+    unsigned int    _rate;
     AudioDevice    *_audio;
+    JackDevice     *_jack;
     MidiController *_midi;
+    SocketInput    *_socket;
+    EventQueue     *_events;
+    ControlMap     *_controls;
     Polyphonic     *_polyphonic;
+    Effects        *_effects;
+    OutputStage    *_output;
     int16_t        *_samples;
     size_t          _samplesLen;
+    /* the period as interleaved floats, shared with the recorder */
+    float          *_mix;
     double          _volume;
+    /* the volume being applied, gliding towards _volume */
+    double          _gain;
+    double          _gainStep;
+    double          _gainTarget;
+    size_t          _gainFrames;
+    bool            _deterministic;
+
+    /* patch changes and the newest tuning, for the audio thread to apply */
+    PatchChanges   *_patch;
+    TripleBuffer<Tuning> *_tunings;
+    /* the tuning read, kept rather than building a Tuning every block */
+    Tuning          _tuning;
+
+    /* events due in the block being rendered */
+    MidiEvent      *_pending;
+    /* the block as rendered by the voices, before the volume */
+    double         *_left;
+    double         *_right;
+    /* the volume frame by frame over the block, gliding between levels */
+    double         *_gains;
+    /* a block as interleaved floats, for rendering into separate channels */
+    float          *_block;
+    std::atomic<uint64_t> _frame;
+
+    std::atomic<Recorder*> _recorder;
+    /* blocks being written to the recorder, to know it's not in use */
+    std::atomic<int> _recordWriters;
+
+    std::atomic<ProfileCallback> _profiler;
+    void *_profilerData;
+
+    std::atomic<OutputMonitor> _monitor;
+    void *_monitorData;
 
     bool _running;
     pthread_t _thread;
@@ -0,0 +1,58 @@
+#ifndef SYNTH_TRIPLEBUFFER_HPP
+#define SYNTH_TRIPLEBUFFER_HPP
+
+#include <atomic>
+
+/*
+ * Hands the latest of a value from one thread to another without locking:
+ * the producer may `write' as often as it likes and the consumer `read's
+ * only the newest, never one half written. Values written in between are
+ * skipped. One producer and one consumer, like RingBuffer.
+ */
+template <typename T>
+class TripleBuffer {
+public:
+    TripleBuffer ()
+        : _back (0)
+        , _middle (1)
+        , _front (2)
+    { }
+
+    /* Publish `value', replacing any the consumer hasn't read. Producer only. */
+    void write (const T &value)
+    {
+        _buffers[_back] = value;
+        _back = _middle.exchange(_back | fresh, std::memory_order_acq_rel) & index;
+    }
+
+    /*
+     * Copy out the newest value written since the last read, returning false
+     * if there isn't one. Consumer only.
+     */
+    bool read (T &value)
+    {
+        if (!(_middle.load(std::memory_order_relaxed) & fresh))
+            return false;
+        _front = _middle.exchange(_front, std::memory_order_acq_rel) & index;
+        value = _buffers[_front];
+        return true;
+    }
+
+private:
+    TripleBuffer (const TripleBuffer&);
+    TripleBuffer& operator= (const TripleBuffer&);
+
+    /* the middle buffer holds a value not read yet */
+    static const int fresh = 4;
+    static const int index = 3;
+
+    T _buffers[3];
+    /* buffer being written, only used by the producer */
+    int _back;
+    /* buffer between the two, and whether it's fresh */
+    std::atomic<int> _middle;
+    /* buffer last read, only used by the consumer */
+    int _front;
+};
+
+#endif
@@ -0,0 +1,61 @@
+#ifndef SYNTH_TUNING_HPP
+#define SYNTH_TUNING_HPP
+
+#include <cstddef>
+
+#define TUNING_NOTES 128
+
+/*
+ * The frequency of every MIDI note, computed once up front so starting a
+ * note or retuning the voices is a table lookup rather than a pow().
+ *
+ * Besides equal temperament, any scale in the Scala format can be loaded: a
+ * .scl file listing the scale's pitches in cents or as ratios, and optionally
+ * a .kbm keyboard mapping saying which key plays which degree of the scale
+ * and which key sounds at what frequency. Without a mapping, degree 0 is on
+ * middle C (note 60) and the scale repeats up and down the keyboard, with
+ * A4 (note 69) kept at the reference frequency.
+ */
+class Tuning {
+public:
+    /* Twelve-tone equal temperament with A4 (note 69) at `reference' Hz */
+    Tuning (double reference = 440.0);
+
+    /*
+     * Load a Scala scale and, if given, a keyboard mapping. Keys the mapping
+     * leaves out keep their equal-tempered pitch. Returns false, leaving the
+     * tuning as it was, if either file can't be read.
+     */
+    bool load (const char *scale, const char *keyboard = NULL);
+
+    /* Shift every note by `cents', e.g. to match another instrument */
+    void setFineTune (double cents);
+    double fineTune () const;
+
+    /* The frequency of the reference note, A4 unless a keyboard map moved it */
+    double reference () const;
+
+    /* The frequency of a MIDI note, 0-127 */
+    inline double
+    frequency (int note) const
+    {
+        return _frequencies[note & (TUNING_NOTES - 1)];
+    }
+
+    /* The frequency ratio of an interval, 2^(semitones / 12), from a table */
+    static double ratio (double semitones);
+
+protected:
+    void update ();
+
+private:
+    /* the frequency of `_referenceNote', which the others are relative to */
+    double _reference;
+    int _referenceNote;
+    double _fineTune;
+    /* each note's distance from the reference note */
+    double _cents[TUNING_NOTES];
+    double _frequencies[TUNING_NOTES];
+};
+
+#endif
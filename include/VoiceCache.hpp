@@ -0,0 +1,104 @@
+#ifndef SYNTH_VOICECACHE_HPP
+#define SYNTH_VOICECACHE_HPP
+
+#include <cstddef>
+#include <vector>
+#include <inttypes.h>
+#include "Oscillator.hpp"
+#include "Envelope.hpp"
+#include "Filter.hpp"
+
+/* How many numbers it takes to describe a new voice, see VoiceKey */
+#define VOICE_KEY_SIZE 43
+
+/*
+ * Everything that decides what a new voice sounds like before its gains:
+ * the patch, the matrix slots reaching its pitch and filter, the note and
+ * its velocity, and where the voice starts within a control block. Two
+ * voices with the same key render the same samples.
+ */
+struct VoiceKey {
+    double values[VOICE_KEY_SIZE];
+
+    uint64_t hash () const;
+    bool operator== (const VoiceKey &other) const;
+};
+
+/* A voice's sound-making state where its modulation is evaluated */
+struct VoiceSnapshot {
+    /* samples into the note */
+    size_t age;
+    double pitchMod;
+    Oscillator oscillator;
+    Envelope env;
+    Envelope filterEnv;
+    Filter filter;
+};
+
+/*
+ * The start of a note as a voice rendered it: its output before the gains,
+ * and its state every time its modulation was evaluated, so a voice playing
+ * it back can pick up live from there.
+ */
+struct VoiceRecording {
+    VoiceKey key;
+    uint64_t hash;
+    std::vector<double> samples;
+    std::vector<VoiceSnapshot> snapshots;
+    /* longest the recording may run */
+    size_t limit;
+    /* still being recorded by a voice */
+    bool recording;
+    /*
+     * ran until the note settled or the limit; otherwise the next voice
+     * to play it to the end records on from there
+     */
+    bool complete;
+    /* voices recording or playing it, which keep it from being reused */
+    int users;
+    unsigned long lastUsed;
+};
+
+/*
+ * Recordings of the first part of recently played notes, reused least
+ * recently used first. A recording ends where the note stops sounding the
+ * same every time it is played: once both envelopes reach sustain, or when
+ * the note is released or anything about it changes.
+ */
+class VoiceCache {
+public:
+    VoiceCache ();
+    ~VoiceCache ();
+
+    /*
+     * Keep up to `entries' recordings, each at most `limit' samples long,
+     * dropping any there are, with their memory allocated up front. 0 turns
+     * the cache off. No voice may be using a recording.
+     */
+    void setSize (size_t entries, size_t limit);
+
+    /*
+     * Trade recordings with `other' without allocating, so a cache sized on
+     * another thread can be put in place on the audio thread. No voice may
+     * be using a recording of this one.
+     */
+    void swap (VoiceCache &other);
+
+    /* The most recordings kept, 0 if the cache is off */
+    size_t size () const;
+
+    /* The recording of `key', finished or still being made, or NULL */
+    VoiceRecording* find (const VoiceKey &key);
+
+    /*
+     * Start a new recording of `key' in place of the least recently used
+     * one, or NULL if every recording is in use.
+     */
+    VoiceRecording* record (const VoiceKey &key);
+
+private:
+    std::vector<VoiceRecording*> _entries;
+    unsigned long _clock;
+};
+
+#endif
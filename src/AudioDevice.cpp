@@ -18,29 +18,36 @@ static const unsigned int rate = 44100;
 /* count of channels */
 static const unsigned int channels = 2;
 
+/* Record the error and give up setting up the device */
+#define CHK_ERR(err, ...) \
+    if ((err) < 0) { setError(__VA_ARGS__); return (err); }
+
 void
-chk_err (int err, const char* format, ...)
-{ 
+AudioDevice::setError (const char *format, ...)
+{
+    char message[256];
     va_list args;
-    if (err < 0) {
-        va_start(args, format);
-        vfprintf(stderr, format, args);
-        va_end(args);
-        exit(1);
-    }
+    va_start(args, format);
+    vsnprintf(message, sizeof(message), format, args);
+    va_end(args);
+
+    fprintf(stderr, "%s\n", message);
+    pthread_mutex_lock(&this->error_lock);
+    this->error_message = message;
+    pthread_mutex_unlock(&this->error_lock);
 }
 
-void AudioDevice::initDevice ()
+int AudioDevice::initDevice ()
 {
     snd_pcm_t *handle;
     int err = snd_pcm_open(&handle, device, SND_PCM_STREAM_PLAYBACK, 0);
-    chk_err(err, "Playback open error: %s\n", snd_strerror(err));
+    CHK_ERR(err, "Playback open error: %s", snd_strerror(err));
     this->device_handle = handle;
+    return 0;
 }
 
-void AudioDevice::setupHardware ()
+int AudioDevice::setupHardware ()
 {
-    assert(this->device_handle);
     snd_pcm_t *handle = (snd_pcm_t*) this->device_handle;
 
     int err;
@@ -51,57 +58,57 @@ void AudioDevice::setupHardware ()
 
     /* fill hwparams with default values */
     err = snd_pcm_hw_params_any(handle, hwparams);
-    chk_err(err, "No hardware configurations available: %s\n", snd_strerror(err));
+    CHK_ERR(err, "No hardware configurations available: %s", snd_strerror(err));
 
     /* enable resampling */
     err = snd_pcm_hw_params_set_rate_resample(handle, hwparams, 1);
-    chk_err(err, "Resampling setup failed for playback: %s\n", snd_strerror(err));
+    CHK_ERR(err, "Resampling setup failed for playback: %s", snd_strerror(err));
 
     /* set the interleaved read/write format */
     err = snd_pcm_hw_params_set_access(handle, hwparams, format_access);
-    chk_err(err, "Access not available for playback: %s\n", snd_strerror(err));
+    CHK_ERR(err, "Access not available for playback: %s", snd_strerror(err));
 
     /* set the sample format */
     err = snd_pcm_hw_params_set_format(handle, hwparams, format);
-    chk_err(err, "Sample format not available for playback: %s\n", snd_strerror(err));
+    CHK_ERR(err, "Sample format not available for playback: %s", snd_strerror(err));
 
     /* set number of channels */
     err = snd_pcm_hw_params_set_channels(handle, hwparams, channels);
-    chk_err(err, "Channels count (%u) not available for playbacks: %s\n", channels, snd_strerror(err));
+    CHK_ERR(err, "Channels count (%u) not available for playbacks: %s", channels, snd_strerror(err));
 
     /* set the stream rate */
     unsigned rrate = rate;
     err = snd_pcm_hw_params_set_rate_near(handle, hwparams, &rrate, 0);
-    chk_err(err, "Rate %uHz not available for playback: %s\n", rate, snd_strerror(err));
+    CHK_ERR(err, "Rate %uHz not available for playback: %s", rate, snd_strerror(err));
     if (rrate != rate) {
-        fprintf(stderr, "Rate doesn't match (requested %uHz, get %iHz)\n", rate, err);
-        exit(1);
+        setError("Rate doesn't match (requested %uHz, got %uHz)", rate, rrate);
+        return -EINVAL;
     }
 
     /* Set the period and buffer size fairly low to keep latency low */
-    this->buffer_size = 1024;
-    this->period_size = 64;
+    this->buffer_size = this->buffer_request;
+    this->period_size = this->period_request;
 
     err = snd_pcm_hw_params_set_buffer_size_near(handle, hwparams, &buffer_size);
-    chk_err(err, "Unable to set buffer size for playback: %s\n", snd_strerror(err));
+    CHK_ERR(err, "Unable to set buffer size for playback: %s", snd_strerror(err));
     err = snd_pcm_hw_params_get_buffer_size(hwparams, &val);
-    chk_err(err, "Unable to get buffer size for playback: %s\n", snd_strerror(err));
+    CHK_ERR(err, "Unable to get buffer size for playback: %s", snd_strerror(err));
     buffer_size = val;
 
     err = snd_pcm_hw_params_set_period_size_near(handle, hwparams, &period_size, NULL);
-    chk_err(err, "Unable to set period size for playback: %s\n", snd_strerror(err));
+    CHK_ERR(err, "Unable to set period size for playback: %s", snd_strerror(err));
     err = snd_pcm_hw_params_get_period_size(hwparams, &val, NULL);
-    chk_err(err, "Unable to get period size for playback: %s\n", snd_strerror(err));
+    CHK_ERR(err, "Unable to get period size for playback: %s", snd_strerror(err));
     period_size = val;
 
     /* write the parameters to device */
     err = snd_pcm_hw_params(handle, hwparams);
-    chk_err(err, "Unable to set hw params for playback: %s\n", snd_strerror(err));
+    CHK_ERR(err, "Unable to set hw params for playback: %s", snd_strerror(err));
+    return 0;
 }
 
-void AudioDevice::setupSoftware ()
+int AudioDevice::setupSoftware ()
 {
-    assert(this->device_handle);
     snd_pcm_t *handle = (snd_pcm_t*) this->device_handle;
 
     int err;
@@ -111,45 +118,98 @@ void AudioDevice::setupSoftware ()
 
     /* get the current swparams */
     err = snd_pcm_sw_params_current(handle, swparams);
-    chk_err(err, "Unable to determine current swparams for playback: %s\n", snd_strerror(err));
+    CHK_ERR(err, "Unable to determine current swparams for playback: %s", snd_strerror(err));
 
     /* start the transfer when the buffer is almost full: */
     /* (buffer_size / avail_min) * avail_min */
     err = snd_pcm_sw_params_set_start_threshold(handle, swparams, (buffer_size / period_size) * period_size);
-    chk_err(err, "Unable to set start threshold mode for playback: %s\n", snd_strerror(err));
+    CHK_ERR(err, "Unable to set start threshold mode for playback: %s", snd_strerror(err));
 
     /* allow the transfer when at least period_size samples can be processed */
     err = snd_pcm_sw_params_set_avail_min(handle, swparams, period_size);
-    chk_err(err, "Unable to set avail min for playback: %s\n", snd_strerror(err));
+    CHK_ERR(err, "Unable to set avail min for playback: %s", snd_strerror(err));
 
     /* write the parameters to the playback device */
     err = snd_pcm_sw_params(handle, swparams);
-    chk_err(err, "Unable to set sw params for playback: %s\n", snd_strerror(err));
+    CHK_ERR(err, "Unable to set sw params for playback: %s", snd_strerror(err));
+    return 0;
 }
 
-AudioDevice::AudioDevice ()
+AudioDevice::AudioDevice (size_t periodFrames, size_t bufferFrames)
+    : samples (NULL)
+    , buffer_size (bufferFrames)
+    , period_size (periodFrames)
+    , period_request (periodFrames)
+    , buffer_request (bufferFrames)
+    , device_handle (NULL)
+    , device_status (DEVICE_STATUS_RECONNECTING)
 {
-    initDevice();
-    setupHardware();
-    setupSoftware();
+    pthread_mutex_init(&this->error_lock, NULL);
 
+    /*
+     * Sized for the period asked for, so a device which doesn't open yet
+     * can still be played to once it does, whatever period it ends up with.
+     */
     this->samples_bytes = (this->period_size * channels * format_width) / 8;
     this->num_samples = this->samples_bytes / sizeof(int16_t);
     this->samples = (int16_t*) malloc(this->samples_bytes);
 
+    open();
+}
+
+AudioDevice::~AudioDevice ()
+{
+    if (this->device_handle)
+        snd_pcm_drain((snd_pcm_t*) this->device_handle);
+    close();
+    free(this->samples);
+    pthread_mutex_destroy(&this->error_lock);
+}
+
+bool
+AudioDevice::open ()
+{
+    close();
+    if (initDevice() < 0)
+        return false;
+    if (setupHardware() < 0 || setupSoftware() < 0) {
+        close();
+        return false;
+    }
+
     if (DEBUG) {
         printf("Period Size: %ld\n", this->period_size);
         printf("Buffer Size: %ld\n", this->buffer_size);
         printf("Num Channels: %u\n", channels);
         printf("Num Samples: %lu\n", this->num_samples);
     }
+
+    this->device_status = DEVICE_STATUS_OK;
+    return true;
 }
 
-AudioDevice::~AudioDevice ()
+void
+AudioDevice::close ()
 {
-    snd_pcm_drain((snd_pcm_t*) this->device_handle);
-    snd_pcm_close((snd_pcm_t*) this->device_handle);
-    free(this->samples);
+    if (this->device_handle)
+        snd_pcm_close((snd_pcm_t*) this->device_handle);
+    this->device_handle = NULL;
+    this->device_status = DEVICE_STATUS_RECONNECTING;
+}
+
+DeviceStatus
+AudioDevice::status () const
+{
+    return this->device_status;
+}
+
+std::string
+AudioDevice::error () const
+{
+    pthread_mutex_lock(&this->error_lock);
+    std::string message = this->error_message;
+    pthread_mutex_unlock(&this->error_lock);
+    return message;
 }
 
 int16_t*
@@ -170,6 +230,16 @@ AudioDevice::getPeriodSize ()
     return this->period_size;
 }
 
+long
+AudioDevice::queued ()
+{
+    snd_pcm_t *handle = (snd_pcm_t*) this->device_handle;
+    snd_pcm_sframes_t delay;
+    if (!handle || snd_pcm_delay(handle, &delay) < 0)
+        return -1;
+    return delay;
+}
+
 size_t
 AudioDevice::getSamplesBytes ()
 {
@@ -189,7 +259,7 @@ static int xrun_recovery (snd_pcm_t *handle, int err)
         err = snd_pcm_prepare(handle);
         if (err < 0)
             printf("Can't recovery from underrun, prepare failed: %s\n", snd_strerror(err));
-        return 0;
+        return err;
     } else if (err == -ESTRPIPE) {
         while ((err = snd_pcm_resume(handle)) == -EAGAIN)
             sleep(1);   /* wait until the suspend flag is released */
@@ -198,45 +268,44 @@ static int xrun_recovery (snd_pcm_t *handle, int err)
             if (err < 0)
                 printf("Can't recovery from suspend, prepare failed: %s\n", snd_strerror(err));
         }
-        return 0;
+        return err;
     }
     return err;
 }
 
-void
-AudioDevice::play (int16_t *buffer, size_t length)
+bool
+AudioDevice::play (const int16_t *buffer, size_t length)
 {
-    assert(length % this->num_samples == 0);
-    for (size_t index = 0; index < length; index += num_samples) {
-        for (size_t i = 0; i < this->num_samples; i++) {
-            this->samples[i] = buffer[index + i];
-        }
-        this->playSamples();
-    }
+    return write(buffer, length / channels);
 }
 
-void
+bool
 AudioDevice::playSamples ()
 {
-    assert(this->device_handle);
-    snd_pcm_t *handle = (snd_pcm_t*) this->device_handle;
+    return write(this->samples, this->num_samples / channels);
+}
 
-    int frames;
-    int16_t *ptr = samples;
-    int count = this->period_size;
+bool
+AudioDevice::write (const int16_t *buffer, size_t frames)
+{
+    snd_pcm_t *handle = (snd_pcm_t*) this->device_handle;
+    if (!handle)
+        return false;
 
-    while (count > 0) {
-        frames = snd_pcm_writei(handle, ptr, count);
-        if (frames == -EAGAIN)
+    const int16_t *ptr = buffer;
+    while (frames > 0) {
+        snd_pcm_sframes_t written = snd_pcm_writei(handle, ptr, frames);
+        if (written == -EAGAIN)
             continue;
-        if (frames < 0) {
-            if (xrun_recovery(handle, frames) < 0) {
-                printf("Write error: %s\n", snd_strerror(frames));
-                exit(EXIT_FAILURE);
+        if (written < 0) {
+            if (xrun_recovery(handle, written) < 0) {
+                setError("Write error: %s", snd_strerror(written));
+                return false;
             }
-            break;  /* skip one period */
+            break;  /* skip the rest of the block */
         }
-        ptr += frames * channels;
-        count -= frames;
+        ptr += written * channels;
+        frames -= written;
     }
+    return true;
 }
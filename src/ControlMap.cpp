@@ -0,0 +1,186 @@
+#include <cmath>
+#include "Definitions.hpp"
+#include "ControlMap.hpp"
+
+/*
+ * most changes which can be queued between two audio blocks: enough to map
+ * every control on every channel after clearing the table and learning
+ */
+static const size_t max_changes = MIDI_CHANNELS * MIDI_CONTROLS + 2;
+/* steepness of the exponential and logarithmic curves */
+static const double curve_steepness = 4.0;
+
+/*
+ * Controllers only have 128 positions, so each curve is precomputed for all
+ * of them and scaling a value is a table lookup.
+ */
+struct CurveTables {
+    double table[NUM_CONTROL_CURVES][MIDI_CONTROLS];
+
+    CurveTables ()
+    {
+        double k = curve_steepness;
+        for (int i = 0; i < MIDI_CONTROLS; i++) {
+            double x = i / 127.0;
+            table[CONTROL_CURVE_LINEAR][i] = x;
+            table[CONTROL_CURVE_EXPONENTIAL][i] = (exp(k * x) - 1.0) / (exp(k) - 1.0);
+            table[CONTROL_CURVE_LOGARITHMIC][i] = log(1.0 + x * (exp(k) - 1.0)) / k;
+        }
+    }
+};
+
+static const CurveTables curves;
+
+double
+ControlMapping::scale (double value) const
+{
+    int i = (int) (clamp(value, 0.0, 1.0) * 127.0 + 0.5);
+    return min + (max - min) * curves.table[curve][i];
+}
+
+ControlMap::ControlMap ()
+    : _changes (max_changes)
+    , _learning (false)
+    , _learned (-1)
+{
+    pthread_mutex_init(&_changesLock, NULL);
+
+    /* the original layout: amp ADSR, cutoff, resonance, filter ADSR */
+    static const SynthParam legacy[] = {
+        PARAM_ATTACK, PARAM_DECAY, PARAM_SUSTAIN, PARAM_RELEASE,
+        PARAM_CUTOFF, PARAM_RESONANCE,
+        PARAM_FILTER_ATTACK, PARAM_FILTER_DECAY,
+        PARAM_FILTER_SUSTAIN, PARAM_FILTER_RELEASE,
+    };
+    for (int i = 0; i < 10; i++) {
+        ControlMapping m(legacy[i], 0.0, 1.0, CONTROL_CURVE_LINEAR);
+        set(MIDI_OMNI, i + 1, m);
+    }
+}
+
+ControlMap::~ControlMap ()
+{
+    pthread_mutex_destroy(&_changesLock);
+}
+
+bool
+ControlMap::queue (const Change &change)
+{
+    /*
+     * Nothing may be draining the ring, e.g. a synth that hasn't rendered
+     * yet, so waiting for room could wait forever.
+     */
+    pthread_mutex_lock(&_changesLock);
+    bool queued = _changes.push(change);
+    pthread_mutex_unlock(&_changesLock);
+    return queued;
+}
+
+bool
+ControlMap::map (int channel, int control, const ControlMapping &mapping)
+{
+    if (channel < MIDI_OMNI || channel >= MIDI_CHANNELS)
+        return false;
+    if (control < 0 || control >= MIDI_CONTROLS)
+        return false;
+    Change c;
+    c.type = CHANGE_MAP;
+    c.channel = channel;
+    c.control = control;
+    c.mapping = mapping;
+    return queue(c);
+}
+
+bool
+ControlMap::unmap (int channel, int control)
+{
+    return map(channel, control, ControlMapping());
+}
+
+bool
+ControlMap::clear ()
+{
+    Change c;
+    c.type = CHANGE_CLEAR;
+    c.channel = c.control = 0;
+    return queue(c);
+}
+
+bool
+ControlMap::learn (const ControlMapping &mapping)
+{
+    Change c;
+    c.type = CHANGE_LEARN;
+    c.channel = c.control = 0;
+    c.mapping = mapping;
+    bool learning = _learning.exchange(true);
+    if (queue(c))
+        return true;
+    /* an earlier learn still waiting keeps learn mode on */
+    if (!learning)
+        _learning = false;
+    return false;
+}
+
+bool
+ControlMap::learning () const
+{
+    return _learning;
+}
+
+bool
+ControlMap::learned (int &channel, int &control) const
+{
+    int learned = _learned;
+    if (learned < 0)
+        return false;
+    channel = learned / MIDI_CONTROLS;
+    control = learned % MIDI_CONTROLS;
+    return true;
+}
+
+void
+ControlMap::set (int channel, int control, const ControlMapping &mapping)
+{
+    if (channel == MIDI_OMNI) {
+        for (int c = 0; c < MIDI_CHANNELS; c++)
+            _table[c][control] = mapping;
+    } else {
+        _table[channel][control] = mapping;
+    }
+}
+
+void
+ControlMap::update ()
+{
+    Change c;
+    while (_changes.pop(c)) {
+        switch (c.type) {
+            case CHANGE_MAP:
+                set(c.channel, c.control, c.mapping);
+                break;
+            case CHANGE_CLEAR:
+                for (int ch = 0; ch < MIDI_CHANNELS; ch++)
+                    for (int cc = 0; cc < MIDI_CONTROLS; cc++)
+                        _table[ch][cc] = ControlMapping();
+                break;
+            case CHANGE_LEARN:
+                _learnMapping = c.mapping;
+                break;
+        }
+    }
+}
+
+const ControlMapping&
+ControlMap::find (int channel, int control)
+{
+    channel &= MIDI_CHANNELS - 1;
+    control &= MIDI_CONTROLS - 1;
+    if (_learning && _learnMapping.param != PARAM_NONE) {
+        _table[channel][control] = _learnMapping;
+        _learnMapping = ControlMapping();
+        _learned = channel * MIDI_CONTROLS + control;
+        _learning = false;
+    }
+    return _table[channel][control];
+}
@@ -0,0 +1,246 @@
+#include <cmath>
+#include "Definitions.hpp"
+#include "Effects.hpp"
+
+/* longest delay time in seconds */
+static const double max_delay_time = 2.0;
+/* lowpass coefficient in the delay's feedback path, 1.0 being no damping */
+static const double delay_damping = 0.6;
+/* chorus delay at the center of the sweep and the widest sweep, in seconds */
+static const double chorus_delay = 0.015;
+static const double chorus_depth = 0.007;
+/* Freeverb's tunings in samples at 44.1kHz and its scaling constants */
+static const size_t comb_tunings[] = {
+    1116, 1188, 1277, 1356, 1422, 1491, 1557, 1617
+};
+static const size_t allpass_tunings[] = { 556, 441, 341, 225 };
+static const size_t stereo_spread = 23;
+static const double reverb_gain = 0.015;
+static const double room_scale = 0.28;
+static const double room_offset = 0.7;
+static const double damp_scale = 0.4;
+/* keeps decaying feedback loops out of the slow denormal range */
+static const double anti_denormal = 1e-18;
+
+DelayLine::DelayLine ()
+    : _mask (0)
+    , _pos (0)
+{ }
+
+void
+DelayLine::allocate (size_t frames)
+{
+    /* power of two so the index wraps with a mask */
+    size_t size = 1;
+    while (size < frames + 2)
+        size <<= 1;
+    _buffer.assign(size, 0.0);
+    _mask = size - 1;
+    _pos = 0;
+}
+
+void
+DelayLine::clear ()
+{
+    std::fill(_buffer.begin(), _buffer.end(), 0.0);
+}
+
+Delay::Delay (unsigned long rate)
+    : _rate (rate)
+    , _time (0.25)
+    , _feedback (0.0)
+    , _mix (0.0)
+    , _dampLeft (0.0)
+    , _dampRight (0.0)
+{
+    size_t frames = (size_t) (max_delay_time * rate);
+    _left.allocate(frames);
+    _right.allocate(frames);
+}
+
+void
+Delay::set (double time, double feedback, double mix)
+{
+    _time = clamp(time, 0.0, max_delay_time);
+    _feedback = clamp(feedback, 0.0, 0.95);
+    _mix = clamp(mix, 0.0, 1.0);
+}
+
+bool
+Delay::enabled () const
+{
+    return _mix > 0.0;
+}
+
+void
+Delay::process (double *left, double *right, size_t frames)
+{
+    size_t delay = std::max((size_t) (_time * _rate), (size_t) 1);
+    for (size_t i = 0; i < frames; i++) {
+        double l = _left.read(delay);
+        double r = _right.read(delay);
+        _dampLeft += delay_damping * (l - _dampLeft) + anti_denormal;
+        _dampRight += delay_damping * (r - _dampRight) + anti_denormal;
+        _left.write(left[i] + _feedback * _dampLeft);
+        _right.write(right[i] + _feedback * _dampRight);
+        left[i] += _mix * l;
+        right[i] += _mix * r;
+    }
+}
+
+Chorus::Chorus (unsigned long rate)
+    : _rate (rate)
+    , _depth (0.5)
+    , _mix (0.0)
+    , _cos (1.0)
+    , _sin (0.0)
+    , _cosStep (1.0)
+    , _sinStep (0.0)
+{
+    size_t frames = (size_t) ((chorus_delay + chorus_depth) * rate) + 1;
+    _left.allocate(frames);
+    _right.allocate(frames);
+    set(0.5, 0.5, 0.0);
+}
+
+void
+Chorus::set (double rate, double depth, double mix)
+{
+    double w = TWOPI * clamp(rate, 0.0, 10.0) / _rate;
+    _cosStep = cos(w);
+    _sinStep = sin(w);
+    _depth = clamp(depth, 0.0, 1.0);
+    _mix = clamp(mix, 0.0, 1.0);
+}
+
+bool
+Chorus::enabled () const
+{
+    return _mix > 0.0;
+}
+
+void
+Chorus::process (double *left, double *right, size_t frames)
+{
+    double center = chorus_delay * _rate;
+    double sweep = _depth * chorus_depth * _rate;
+    double dry = 1.0 - 0.5 * _mix;
+    double wet = 0.5 * _mix;
+
+    for (size_t i = 0; i < frames; i++) {
+        _left.write(left[i]);
+        _right.write(right[i]);
+        left[i] = dry * left[i] + wet * _left.read(center + sweep * _sin);
+        right[i] = dry * right[i] + wet * _right.read(center + sweep * _cos);
+
+        double c = _cos * _cosStep - _sin * _sinStep;
+        _sin = _cos * _sinStep + _sin * _cosStep;
+        _cos = c;
+    }
+
+    /* keep rounding from growing or shrinking the phasor */
+    double norm = 1.0 / sqrt(_cos * _cos + _sin * _sin);
+    _cos *= norm;
+    _sin *= norm;
+}
+
+Reverb::Reverb (unsigned long rate)
+    : _feedback (0.0)
+    , _damping (0.0)
+    , _mix (0.0)
+{
+    double scale = rate / 44100.0;
+    for (int ch = 0; ch < 2; ch++) {
+        size_t spread = ch * stereo_spread;
+        for (int i = 0; i < num_combs; i++) {
+            Comb &c = _combs[ch][i];
+            c.length = (size_t) ((comb_tunings[i] + spread) * scale);
+            c.line.allocate(c.length);
+            c.store = 0.0;
+        }
+        for (int i = 0; i < num_allpasses; i++) {
+            Allpass &a = _allpasses[ch][i];
+            a.length = (size_t) ((allpass_tunings[i] + spread) * scale);
+            a.line.allocate(a.length);
+        }
+    }
+    set(0.5, 0.5, 0.0);
+}
+
+void
+Reverb::set (double size, double damping, double mix)
+{
+    _feedback = clamp(size, 0.0, 1.0) * room_scale + room_offset;
+    _damping = clamp(damping, 0.0, 1.0) * damp_scale;
+    _mix = clamp(mix, 0.0, 1.0);
+}
+
+bool
+Reverb::enabled () const
+{
+    return _mix > 0.0;
+}
+
+void
+Reverb::process (double *left, double *right, size_t frames)
+{
+    double *io[2] = { left, right };
+
+    for (size_t i = 0; i < frames; i++) {
+        double input = (left[i] + right[i]) * reverb_gain;
+
+        for (int ch = 0; ch < 2; ch++) {
+            double out = 0.0;
+            for (int j = 0; j < num_combs; j++) {
+                Comb &c = _combs[ch][j];
+                double y = c.line.read(c.length);
+                c.store = y * (1.0 - _damping) + c.store * _damping
+                        + anti_denormal;
+                c.line.write(input + c.store * _feedback);
+                out += y;
+            }
+            for (int j = 0; j < num_allpasses; j++) {
+                Allpass &a = _allpasses[ch][j];
+                double y = a.line.read(a.length);
+                a.line.write(out + y * 0.5);
+                out = y - out;
+            }
+            io[ch][i] += _mix * out;
+        }
+    }
+}
+
+Effects::Effects (unsigned long rate)
+    : _chorus (rate)
+    , _delay (rate)
+    , _reverb (rate)
+{ }
+
+void
+Effects::setChorus (double rate, double depth, double mix)
+{
+    _chorus.set(rate, depth, mix);
+}
+
+void
+Effects::setDelay (double time, double feedback, double mix)
+{
+    _delay.set(time, feedback, mix);
+}
+
+void
+Effects::setReverb (double size, double damping, double mix)
+{
+    _reverb.set(size, damping, mix);
+}
+
+void
+Effects::process (double *left, double *right, size_t frames)
+{
+    if (_chorus.enabled())
+        _chorus.process(left, right, frames);
+    if (_delay.enabled())
+        _delay.process(left, right, frames);
+    if (_reverb.enabled())
+        _reverb.process(left, right, frames);
+}
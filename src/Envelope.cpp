@@ -2,26 +2,43 @@
 #include "Envelope.hpp"
 #include "Definitions.hpp"
 
-Envelope::Envelope (double ADSR[4])
-    : _minLevel (0.0001)
-    , _level (_minLevel)
+/* the level an envelope starts from and releases to */
+static const double min_level = 0.0001;
+
+/* simple state transition table */
+static const EnvelopeStage next_stage[NUM_STAGES] = {
+    STAGE_DECAY,    /* from attack */
+    STAGE_SUSTAIN,  /* from decay */
+    STAGE_SUSTAIN,  /* from sustain */
+    STAGE_RELEASE,  /* from release */
+};
+
+EnvelopeShape::EnvelopeShape ()
+    : version (0)
+    , rate (44100)
+{
+    for (int i = 0; i < NUM_STAGES; i++) {
+        values[i] = 0.0;
+        changed[i] = 0;
+    }
+}
+
+void
+EnvelopeShape::set (EnvelopeStage stage, double value)
+{
+    values[stage] = value;
+    changed[stage] = ++version;
+}
+
+Envelope::Envelope (const EnvelopeShape *shape)
+    : _level (min_level)
     , _multiplier (1.0) 
-    , _currStage (STAGE_ATTACK)
     , _currSample (0)
     , _nextStageAt (0)
-{
-    /* determines when the next stage occurs */
-    _values[STAGE_ATTACK]  = ADSR[0];
-    _values[STAGE_DECAY]   = ADSR[1];
-    _values[STAGE_SUSTAIN] = ADSR[2];
-    _values[STAGE_RELEASE] = ADSR[3];
-
-    /* simple state transition table */
-    _next[STAGE_ATTACK]  = STAGE_DECAY;
-    _next[STAGE_DECAY]   = STAGE_SUSTAIN;
-    _next[STAGE_SUSTAIN] = STAGE_SUSTAIN;
-    _next[STAGE_RELEASE] = STAGE_RELEASE;
-}
+    , _currStage (STAGE_ATTACK)
+    , _shape (shape)
+    , _version (shape->version)
+{ }
 
 void
 Envelope::noteOn ()
@@ -38,7 +55,7 @@ Envelope::noteOff ()
 bool
 Envelope::isActive () const
 {
-    if (_currStage == STAGE_RELEASE && _level <= _minLevel)
+    if (_currStage == STAGE_RELEASE && _level <= min_level)
         return false;
     return true;
 }
@@ -55,30 +72,36 @@ Envelope::next ()
     return _level;
 }
 
+double
+Envelope::level () const
+{
+    return _level;
+}
+
+EnvelopeStage
+Envelope::stage () const
+{
+    return _currStage;
+}
+
 void
-Envelope::setValue (EnvelopeStage stage, double value)
+Envelope::reshape ()
 {
-    _values[stage] = value;
-    if (_currStage != stage)
-        return;
+    double value = _shape->values[_currStage];
     if (_currStage == STAGE_SUSTAIN) {
         _level = value;
     }
-    else if (_currStage == STAGE_DECAY && stage == STAGE_SUSTAIN) {
-        unsigned long samplesLeft = _nextStageAt - _currSample;
-        calcStageMultiplier(_level, std::max(value, _minLevel), samplesLeft);
-    }
     else {
-        double nextLevel = _minLevel;
+        double nextLevel = min_level;
         switch (_currStage) {
             case STAGE_ATTACK:
                 nextLevel = 1.0;
                 break;
             case STAGE_DECAY:
-                nextLevel = std::max(_values[STAGE_SUSTAIN], _minLevel);
+                nextLevel = std::max(_shape->values[STAGE_SUSTAIN], min_level);
                 break;
             case STAGE_RELEASE:
-                nextLevel = _minLevel;
+                nextLevel = min_level;
                 break;
             default:
                 break;
@@ -86,7 +109,7 @@ Envelope::setValue (EnvelopeStage stage, double value)
 
         double percentDone = (double) _currSample / (double) _nextStageAt;
         double percentLeft = 1.0 - percentDone;
-        unsigned long samplesLeft = percentLeft * value * Envelope::rate;
+        unsigned long samplesLeft = percentLeft * value * _shape->rate;
         _nextStageAt = _currSample + samplesLeft;
         calcStageMultiplier(_level, nextLevel, samplesLeft);
     }
@@ -95,7 +118,7 @@ Envelope::setValue (EnvelopeStage stage, double value)
 EnvelopeStage
 Envelope::getNextStage () const
 {
-    return _next[_currStage];
+    return next_stage[_currStage];
 }
 
 /* 
@@ -114,29 +137,31 @@ Envelope::calcStageMultiplier (double start, double end, unsigned long numSample
 void
 Envelope::enterStage (EnvelopeStage stage)
 {
+    /* starting a stage reads the shape as it is now */
     _currStage = stage;
+    _version = _shape->version;
 
     _currSample = 0;
     if (_currStage == STAGE_SUSTAIN)
         _nextStageAt = 0;
     else
-        _nextStageAt = _values[_currStage] * Envelope::rate;
+        _nextStageAt = _shape->values[_currStage] * _shape->rate;
 
     switch (_currStage) {
         case STAGE_ATTACK:
-            _level = _minLevel;
+            _level = min_level;
             calcStageMultiplier(_level, 1.0, _nextStageAt);
             break;
 
         case STAGE_DECAY:
             _level = 1.0;
             calcStageMultiplier(_level,
-                    std::max(_values[STAGE_SUSTAIN], _minLevel),
+                    std::max(_shape->values[STAGE_SUSTAIN], min_level),
                     _nextStageAt);
             break;
 
         case STAGE_SUSTAIN:
-            _level = _values[STAGE_SUSTAIN];
+            _level = _shape->values[STAGE_SUSTAIN];
             _multiplier = 1.0;
             break;
 
@@ -145,19 +170,10 @@ Envelope::enterStage (EnvelopeStage stage)
              * Because this stage can be entered by any stage by releasing
              * the key, let it `decay' from the current output level.
              */
-            calcStageMultiplier(_level, _minLevel, _nextStageAt);
+            calcStageMultiplier(_level, min_level, _nextStageAt);
             break;
 
         default:
             break;
     }
 }
-
-/* Set the sample rate for all envelopes created */
-void
-Envelope::setRate (unsigned long rate)
-{
-    Envelope::rate = rate;
-}
-
-unsigned long Envelope::rate = 44100;
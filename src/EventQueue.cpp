@@ -0,0 +1,106 @@
+#include <algorithm>
+#include "EventQueue.hpp"
+
+EventQueue::EventQueue ()
+    : _sequence (0)
+    , _next (0)
+    , _origin (0)
+    , _rate (0)
+    , _latency (0)
+{
+    pthread_mutex_init(&_lock, NULL);
+}
+
+EventQueue::~EventQueue ()
+{
+    pthread_mutex_destroy(&_lock);
+}
+
+void
+EventQueue::push (const MidiEvent &event)
+{
+    Entry entry;
+    entry.event = event;
+    if (event.time)
+        entry.event.frame += frameAt(event.time);
+    /*
+     * Events already due all play at the start of the next block, so they
+     * keep the order they arrived in between themselves.
+     */
+    entry.frame = std::max(entry.event.frame, _next);
+    entry.sequence = _sequence++;
+    _queue.push(entry);
+}
+
+void
+EventQueue::input (MidiEvent event)
+{
+    pthread_mutex_lock(&_lock);
+    push(event);
+    pthread_mutex_unlock(&_lock);
+}
+
+void
+EventQueue::input (const MidiEvent *events, size_t count)
+{
+    pthread_mutex_lock(&_lock);
+    for (size_t i = 0; i < count; i++)
+        push(events[i]);
+    pthread_mutex_unlock(&_lock);
+}
+
+MidiEvent
+EventQueue::nextEvent ()
+{
+    MidiEvent event(MIDI_EMPTY);
+    pthread_mutex_lock(&_lock);
+    if (_queue.empty())
+        goto unlock;
+    event = _queue.top().event;
+    _queue.pop();
+unlock:
+    pthread_mutex_unlock(&_lock);
+    return event;
+}
+
+size_t
+EventQueue::drain (MidiEvent *events, size_t max, uint64_t before)
+{
+    size_t count = 0;
+    pthread_mutex_lock(&_lock);
+    while (count < max && !_queue.empty()) {
+        if (_queue.top().frame >= before)
+            break;
+        events[count++] = _queue.top().event;
+        _queue.pop();
+    }
+    if (before > _next)
+        _next = before;
+    pthread_mutex_unlock(&_lock);
+    return count;
+}
+
+void
+EventQueue::setClock (uint64_t origin, unsigned int rate)
+{
+    pthread_mutex_lock(&_lock);
+    _rate = rate;
+    _origin = origin;
+    pthread_mutex_unlock(&_lock);
+}
+
+void
+EventQueue::setLatency (uint64_t frames)
+{
+    pthread_mutex_lock(&_lock);
+    _latency = frames;
+    pthread_mutex_unlock(&_lock);
+}
+
+uint64_t
+EventQueue::frameAt (uint64_t time) const
+{
+    if (_origin == 0 || time < _origin)
+        return _next;
+    return (time - _origin) * (double) _rate / 1e9 + _latency;
+}
@@ -1,16 +1,49 @@
+#include <cmath>
 #include "Filter.hpp"
 #include "Definitions.hpp"
 
-Filter::Filter (const double cutoff, const double resonance)
-    : _mode (FILTER_LOWPASS)
-    , _cutoff (0.0)
-    , _cutoffThresh (cutoff)
-    , _cutoffMod (0.0)
-    , _resonance (resonance)
+/* range of the zero-delay-feedback filters' cutoff */
+static const double min_hz = 20.0;
+static const double max_hz = 20000.0;
+FilterCoefficients::FilterCoefficients (unsigned long rate)
+{
+    for (int i = 0; i <= FILTER_TABLE_SIZE; i++) {
+        double hz = Filter::cutoffToHz((double) i / FILTER_TABLE_SIZE);
+        /* stay clear of Nyquist where tan() blows up */
+        hz = std::min(hz, 0.49 * rate);
+        _g[i] = tan(PI * hz / rate);
+    }
+}
+
+double
+FilterCoefficients::lookup (double cutoff) const
+{
+    double pos = clamp(cutoff, 0.0, 1.0) * FILTER_TABLE_SIZE;
+    int i = std::min((int) pos, FILTER_TABLE_SIZE - 1);
+    double frac = pos - i;
+    return _g[i] + frac * (_g[i + 1] - _g[i]);
+}
+
+Filter::Filter (const double cutoff, const double resonance,
+                const FilterCoefficients *coefficients)
+    : _cutoff (0.0)
+    , _feedback (0.0)
     , _buf0 (0.0)
     , _buf1 (0.0)
     , _buf2 (0.0)
     , _buf3 (0.0)
+    , _a1 (0.0)
+    , _a2 (0.0)
+    , _a3 (0.0)
+    , _ic1 (0.0)
+    , _ic2 (0.0)
+    , _mode (FILTER_LOWPASS)
+    , _type (FILTER_TYPE_CASCADE)
+    , _cutoffThresh (cutoff)
+    , _cutoffMod (0.0)
+    , _resonance (resonance)
+    , _g (0.0)
+    , _coefficients (coefficients)
 {
     updateCutoff();
     updateFeedback();
@@ -19,19 +52,27 @@ Filter::Filter (const double cutoff, const double resonance)
 double
 Filter::process (const double input)
 {
-    if (input == 0.0)
-        return input;
-    _buf0 += _cutoff * (input - _buf0 + _feedback * (_buf0 - _buf1));
-    _buf1 += _cutoff * (_buf0 - _buf1);
-    _buf2 += _cutoff * (_buf1 - _buf2);
-    _buf3 += _cutoff * (_buf2 - _buf3);
+    switch (_type) {
+        case FILTER_TYPE_SVF:
+            return processType<FILTER_TYPE_SVF>(input);
+        case FILTER_TYPE_LADDER:
+            return processType<FILTER_TYPE_LADDER>(input);
+        default:
+            return processType<FILTER_TYPE_CASCADE>(input);
+    }
+}
+
+template <FilterType Type>
+double
+Filter::processType (const double input)
+{
     switch (_mode) {
         case FILTER_LOWPASS:
-            return _buf3;
+            return process<Type, FILTER_LOWPASS>(input);
         case FILTER_HIGHPASS:
-            return input - _buf3;
+            return process<Type, FILTER_HIGHPASS>(input);
         case FILTER_BANDPASS:
-            return _buf0 - _buf3;
+            return process<Type, FILTER_BANDPASS>(input);
         default:
             return 0.0;
     }
@@ -48,6 +89,9 @@ Filter::setCutoff (const double cutoff)
 void
 Filter::setCutoffMod (const double cutoffMod)
 {
+    /* called every control block, mostly with the same value */
+    if (cutoffMod == _cutoffMod)
+        return;
     _cutoffMod = cutoffMod;
     updateCutoff();
     updateFeedback();
@@ -60,20 +104,90 @@ Filter::setResonance (const double resonance)
     updateFeedback();
 }
 
+double
+Filter::resonance () const
+{
+    return _resonance;
+}
+
 void
 Filter::setMode (FilterMode mode)
 {
     _mode = mode;
 }
 
+FilterMode
+Filter::mode () const
+{
+    return _mode;
+}
+
+void
+Filter::setType (FilterType type)
+{
+    if (type == _type)
+        return;
+    _type = type;
+    _buf0 = _buf1 = _buf2 = _buf3 = 0.0;
+    _ic1 = _ic2 = 0.0;
+    updateCutoff();
+    updateFeedback();
+}
+
+FilterType
+Filter::type () const
+{
+    return _type;
+}
+
+double
+Filter::cutoffToHz (double cutoff)
+{
+    return min_hz * pow(max_hz / min_hz, clamp(cutoff, 0.0, 1.0));
+}
+
+double
+Filter::hzToCutoff (double hz)
+{
+    hz = clamp(hz, min_hz, max_hz);
+    return log(hz / min_hz) / log(max_hz / min_hz);
+}
+
 void inline
 Filter::updateCutoff ()
 {
-    _cutoff = clamp(_cutoffThresh + _cutoffMod, 0.01, 0.99);
+    /* the cascade goes unstable at the ends; the others reach 20Hz-20kHz */
+    if (_type == FILTER_TYPE_CASCADE) {
+        _cutoff = clamp(_cutoffThresh + _cutoffMod, 0.01, 0.99);
+    } else {
+        _cutoff = clamp(_cutoffThresh + _cutoffMod, 0.0, 1.0);
+        _g = _coefficients->lookup(_cutoff);
+    }
 }
 
 void inline
 Filter::updateFeedback ()
 {
-    _feedback = _resonance + (_resonance / (1.0 - _cutoff));
+    switch (_type) {
+        case FILTER_TYPE_SVF:
+            /* damping, from 2 (no resonance) down towards self-oscillation */
+            _feedback = 2.0 - 2.0 * _resonance;
+            _a1 = 1.0 / (1.0 + _g * (_g + _feedback));
+            _a2 = _g * _a1;
+            _a3 = _g * _a2;
+            break;
+
+        case FILTER_TYPE_LADDER: {
+            _feedback = 4.0 * _resonance;
+            _a1 = _g / (1.0 + _g);
+            _a2 = 1.0 / (1.0 + _g);
+            double G2 = _a1 * _a1;
+            _a3 = 1.0 / (1.0 + _feedback * G2 * G2);
+            break;
+        }
+
+        default:
+            _feedback = _resonance + (_resonance / (1.0 - _cutoff));
+            break;
+    }
 }
@@ -0,0 +1,194 @@
+#include <cstdarg>
+#include <cstdio>
+#ifdef SYNTH_JACK
+#include <jack/jack.h>
+#include <jack/midiport.h>
+#endif
+#include "JackDevice.hpp"
+
+/* most MIDI events played in one period; any more are dropped */
+static const size_t max_period_events = 512;
+
+#ifdef SYNTH_JACK
+static const char *output_names[2] = {"out_left", "out_right"};
+#endif
+
+JackDevice::JackDevice (const char *name, JackRender render, void *data)
+    : _client (NULL)
+    , _midiInput (NULL)
+    , _render (render)
+    , _data (data)
+    , _events (new MidiEvent[max_period_events])
+    , _status (DEVICE_STATUS_FAILED)
+{
+    pthread_mutex_init(&_errorLock, NULL);
+    _outputs[0] = _outputs[1] = NULL;
+
+#ifdef SYNTH_JACK
+    jack_status_t status;
+    jack_client_t *client = jack_client_open(name, JackNoStartServer, &status);
+    if (!client) {
+        setError("Could not connect to the JACK server (status 0x%x)", status);
+        return;
+    }
+    _client = client;
+
+    for (int i = 0; i < 2; i++) {
+        _outputs[i] = jack_port_register(client, output_names[i],
+                JACK_DEFAULT_AUDIO_TYPE, JackPortIsOutput | JackPortIsTerminal, 0);
+        if (!_outputs[i]) {
+            setError("Could not register JACK port `%s'", output_names[i]);
+            return;
+        }
+    }
+    _midiInput = jack_port_register(client, "midi_in", JACK_DEFAULT_MIDI_TYPE,
+            JackPortIsInput | JackPortIsTerminal, 0);
+    if (!_midiInput) {
+        setError("Could not register JACK port `midi_in'");
+        return;
+    }
+
+    jack_set_process_callback(client, JackDevice::process_callback, this);
+    jack_on_shutdown(client, JackDevice::shutdown_callback, this);
+    _status = DEVICE_STATUS_OK;
+#else
+    (void) name;
+    setError("Built without JACK support");
+#endif
+}
+
+JackDevice::~JackDevice ()
+{
+#ifdef SYNTH_JACK
+    if (_client)
+        jack_client_close((jack_client_t*) _client);
+#endif
+    delete[] _events;
+    pthread_mutex_destroy(&_errorLock);
+}
+
+bool
+JackDevice::start ()
+{
+#ifdef SYNTH_JACK
+    if (_status != DEVICE_STATUS_OK)
+        return false;
+
+    jack_client_t *client = (jack_client_t*) _client;
+    int err = jack_activate(client);
+    if (err != 0) {
+        setError("Could not activate JACK client (error %d)", err);
+        _status = DEVICE_STATUS_FAILED;
+        return false;
+    }
+
+    /* ports can only be connected once the client is active */
+    const char **playback = jack_get_ports(client, NULL, JACK_DEFAULT_AUDIO_TYPE,
+            JackPortIsPhysical | JackPortIsInput);
+    if (playback) {
+        for (int i = 0; i < 2 && playback[i]; i++)
+            jack_connect(client, jack_port_name((jack_port_t*) _outputs[i]),
+                    playback[i]);
+        jack_free(playback);
+    }
+    return true;
+#else
+    return false;
+#endif
+}
+
+DeviceStatus
+JackDevice::status () const
+{
+    return _status;
+}
+
+std::string
+JackDevice::error () const
+{
+    pthread_mutex_lock(&_errorLock);
+    std::string message = _error;
+    pthread_mutex_unlock(&_errorLock);
+    return message;
+}
+
+unsigned int
+JackDevice::getRate () const
+{
+#ifdef SYNTH_JACK
+    if (_client)
+        return jack_get_sample_rate((jack_client_t*) _client);
+#endif
+    return 0;
+}
+
+size_t
+JackDevice::getPeriodSize () const
+{
+#ifdef SYNTH_JACK
+    if (_client)
+        return jack_get_buffer_size((jack_client_t*) _client);
+#endif
+    return 0;
+}
+
+int
+JackDevice::process_callback (uint32_t frames, void *data)
+{
+    return ((JackDevice*) data)->process(frames);
+}
+
+void
+JackDevice::shutdown_callback (void *data)
+{
+    JackDevice *device = (JackDevice*) data;
+    device->_status = DEVICE_STATUS_FAILED;
+    device->setError("The JACK server shut down");
+}
+
+/*
+ * Runs on the server's real-time thread once a period. The events are already
+ * in time order, timed in frames from the start of the period.
+ */
+int
+JackDevice::process (uint32_t frames)
+{
+#ifdef SYNTH_JACK
+    float *out[2];
+    for (int i = 0; i < 2; i++)
+        out[i] = (float*) jack_port_get_buffer((jack_port_t*) _outputs[i], frames);
+
+    void *midi = jack_port_get_buffer((jack_port_t*) _midiInput, frames);
+    uint32_t available = jack_midi_get_event_count(midi);
+    size_t count = 0;
+    for (uint32_t i = 0; i < available && count < max_period_events; i++) {
+        jack_midi_event_t event;
+        if (jack_midi_event_get(&event, midi, i) != 0)
+            continue;
+        if (midi_decode(event.buffer, event.size, _events[count])) {
+            _events[count].frame = event.time;
+            count++;
+        }
+    }
+
+    _render(out, frames, _events, count, _data);
+#else
+    (void) frames;
+#endif
+    return 0;
+}
+
+void
+JackDevice::setError (const char *format, ...)
+{
+    char message[256];
+    va_list args;
+    va_start(args, format);
+    vsnprintf(message, sizeof(message), format, args);
+    va_end(args);
+
+    fprintf(stderr, "%s\n", message);
+    pthread_mutex_lock(&_errorLock);
+    _error = message;
+    pthread_mutex_unlock(&_errorLock);
+}
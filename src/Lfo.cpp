@@ -0,0 +1,78 @@
+#include <cmath>
+#include "Definitions.hpp"
+#include "Lfo.hpp"
+
+Lfo::Lfo ()
+    : _wave (LFO_WAVE_SINE)
+    , _rate (1.0)
+    , _phase (0.0)
+    , _value (0.0)
+    , _seed (0x12345678)
+    , _held (0.0)
+    , _sampleRate (44100)
+{
+}
+
+void
+Lfo::setWave (enum LfoWave wave)
+{
+    _wave = wave;
+}
+
+void
+Lfo::setRate (double rate)
+{
+    _rate = clamp(rate, 0.0, 100.0);
+}
+
+void
+Lfo::reset ()
+{
+    _phase = 0.0;
+    _value = 0.0;
+}
+
+double
+Lfo::value () const
+{
+    return _value;
+}
+
+double
+Lfo::advance (unsigned long frames)
+{
+    _phase += _rate * frames / _sampleRate;
+    if (_phase >= 1.0) {
+        _phase -= floor(_phase);
+        /* xorshift keeps the random wave repeatable between runs */
+        _seed ^= _seed << 13;
+        _seed ^= _seed >> 17;
+        _seed ^= _seed << 5;
+        _held = (_seed / 4294967295.0) * 2.0 - 1.0;
+    }
+
+    switch (_wave) {
+        case LFO_WAVE_SINE:
+            _value = sin(TWOPI * _phase);
+            break;
+        case LFO_WAVE_TRIANGLE:
+            _value = 1.0 - 4.0 * fabs(_phase - 0.5);
+            break;
+        case LFO_WAVE_SAW:
+            _value = 2.0 * _phase - 1.0;
+            break;
+        case LFO_WAVE_SQUARE:
+            _value = _phase < 0.5 ? 1.0 : -1.0;
+            break;
+        case LFO_WAVE_RANDOM:
+            _value = _held;
+            break;
+    }
+    return _value;
+}
+
+void
+Lfo::setSampleRate (unsigned long rate)
+{
+    _sampleRate = rate;
+}
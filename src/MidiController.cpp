@@ -1,12 +1,14 @@
-#include <cmath>
 #include <alsa/asoundlib.h>
 #include "MidiController.hpp"
+#include "EventQueue.hpp"
 #include "Definitions.hpp"
+#include "Tuning.hpp"
 
 static MidiEvent
 _midi_event_process (snd_seq_event_t *ev)
 {
     MidiEventType type = MIDI_UNHANDLED;
+    int channel = 0;
     int note = 0;
     double control = 0.0;
     double velocity = 0.0;
@@ -19,6 +21,7 @@ _midi_event_process (snd_seq_event_t *ev)
                 printf("[%u] Pitchbend:  val(%2x)\n", ev->time.tick,
                                                       ev->data.control.value);
             type = MIDI_PITCHBEND;
+            channel = ev->data.control.channel;
             pitch = (double) ev->data.control.value / 8192.0;
             break;
         }
@@ -30,6 +33,7 @@ _midi_event_process (snd_seq_event_t *ev)
                                                        ev->data.control.param,
                                                        ev->data.control.value);
             type = MIDI_CONTROL;
+            channel = ev->data.control.channel;
             note = ev->data.control.param;
             control = (double) ev->data.control.value / 127.0;
             break;
@@ -43,6 +47,7 @@ _midi_event_process (snd_seq_event_t *ev)
                                                       ev->data.note.velocity);
             if (ev->data.note.velocity > 0) {
                 type = MIDI_NOTEON;
+                channel = ev->data.note.channel;
                 note = ev->data.note.note;
                 velocity = (double)ev->data.note.velocity / 127.0;
             }
@@ -56,35 +61,99 @@ _midi_event_process (snd_seq_event_t *ev)
                                                        ev->data.note.note,
                                                        ev->data.note.velocity);
            type = MIDI_NOTEOFF;
+           channel = ev->data.note.channel;
            note = ev->data.note.note;
            break;
         }
     }
 
-    return MidiEvent(type, note, control, velocity, pitch);
+    MidiEvent event(type, note, control, velocity, pitch);
+    event.channel = channel;
+    return event;
 }
 
-struct MidiThreadData {
-    bool *collecting_events;
-    snd_seq_t *sequencer;
-    MidiController *controller;
-};
+bool
+midi_decode (const unsigned char *message, size_t length, MidiEvent &event)
+{
+    if (length < 3)
+        return false;
+
+    int status = message[0] & 0xf0;
+    int data1 = message[1] & 0x7f;
+    int data2 = message[2] & 0x7f;
 
-static void*
-_midi_event_thread (void *data)
+    switch (status) {
+        case 0x90:
+            if (data2 > 0) {
+                event = MidiEvent(MIDI_NOTEON, data1, 0.0, data2 / 127.0, 0.0);
+                break;
+            }
+            /* a note on with no velocity is a note off */
+        case 0x80:
+            event = MidiEvent(MIDI_NOTEOFF, data1, 0.0, 0.0, 0.0);
+            break;
+        case 0xb0:
+            event = MidiEvent(MIDI_CONTROL, data1, data2 / 127.0, 0.0, 0.0);
+            break;
+        case 0xe0:
+            event = MidiEvent(MIDI_PITCHBEND, 0, 0.0, 0.0,
+                    (((data2 << 7) | data1) - 8192) / 8192.0);
+            break;
+        default:
+            return false;
+    }
+
+    event.channel = message[0] & 0x0f;
+    return true;
+}
+
+/* How long the event thread waits for events before checking on things */
+static const int poll_timeout_ms = 100;
+
+/* Splits `name' or `name:port' into a device */
+static void
+parse_device (const char *spec, std::string &name, int &port)
 {
-    MidiThreadData *threadData = (MidiThreadData*) data;
-    bool *collecting_events = threadData->collecting_events;
-    snd_seq_t *sequencer = threadData->sequencer;
-    MidiController *controller = threadData->controller;
-    delete threadData;
+    name = spec;
+    port = -1;
+    size_t colon = name.rfind(':');
+    if (colon == std::string::npos || colon + 1 == name.size()
+            || name.find_first_not_of("0123456789", colon + 1) != std::string::npos)
+        return;
+    port = atoi(name.c_str() + colon + 1);
+    name.erase(colon);
+}
+
+void*
+MidiController::event_thread (void *data)
+{
+    ((MidiController*) data)->collectEvents();
+    return NULL;
+}
+
+void
+MidiController::collectEvents ()
+{
+    snd_seq_t *sequencer = (snd_seq_t*) _sequencer;
+    int nfds = snd_seq_poll_descriptors_count(sequencer, POLLIN);
+    struct pollfd *fds = new struct pollfd[nfds];
+    snd_seq_poll_descriptors(sequencer, fds, nfds, POLLIN);
 
     bool set_pending;
     int events_pending;
     snd_seq_event_t *seq_event = NULL;
     int r;
 
-    while (*collecting_events) {
+    while (_eventThreadWorking) {
+        updateDevices();
+
+        int ready = poll(fds, nfds, poll_timeout_ms);
+        /* keep up with any drift between the queue's clock and ours */
+        if (ready == 0)
+            syncQueue();
+        if (ready <= 0)
+            continue;
+
         set_pending = false;
         events_pending = 0;
         seq_event = NULL;
@@ -92,9 +161,12 @@ _midi_event_thread (void *data)
             r = snd_seq_event_input(sequencer, &seq_event);
             if (r == -EAGAIN)
                 break;
+            /* the input buffer overran and events were lost; carry on */
+            if (r == -ENOSPC)
+                continue;
             if (r < 0) {
-               fprintf(stderr, "_midi_event_thread: %s\n", snd_strerror(r));
-               exit(1);
+                setError("Could not read MIDI event: %s", snd_strerror(r));
+                break;
             }
             /*
              * Warning: `snd_seq_event_input_pending` seems to only 'work'
@@ -107,77 +179,343 @@ _midi_event_thread (void *data)
                events_pending = snd_seq_event_input_pending(sequencer, 0);
             }
 
-            controller->input(_midi_event_process(seq_event));
+            if (seq_event->source.client == SND_SEQ_CLIENT_SYSTEM) {
+                announce(seq_event);
+            } else {
+                MidiEvent event = _midi_event_process(seq_event);
+                if (_queue >= 0 && snd_seq_ev_is_real(seq_event))
+                    event.time = _queueOrigin
+                        + seq_event->time.time.tv_sec * 1000000000ULL
+                        + seq_event->time.time.tv_nsec;
+                input(event);
+            }
             events_pending--;
         } while (events_pending > 0);
     }
 
-    return NULL;
+    delete[] fds;
+}
+
+void
+MidiController::updateDevices ()
+{
+    std::vector<std::pair<Device, bool> > changes;
+    pthread_mutex_lock(&_devicesLock);
+    changes.swap(_deviceChanges);
+    pthread_mutex_unlock(&_devicesLock);
+    if (changes.empty())
+        return;
+
+    snd_seq_t *handle = (snd_seq_t*) _sequencer;
+    for (size_t i = 0; i < changes.size(); i++) {
+        const Device &device = changes[i].first;
+        if (changes[i].second) {
+            _devices.push_back(device);
+            continue;
+        }
+
+        for (size_t j = 0; j < _devices.size(); ) {
+            if (_devices[j].name == device.name && _devices[j].port == device.port)
+                _devices.erase(_devices.begin() + j);
+            else
+                j++;
+        }
+        for (size_t j = 0; j < _connections.size(); ) {
+            const Connection &c = _connections[j];
+            if (c.name == device.name && (device.port < 0 || c.port == device.port)) {
+                snd_seq_disconnect_from(handle, _port, c.client, c.port);
+                _connections.erase(_connections.begin() + j);
+            } else {
+                j++;
+            }
+        }
+    }
+
+    scan();
+    updateStatus();
+}
+
+void
+MidiController::scan ()
+{
+    snd_seq_t *handle = (snd_seq_t*) _sequencer;
+    snd_seq_client_info_t *cinfo;
+    snd_seq_port_info_t *pinfo;
+    snd_seq_client_info_alloca(&cinfo);
+    snd_seq_port_info_alloca(&pinfo);
+
+    snd_seq_client_info_set_client(cinfo, -1);
+    while (snd_seq_query_next_client(handle, cinfo) >= 0) {
+        int client = snd_seq_client_info_get_client(cinfo);
+        snd_seq_port_info_set_client(pinfo, client);
+        snd_seq_port_info_set_port(pinfo, -1);
+        while (snd_seq_query_next_port(handle, pinfo) >= 0)
+            connectPort(client, snd_seq_port_info_get_port(pinfo));
+    }
 }
 
-MidiController::MidiController (const char *midiDevice)
+void
+MidiController::connectPort (int client, int port)
+{
+    snd_seq_t *handle = (snd_seq_t*) _sequencer;
+    if (client == snd_seq_client_id(handle) || client == SND_SEQ_CLIENT_SYSTEM)
+        return;
+    for (size_t i = 0; i < _connections.size(); i++)
+        if (_connections[i].client == client && _connections[i].port == port)
+            return;
+
+    snd_seq_client_info_t *cinfo;
+    snd_seq_port_info_t *pinfo;
+    snd_seq_client_info_alloca(&cinfo);
+    snd_seq_port_info_alloca(&pinfo);
+    if (snd_seq_get_any_client_info(handle, client, cinfo) < 0
+            || snd_seq_get_any_port_info(handle, client, port, pinfo) < 0)
+        return;
+
+    /* only ports which send events can be listened to */
+    unsigned int caps = SND_SEQ_PORT_CAP_READ | SND_SEQ_PORT_CAP_SUBS_READ;
+    if ((snd_seq_port_info_get_capability(pinfo) & caps) != caps)
+        return;
+
+    const char *name = snd_seq_client_info_get_name(cinfo);
+    for (size_t i = 0; i < _devices.size(); i++) {
+        const Device &device = _devices[i];
+        if (device.name != name || (device.port >= 0 && device.port != port))
+            continue;
+
+        /* have the queue stamp each event with the time it arrived */
+        snd_seq_port_subscribe_t *sub;
+        snd_seq_addr_t sender, dest;
+        snd_seq_port_subscribe_alloca(&sub);
+        sender.client = client;
+        sender.port = port;
+        dest.client = snd_seq_client_id(handle);
+        dest.port = _port;
+        snd_seq_port_subscribe_set_sender(sub, &sender);
+        snd_seq_port_subscribe_set_dest(sub, &dest);
+        if (_queue >= 0) {
+            snd_seq_port_subscribe_set_queue(sub, _queue);
+            snd_seq_port_subscribe_set_time_update(sub, 1);
+            snd_seq_port_subscribe_set_time_real(sub, 1);
+        }
+
+        int err = snd_seq_subscribe_port(handle, sub);
+        if (err < 0) {
+            setError("Could not connect to midi device `%s': %s", name,
+                    snd_strerror(err));
+            return;
+        }
+        Connection c = {client, port, name};
+        _connections.push_back(c);
+        return;
+    }
+}
+
+void
+MidiController::syncQueue ()
+{
+    if (_queue < 0)
+        return;
+
+    snd_seq_queue_status_t *info;
+    snd_seq_queue_status_alloca(&info);
+    uint64_t before = monotonic_ns();
+    if (snd_seq_get_queue_status((snd_seq_t*) _sequencer, _queue, info) < 0)
+        return;
+    uint64_t now = before + (monotonic_ns() - before) / 2;
+
+    const snd_seq_real_time_t *t = snd_seq_queue_status_get_real_time(info);
+    _queueOrigin = now - (t->tv_sec * 1000000000ULL + t->tv_nsec);
+}
+
+void
+MidiController::announce (const void *data)
+{
+    const snd_seq_event_t *ev = (const snd_seq_event_t*) data;
+    int client = ev->data.addr.client;
+    int port = ev->data.addr.port;
+
+    switch (ev->type) {
+        case SND_SEQ_EVENT_PORT_START:
+            connectPort(client, port);
+            break;
+
+        case SND_SEQ_EVENT_PORT_EXIT:
+        case SND_SEQ_EVENT_CLIENT_EXIT:
+            /* the sequencer drops the subscriptions itself */
+            for (size_t i = 0; i < _connections.size(); ) {
+                const Connection &c = _connections[i];
+                if (c.client == client
+                        && (ev->type == SND_SEQ_EVENT_CLIENT_EXIT || c.port == port)) {
+                    setError("MIDI device `%s' disconnected", c.name.c_str());
+                    _connections.erase(_connections.begin() + i);
+                } else {
+                    i++;
+                }
+            }
+            break;
+
+        default:
+            return;
+    }
+
+    updateStatus();
+}
+
+void
+MidiController::updateStatus ()
+{
+    for (size_t i = 0; i < _devices.size(); i++) {
+        bool found = false;
+        for (size_t j = 0; j < _connections.size() && !found; j++)
+            found = _connections[j].name == _devices[i].name;
+        if (!found) {
+            _status = DEVICE_STATUS_RECONNECTING;
+            return;
+        }
+    }
+    _status = DEVICE_STATUS_OK;
+}
+
+MidiController::MidiController (const char *midiDevice, EventQueue *events)
     : _sequencer (NULL)
+    , _port (-1)
+    , _queue (-1)
+    , _queueOrigin (0)
     , _frequency (-1.0)
     , _velocity (0.0)
     , _pitch (0.0)
+    , _events (events)
+    , _eventThreadWorking (false)
+    , _status (DEVICE_STATUS_FAILED)
 {
-    snd_seq_t *handle = NULL;
-    int seq_port;
+    pthread_mutex_init(&_errorLock, NULL);
+    pthread_mutex_init(&_devicesLock, NULL);
 
     /* Setup the ALSA MIDI Sequencer */
-    CHK(snd_seq_open(&handle, "default", SND_SEQ_OPEN_INPUT, 0),
-            "Could not open sequencer");
+    snd_seq_t *handle = NULL;
+    int err = snd_seq_open(&handle, "default", SND_SEQ_OPEN_DUPLEX, 0);
+    if (err < 0) {
+        setError("Could not open sequencer: %s", snd_strerror(err));
+        return;
+    }
+    _sequencer = handle;
 
-    CHK(snd_seq_set_client_name(handle, "Midi Listener"),
-            "Could not set client name");
+    if ((err = snd_seq_set_client_name(handle, "Midi Listener")) < 0) {
+        setError("Could not set client name: %s", snd_strerror(err));
+        return;
+    }
 
-    CHK(seq_port = snd_seq_create_simple_port(handle, "listen:in",
+    _port = snd_seq_create_simple_port(handle, "listen:in",
                     SND_SEQ_PORT_CAP_WRITE|SND_SEQ_PORT_CAP_SUBS_WRITE,
-                    SND_SEQ_PORT_TYPE_APPLICATION),
-            "Could not open port");
-
-    CHK(snd_seq_nonblock(handle, 1), "Could not set non-blocking");
-
-    if (midiDevice != NULL) {
-        int client = -1;
-        snd_seq_client_info_t *cinfo;
-        snd_seq_client_info_alloca(&cinfo);
-        snd_seq_client_info_set_client(cinfo, -1);
-        /* Iterate over active clients until we find the midiDevice */
-        while (snd_seq_query_next_client(handle, cinfo) >= 0) {
-            char const* name = snd_seq_client_info_get_name(cinfo);
-            if (strcmp(name, midiDevice) != 0)
-                continue;
-            client = snd_seq_client_info_get_client(cinfo);
-        }
-        if (client < 0) {
-            fprintf(stderr, "Could not find midi device `%s'\n", midiDevice);
-            exit(1);
+                    SND_SEQ_PORT_TYPE_APPLICATION);
+    if (_port < 0) {
+        setError("Could not open port: %s", snd_strerror(_port));
+        return;
+    }
+
+    if ((err = snd_seq_nonblock(handle, 1)) < 0) {
+        setError("Could not set non-blocking: %s", snd_strerror(err));
+        return;
+    }
+
+    /* without a queue events still play, just on block boundaries */
+    _queue = snd_seq_alloc_named_queue(handle, "Midi Listener");
+    if (_queue >= 0) {
+        snd_seq_start_queue(handle, _queue, NULL);
+        if ((err = snd_seq_drain_output(handle)) < 0) {
+            setError("Could not start queue: %s", snd_strerror(err));
+            snd_seq_free_queue(handle, _queue);
+            _queue = -1;
         }
-        /* try to connect to client on port 0. TODO: accept port as argument */
-        CHK(snd_seq_connect_from(handle, seq_port, client, 0),
-                "Client connection failed");
+        syncQueue();
+    } else {
+        setError("Could not create queue: %s", snd_strerror(_queue));
     }
 
-    /* Create the struct to pass data to the event thread */
-    MidiThreadData *data = new MidiThreadData();
-    data->sequencer = handle;
-    data->controller = this;
-    data->collecting_events = &_eventThreadWorking;
+    /* hear about devices coming and going */
+    err = snd_seq_connect_from(handle, _port, SND_SEQ_CLIENT_SYSTEM,
+            SND_SEQ_PORT_SYSTEM_ANNOUNCE);
+    if (err < 0)
+        setError("Could not listen for new devices: %s", snd_strerror(err));
+
+    _status = DEVICE_STATUS_OK;
+    if (midiDevice) {
+        addDevice(midiDevice);
+        updateDevices();
+        if (_status != DEVICE_STATUS_OK)
+            setError("Could not find midi device `%s'", midiDevice);
+    }
 
     /* Finally start the thread */
-    _sequencer = handle;
     _eventThreadWorking = true;
-    pthread_mutex_init(&_eventQueueLock, NULL);
-    CHK(pthread_create(&_eventThread, NULL, _midi_event_thread, data),
-            "Could not create event thread");
+    if (pthread_create(&_eventThread, NULL, event_thread, this) != 0) {
+        setError("Could not create event thread");
+        _eventThreadWorking = false;
+        _status = DEVICE_STATUS_FAILED;
+    }
 }
 
 MidiController::~MidiController ()
 {
-    _eventThreadWorking = false;
-    pthread_join(_eventThread, NULL);
-    snd_seq_close((snd_seq_t*) _sequencer);
+    if (_eventThreadWorking) {
+        _eventThreadWorking = false;
+        pthread_join(_eventThread, NULL);
+    }
+    if (_sequencer)
+        snd_seq_close((snd_seq_t*) _sequencer);
+    pthread_mutex_destroy(&_errorLock);
+    pthread_mutex_destroy(&_devicesLock);
+}
+
+void
+MidiController::addDevice (const char *device)
+{
+    Device d;
+    parse_device(device, d.name, d.port);
+    pthread_mutex_lock(&_devicesLock);
+    _deviceChanges.push_back(std::make_pair(d, true));
+    pthread_mutex_unlock(&_devicesLock);
+}
+
+void
+MidiController::removeDevice (const char *device)
+{
+    Device d;
+    parse_device(device, d.name, d.port);
+    pthread_mutex_lock(&_devicesLock);
+    _deviceChanges.push_back(std::make_pair(d, false));
+    pthread_mutex_unlock(&_devicesLock);
+}
+
+void
+MidiController::setError (const char *format, ...)
+{
+    char message[256];
+    va_list args;
+    va_start(args, format);
+    vsnprintf(message, sizeof(message), format, args);
+    va_end(args);
+
+    fprintf(stderr, "%s\n", message);
+    pthread_mutex_lock(&_errorLock);
+    _error = message;
+    pthread_mutex_unlock(&_errorLock);
+}
+
+DeviceStatus
+MidiController::status () const
+{
+    return _status;
+}
+
+std::string
+MidiController::error () const
+{
+    pthread_mutex_lock(&_errorLock);
+    std::string message = _error;
+    pthread_mutex_unlock(&_errorLock);
+    return message;
 }
 
 double
@@ -213,11 +551,7 @@ MidiController::noteOn (int note) const
     return iter->second;
 }
 
-static inline double
-noteToFrequency (int note)
-{
-    return 440.0 * pow(2.0, (note - 69.0) / 12.0);
-}
+static const Tuning standard_tuning;
 
 void
 MidiController::process ()
@@ -231,7 +565,7 @@ MidiController::process ()
         case MIDI_NOTEON:
             if (e.type == MIDI_NOTEON && e.velocity) {
                 _note = e.note;
-                _frequency = noteToFrequency(_note);
+                _frequency = standard_tuning.frequency(_note);
                 _velocity = e.velocity;
                 _notes[_note] = true;
             }
@@ -255,9 +589,7 @@ MidiController::process ()
 void
 MidiController::input (MidiEvent event)
 {
-    pthread_mutex_lock(&_eventQueueLock);
-    _queue.push(event);
-    pthread_mutex_unlock(&_eventQueueLock);
+    _events->input(event);
 }
 
 /*
@@ -267,13 +599,5 @@ MidiController::input (MidiEvent event)
 MidiEvent
 MidiController::nextEvent ()
 {
-    MidiEvent event(MIDI_EMPTY);
-    pthread_mutex_lock(&_eventQueueLock);
-    if (_queue.empty())
-        goto unlock;
-    event = _queue.front();
-    _queue.pop();
-unlock:
-    pthread_mutex_unlock(&_eventQueueLock);
-    return event;
+    return _events->nextEvent();
 }
@@ -0,0 +1,334 @@
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include "MidiFile.hpp"
+
+/* 120 bpm, the tempo until the file says otherwise */
+static const uint32_t default_tempo = 500000;
+
+static inline uint32_t
+read_be32 (const unsigned char *p)
+{
+    return (p[0] << 24) | (p[1] << 16) | (p[2] << 8) | p[3];
+}
+
+static inline uint16_t
+read_be16 (const unsigned char *p)
+{
+    return (p[0] << 8) | p[1];
+}
+
+/*
+ * Reads a variable-length quantity, advancing `p'. Returns false if it runs
+ * past `end' or is longer than the 4 bytes the spec allows.
+ */
+static bool
+read_vlq (const unsigned char *&p, const unsigned char *end, uint32_t &value)
+{
+    value = 0;
+    for (int i = 0; i < 4; i++) {
+        if (p >= end)
+            return false;
+        unsigned char c = *p++;
+        value = (value << 7) | (c & 0x7f);
+        if (!(c & 0x80))
+            return true;
+    }
+    return false;
+}
+
+MidiFile::MidiFile (const char *path)
+    : _format (0)
+    , _tracks (0)
+    , _division (0)
+    , _smpte (false)
+{
+    FILE *file = fopen(path, "rb");
+    if (!file) {
+        _error = "could not open file";
+        return;
+    }
+
+    std::vector<unsigned char> data;
+    unsigned char buf[8192];
+    size_t n;
+    while ((n = fread(buf, 1, sizeof(buf), file)) > 0)
+        data.insert(data.end(), buf, buf + n);
+    fclose(file);
+
+    if (!parse(data)) {
+        _events.clear();
+        _tempos.clear();
+        return;
+    }
+
+    /* merge the tracks; ties keep file order so note-offs stay put */
+    std::stable_sort(_events.begin(), _events.end(),
+            [] (const TimedEvent &a, const TimedEvent &b) {
+                return a.tick < b.tick;
+            });
+    Tempo first = { 0, default_tempo };
+    _tempos.insert(_tempos.begin(), first);
+    std::stable_sort(_tempos.begin(), _tempos.end(),
+            [] (const Tempo &a, const Tempo &b) {
+                return a.tick < b.tick;
+            });
+}
+
+bool
+MidiFile::isOpen () const
+{
+    return _error.empty();
+}
+
+const char*
+MidiFile::error () const
+{
+    return _error.c_str();
+}
+
+int
+MidiFile::format () const
+{
+    return _format;
+}
+
+int
+MidiFile::tracks () const
+{
+    return _tracks;
+}
+
+bool
+MidiFile::parse (const std::vector<unsigned char> &data)
+{
+    const unsigned char *p = data.data();
+    const unsigned char *end = p + data.size();
+
+    if (data.size() < 14 || std::string((const char*) p, 4) != "MThd") {
+        _error = "not a standard MIDI file";
+        return false;
+    }
+
+    uint32_t headerLen = read_be32(p + 4);
+    _format = read_be16(p + 8);
+    _tracks = read_be16(p + 10);
+    uint16_t division = read_be16(p + 12);
+
+    if (_format > 1) {
+        _error = "only format 0 and 1 files are supported";
+        return false;
+    }
+
+    if (division & 0x8000) {
+        /* SMPTE: negative frames per second and ticks per frame */
+        int fps = -(int8_t)(division >> 8);
+        double rate = (fps == 29) ? 29.97 : fps;
+        _smpte = true;
+        _division = (unsigned int) round(rate * (division & 0xff));
+    } else {
+        _division = division;
+    }
+    if (_division == 0) {
+        _error = "invalid time division";
+        return false;
+    }
+
+    if (headerLen > (uint32_t)(end - p) - 8) {
+        _error = "truncated header";
+        return false;
+    }
+    p += 8 + headerLen;
+
+    for (int track = 0; track < _tracks; track++) {
+        /* skip any unknown chunks between the tracks */
+        while (end - p >= 8 && std::string((const char*) p, 4) != "MTrk") {
+            uint32_t len = read_be32(p + 4);
+            if (len > (uint32_t)(end - p) - 8)
+                break;
+            p += 8 + len;
+        }
+        if (end - p < 8) {
+            _error = "missing track chunk";
+            return false;
+        }
+        uint32_t len = read_be32(p + 4);
+        if (len > (uint32_t)(end - p) - 8) {
+            _error = "truncated track chunk";
+            return false;
+        }
+        if (!parseTrack(p + 8, p + 8 + len))
+            return false;
+        p += 8 + len;
+    }
+
+    return true;
+}
+
+bool
+MidiFile::parseTrack (const unsigned char *p, const unsigned char *end)
+{
+    uint64_t tick = 0;
+    unsigned char status = 0;
+
+    while (p < end) {
+        uint32_t delta;
+        if (!read_vlq(p, end, delta)) {
+            _error = "bad delta time";
+            return false;
+        }
+        tick += delta;
+
+        if (p >= end) {
+            _error = "truncated event";
+            return false;
+        }
+
+        if (*p == 0xff) {
+            /* meta event: only tempo and end of track matter to us */
+            uint32_t len;
+            if (end - p < 2) {
+                _error = "truncated meta event";
+                return false;
+            }
+            unsigned char type = p[1];
+            p += 2;
+            if (!read_vlq(p, end, len) || len > (uint32_t)(end - p)) {
+                _error = "truncated meta event";
+                return false;
+            }
+            if (type == 0x51 && len == 3) {
+                Tempo t = { tick, (uint32_t)((p[0] << 16) | (p[1] << 8) | p[2]) };
+                _tempos.push_back(t);
+            }
+            p += len;
+            if (type == 0x2f)
+                break;
+            continue;
+        }
+
+        if (*p == 0xf0 || *p == 0xf7) {
+            /* sysex is skipped, and cancels running status */
+            uint32_t len;
+            p++;
+            if (!read_vlq(p, end, len) || len > (uint32_t)(end - p)) {
+                _error = "truncated sysex event";
+                return false;
+            }
+            p += len;
+            status = 0;
+            continue;
+        }
+
+        if (*p & 0x80)
+            status = *p++;
+        else if (!status) {
+            _error = "data byte without running status";
+            return false;
+        }
+
+        unsigned char kind = status & 0xf0;
+        int dataLen = (kind == 0xc0 || kind == 0xd0) ? 1 : 2;
+        if (end - p < dataLen) {
+            _error = "truncated channel event";
+            return false;
+        }
+        unsigned char d0 = p[0];
+        unsigned char d1 = dataLen > 1 ? p[1] : 0;
+        p += dataLen;
+
+        TimedEvent e;
+        e.tick = tick;
+        switch (kind) {
+            case 0x90:
+                if (d1 > 0) {
+                    e.event = MidiEvent(MIDI_NOTEON, d0, 0.0, d1 / 127.0, 0.0);
+                    break;
+                }
+                /* a note on with no velocity is a note off */
+            case 0x80:
+                e.event = MidiEvent(MIDI_NOTEOFF, d0, 0.0, 0.0, 0.0);
+                break;
+            case 0xb0:
+                e.event = MidiEvent(MIDI_CONTROL, d0, d1 / 127.0, 0.0, 0.0);
+                break;
+            case 0xe0:
+            {
+                int bend = ((d1 << 7) | d0) - 8192;
+                e.event = MidiEvent(MIDI_PITCHBEND, 0, 0.0, 0.0, bend / 8192.0);
+                break;
+            }
+            default:
+                /* program change, aftertouch and friends aren't handled */
+                continue;
+        }
+        e.event.channel = status & 0x0f;
+        _events.push_back(e);
+    }
+
+    return true;
+}
+
+double
+MidiFile::seconds (uint64_t tick) const
+{
+    if (_smpte)
+        return (double) tick / _division;
+
+    double secs = 0.0;
+    for (size_t i = 0; i < _tempos.size(); i++) {
+        uint64_t start = _tempos[i].tick;
+        uint64_t stop = (i + 1 < _tempos.size()) ? _tempos[i + 1].tick : tick;
+        if (stop > tick)
+            stop = tick;
+        if (stop > start)
+            secs += (double)(stop - start) * _tempos[i].tempo / 1e6 / _division;
+        if (stop == tick)
+            break;
+    }
+    return secs;
+}
+
+std::vector<MidiEvent>
+MidiFile::events (unsigned int rate) const
+{
+    std::vector<MidiEvent> events;
+    events.reserve(_events.size());
+
+    /*
+     * Walk the events and tempo map together so each event costs O(1)
+     * rather than re-summing the map from the start.
+     */
+    size_t tempo = 0;
+    uint64_t tempoTick = 0;
+    double tempoSecs = 0.0;
+
+    for (size_t i = 0; i < _events.size(); i++) {
+        uint64_t tick = _events[i].tick;
+        double secs;
+        if (_smpte) {
+            secs = (double) tick / _division;
+        } else {
+            while (tempo + 1 < _tempos.size() && _tempos[tempo + 1].tick <= tick) {
+                tempoSecs += (double)(_tempos[tempo + 1].tick - tempoTick)
+                           * _tempos[tempo].tempo / 1e6 / _division;
+                tempoTick = _tempos[++tempo].tick;
+            }
+            secs = tempoSecs + (double)(tick - tempoTick)
+                 * _tempos[tempo].tempo / 1e6 / _division;
+        }
+        MidiEvent e = _events[i].event;
+        e.frame = (uint64_t) llround(secs * rate);
+        events.push_back(e);
+    }
+
+    return events;
+}
+
+uint64_t
+MidiFile::frames (unsigned int rate) const
+{
+    if (_events.empty())
+        return 0;
+    return (uint64_t) llround(seconds(_events.back().tick) * rate);
+}
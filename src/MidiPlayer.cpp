@@ -0,0 +1,115 @@
+#include <cstdio>
+#include <unistd.h>
+#include "MidiPlayer.hpp"
+
+/* frames rendered per block when rendering offline */
+static const size_t render_block = 256;
+/* how far ahead of the synth's clock events are scheduled, in seconds */
+static const double lookahead = 0.05;
+/* how often the player thread wakes up */
+static const useconds_t player_sleep = 2000;
+
+MidiPlayer::MidiPlayer (Synth *synth, const MidiFile &file)
+    : _synth (synth)
+    , _events (file.events(synth->getRate()))
+    , _length (file.frames(synth->getRate()))
+    , _next (0)
+    , _playing (false)
+    , _threadStarted (false)
+{
+}
+
+MidiPlayer::~MidiPlayer ()
+{
+    stop();
+}
+
+uint64_t
+MidiPlayer::length () const
+{
+    return _length;
+}
+
+bool
+MidiPlayer::isPlaying () const
+{
+    return _playing;
+}
+
+void
+MidiPlayer::scheduleUntil (uint64_t start, uint64_t until)
+{
+    while (_next < _events.size() && start + _events[_next].frame < until) {
+        MidiEvent e = _events[_next++];
+        e.frame += start;
+        _synth->schedule(e);
+    }
+}
+
+void
+MidiPlayer::play ()
+{
+    stop();
+    _next = 0;
+    _playing = true;
+    _threadStarted = true;
+    if (pthread_create(&_thread, NULL, MidiPlayer::player_thread, this) != 0) {
+        fprintf(stderr, "Could not create player thread\n");
+        _playing = false;
+        _threadStarted = false;
+    }
+}
+
+void
+MidiPlayer::stop ()
+{
+    if (!_threadStarted)
+        return;
+    _playing = false;
+    pthread_join(_thread, NULL);
+    _threadStarted = false;
+
+    /* release after everything already scheduled so no note is left hanging */
+    uint64_t when = _synth->frame() + (uint64_t)(lookahead * _synth->getRate());
+    for (int note = 0; note < 128; note++) {
+        MidiEvent e(MIDI_NOTEOFF, note, 0.0, 0.0, 0.0);
+        e.frame = when;
+        _synth->schedule(e);
+    }
+}
+
+void*
+MidiPlayer::player_thread (void *data)
+{
+    MidiPlayer *player = (MidiPlayer*) data;
+    Synth *synth = player->_synth;
+    uint64_t ahead = (uint64_t)(lookahead * synth->getRate());
+    uint64_t start = synth->frame() + ahead;
+
+    while (player->_playing && player->_next < player->_events.size()) {
+        player->scheduleUntil(start, synth->frame() + ahead);
+        usleep(player_sleep);
+    }
+    player->_playing = false;
+
+    return NULL;
+}
+
+uint64_t
+MidiPlayer::render (Recorder *recorder, double tail)
+{
+    float buffer[render_block * 2];
+    uint64_t start = _synth->frame();
+    uint64_t end = start + _length + (uint64_t)(tail * _synth->getRate());
+
+    _next = 0;
+    for (uint64_t frame = start; frame < end; frame += render_block) {
+        size_t frames = std::min((uint64_t) render_block, end - frame);
+        scheduleUntil(start, frame + frames);
+        _synth->render(buffer, frames);
+        if (recorder)
+            recorder->writeAll(buffer, frames);
+    }
+
+    return end - start;
+}
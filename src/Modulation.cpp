@@ -0,0 +1,46 @@
+#include "Modulation.hpp"
+
+ModMatrix::ModMatrix ()
+{
+    for (int i = 0; i < NUM_MOD_SLOTS; i++)
+        setSlot(i, MOD_SOURCE_NONE, MOD_DEST_NONE, 0.0);
+    /* what Voice always did before there was a matrix */
+    setSlot(0, MOD_SOURCE_FILTER_ENV, MOD_DEST_CUTOFF, 0.8);
+}
+
+void
+ModMatrix::setSlot (int slot, ModSource source, ModDest dest, double amount)
+{
+    if (slot < 0 || slot >= NUM_MOD_SLOTS)
+        return;
+    _slots[slot].source = source;
+    _slots[slot].dest = dest;
+    _slots[slot].amount = amount;
+}
+
+const ModSlot&
+ModMatrix::slot (int slot) const
+{
+    return _slots[slot];
+}
+
+void
+ModMatrix::process (const double sources[NUM_MOD_SOURCES][MAX_VOICES],
+                    double dests[NUM_MOD_DESTS][MAX_VOICES],
+                    size_t voices) const
+{
+    for (int d = 0; d < NUM_MOD_DESTS; d++)
+        for (size_t v = 0; v < voices; v++)
+            dests[d][v] = 0.0;
+
+    for (int i = 0; i < NUM_MOD_SLOTS; i++) {
+        const ModSlot &s = _slots[i];
+        if (s.source == MOD_SOURCE_NONE || s.dest == MOD_DEST_NONE)
+            continue;
+        const double *src = sources[s.source];
+        double *dst = dests[s.dest];
+        double amount = s.amount;
+        for (size_t v = 0; v < voices; v++)
+            dst[v] += amount * src[v];
+    }
+}
@@ -2,17 +2,16 @@
 #include "Oscillator.hpp"
 #include "Definitions.hpp"
 
-unsigned long Oscillator::rate = 44100.0;
-
 Oscillator::Oscillator ()
     : _mode (OSCILLATOR_WAVE_SQUARE)
+    , _muted (false)
+    , _useNaive (false)
+    , _rate (44100)
     , _freq (440.0)
-    , _pitch (0.0)
+    , _pitch (1.0)
     , _phase (0.0)
     , _phaseIncrement (0.0)
-    , _muted (false)
     , _lastOut (0.0)
-    , _useNaive (false)
 {
     setIncrement();
 }
@@ -55,108 +54,57 @@ Oscillator::useNaive (bool useNaive)
     _useNaive = useNaive;
 }
 
-/* Set the sample rate for all oscillators */
 void
 Oscillator::setRate (unsigned long rate)
 {
-    Oscillator::rate = (double) rate;
+    _rate = rate;
+    setIncrement();
 }
 
 void
 Oscillator::setIncrement ()
 {
-    double pitchModAsFrequency = pow(2.0, fabs(_pitch) * 14.0) - 1;
-    if (_pitch < 0) {
-        pitchModAsFrequency = -pitchModAsFrequency;
-    }
-    double freq = fmin(fmax(_freq + pitchModAsFrequency, 0), Oscillator::rate / 2.0);
-    _phaseIncrement = freq * TWOPI / Oscillator::rate;
+    double freq = fmin(_freq * _pitch, _rate / 2.0);
+    _phaseIncrement = freq * TWOPI / _rate;
 }
 
-double
-Oscillator::polyBlep (double t)
+enum OscillatorWave
+Oscillator::mode () const
 {
-    double dt = _phaseIncrement / TWOPI;
-    /* 0 <= t < 1 */
-    if (t < dt) {
-        t /= dt;
-        return t + t - t * t - 1.0;
-    }
-    /* -1 < t < 0 */
-    else if (t > 1.0 - dt) {
-        t = (t - 1.0) / dt;
-        return t * t + t + t + 1.0;
-    }
-    /* 0 otherwise */
-    else {
-        return 0.0;
-    }
+    return _mode;
 }
 
-double
-Oscillator::next ()
+bool
+Oscillator::naive () const
 {
-    double value = 0.0;
-    double t = _phase / TWOPI;
-
-    if (_muted)
-        return value;
+    return _useNaive;
+}
 
-    if (_useNaive) {
-        value = naiveWave();
-        goto increment;
-    }
-    
-    if (_mode == OSCILLATOR_WAVE_SINE) {
-        value = naiveWave();
-    }
-    else if (_mode == OSCILLATOR_WAVE_SAW) {
-        value = naiveWave();
-        value -= polyBlep(t);
-    }
-    else {
-        value = naiveWave();
-        value += polyBlep(t);
-        value -= polyBlep(fmod(t + 0.5, 1.0));
-        if (_mode == OSCILLATOR_WAVE_TRIANGLE) {
-            // Leaky integrator: y[n] = A * x[n] + (1 - A) * y[n-1]
-            value = _phaseIncrement * value + (1 - _phaseIncrement) * _lastOut;
-            _lastOut = value;
-        }
-    }
-    
-increment:
-    _phase += _phaseIncrement;
-    while (_phase >= TWOPI)
-        _phase -= TWOPI;
-    return value;
+bool
+Oscillator::muted () const
+{
+    return _muted;
 }
 
 double
-Oscillator::naiveWave ()
+Oscillator::next ()
 {
-    double value = 0.0;
+    if (_muted)
+        return 0.0;
+
     switch (_mode) {
         case OSCILLATOR_WAVE_SINE:
-            value = sin(_phase);
-            break;
-
+            return _useNaive ? next<OSCILLATOR_WAVE_SINE, true>()
+                             : next<OSCILLATOR_WAVE_SINE, false>();
         case OSCILLATOR_WAVE_SAW:
-            value = (2.0 * _phase / TWOPI) - 1.0;
-            break;
-
+            return _useNaive ? next<OSCILLATOR_WAVE_SAW, true>()
+                             : next<OSCILLATOR_WAVE_SAW, false>();
         case OSCILLATOR_WAVE_SQUARE:
-            if (_phase < PI) {
-                value = 1.0;
-            } else {
-                value = -1.0;
-            }
-            break;
-
+            return _useNaive ? next<OSCILLATOR_WAVE_SQUARE, true>()
+                             : next<OSCILLATOR_WAVE_SQUARE, false>();
         case OSCILLATOR_WAVE_TRIANGLE:
-            value = -1.0 + (2.0 * _phase / TWOPI);
-            value = 2.0 * (fabs(value) - 0.5);
-            break;
+            return _useNaive ? next<OSCILLATOR_WAVE_TRIANGLE, true>()
+                             : next<OSCILLATOR_WAVE_TRIANGLE, false>();
     }
-    return value;
+    return 0.0;
 }
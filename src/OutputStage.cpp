@@ -0,0 +1,259 @@
+#include <cmath>
+#include <cstring>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+#include "Definitions.hpp"
+#include "OutputStage.hpp"
+
+/* the limiter's ceiling, -0.2dBFS, and its timing in seconds */
+static const float limiter_ceiling = 0.977f;
+static const double limiter_lookahead = 0.002;
+static const double limiter_release = 0.08;
+/* full scale of the integer formats */
+static const float s16_scale = 32767.0f;
+static const float s24_scale = 8388607.0f;
+
+OutputStage::OutputStage (unsigned long rate, unsigned int channels)
+    : _clip (OUTPUT_CLIP_HARD)
+    , _dither (false)
+    , _seed (0x9e3779b9)
+    , _channels (channels)
+    , _delayPos (0)
+    , _minHead (0)
+    , _minCount (0)
+    , _count (0)
+    , _gain (1.0f)
+{
+    _lookahead = std::max((size_t) (limiter_lookahead * rate), (size_t) 1);
+    _delay = new float[_lookahead * _channels]();
+    _minGain = new float[_lookahead + 1];
+    _minFrame = new uint64_t[_lookahead + 1];
+    /* gain falls to its target within the lookahead and recovers slowly */
+    _attack = 1.0f - expf(-3.0f / _lookahead);
+    _release = 1.0f - expf(-1.0f / (limiter_release * rate));
+}
+
+OutputStage::~OutputStage ()
+{
+    delete[] _delay;
+    delete[] _minGain;
+    delete[] _minFrame;
+}
+
+void
+OutputStage::setClip (OutputClip clip)
+{
+    _clip = clip;
+}
+
+OutputClip
+OutputStage::clip () const
+{
+    return _clip;
+}
+
+void
+OutputStage::setDither (bool dither)
+{
+    _dither = dither;
+}
+
+inline float
+OutputStage::noise ()
+{
+    /* the sum of two uniform values is triangular; xorshift32 for each */
+    float sum = 0.0f;
+    for (int i = 0; i < 2; i++) {
+        _seed ^= _seed << 13;
+        _seed ^= _seed >> 17;
+        _seed ^= _seed << 5;
+        sum += (_seed >> 8) * (1.0f / 16777216.0f);
+    }
+    return sum - 1.0f;
+}
+
+void
+OutputStage::process (float *buffer, size_t frames)
+{
+    size_t samples = frames * _channels;
+    size_t i = 0;
+
+    switch (_clip) {
+        case OUTPUT_CLIP_HARD:
+#ifdef __SSE2__
+        {
+            __m128 lo = _mm_set1_ps(-1.0f);
+            __m128 hi = _mm_set1_ps(1.0f);
+            for (; i + 4 <= samples; i += 4) {
+                __m128 x = _mm_loadu_ps(buffer + i);
+                _mm_storeu_ps(buffer + i, _mm_min_ps(_mm_max_ps(x, lo), hi));
+            }
+        }
+#endif
+            for (; i < samples; i++)
+                buffer[i] = std::max(-1.0f, std::min(buffer[i], 1.0f));
+            break;
+
+        /*
+         * x(27 + x^2) / (27 + 9x^2) follows tanh closely and reaches exactly
+         * 1.0 at x = 3, past which it's held.
+         */
+        case OUTPUT_CLIP_SOFT:
+#ifdef __SSE2__
+        {
+            __m128 lo = _mm_set1_ps(-3.0f);
+            __m128 hi = _mm_set1_ps(3.0f);
+            __m128 k27 = _mm_set1_ps(27.0f);
+            __m128 k9 = _mm_set1_ps(9.0f);
+            for (; i + 4 <= samples; i += 4) {
+                __m128 x = _mm_loadu_ps(buffer + i);
+                x = _mm_min_ps(_mm_max_ps(x, lo), hi);
+                __m128 x2 = _mm_mul_ps(x, x);
+                __m128 num = _mm_mul_ps(x, _mm_add_ps(k27, x2));
+                __m128 den = _mm_add_ps(k27, _mm_mul_ps(k9, x2));
+                _mm_storeu_ps(buffer + i, _mm_div_ps(num, den));
+            }
+        }
+#endif
+            for (; i < samples; i++) {
+                float x = std::max(-3.0f, std::min(buffer[i], 3.0f));
+                float x2 = x * x;
+                buffer[i] = x * (27.0f + x2) / (27.0f + 9.0f * x2);
+            }
+            break;
+
+        case OUTPUT_CLIP_LIMIT:
+            limit(buffer, frames);
+            break;
+
+        default:
+            break;
+    }
+}
+
+/*
+ * Each frame's needed gain is the ceiling over its peak. The gain applied to
+ * the frame leaving the delay glides towards the lowest gain needed by any
+ * frame still in the delay, so it has come down by the time a peak arrives.
+ * The lowest is tracked with a monotonic queue rather than a scan.
+ */
+void
+OutputStage::limit (float *buffer, size_t frames)
+{
+    size_t window = _lookahead + 1;
+
+    for (size_t f = 0; f < frames; f++) {
+        float *in = buffer + f * _channels;
+        float peak = 0.0f;
+        for (unsigned c = 0; c < _channels; c++)
+            peak = std::max(peak, fabsf(in[c]));
+        float need = peak > limiter_ceiling ? limiter_ceiling / peak : 1.0f;
+
+        while (_minCount > 0 && _minFrame[_minHead] + _lookahead < _count) {
+            _minHead = (_minHead + 1) % window;
+            _minCount--;
+        }
+        while (_minCount > 0
+                && _minGain[(_minHead + _minCount - 1) % window] >= need)
+            _minCount--;
+        size_t back = (_minHead + _minCount) % window;
+        _minGain[back] = need;
+        _minFrame[back] = _count;
+        _minCount++;
+
+        float target = _minGain[_minHead];
+        if (target < _gain)
+            _gain += _attack * (target - _gain);
+        else
+            _gain += _release * (target - _gain);
+
+        float *out = _delay + _delayPos * _channels;
+        float outPeak = 0.0f;
+        for (unsigned c = 0; c < _channels; c++)
+            outPeak = std::max(outPeak, fabsf(out[c]));
+        /* the glide may not quite have got there; never let a peak through */
+        float gain = _gain;
+        if (outPeak * gain > limiter_ceiling)
+            gain = limiter_ceiling / outPeak;
+
+        for (unsigned c = 0; c < _channels; c++) {
+            float x = out[c];
+            out[c] = in[c];
+            in[c] = x * gain;
+        }
+        _delayPos = (_delayPos + 1) % _lookahead;
+        _count++;
+    }
+}
+
+void
+OutputStage::toS16 (const float *in, int16_t *out, size_t samples)
+{
+    size_t i = 0;
+#ifdef __SSE2__
+    __m128 scale = _mm_set1_ps(s16_scale);
+    __m128 lo = _mm_set1_ps(-32768.0f);
+    __m128 hi = _mm_set1_ps(32767.0f);
+    for (; i + 8 <= samples; i += 8) {
+        __m128 a = _mm_mul_ps(_mm_loadu_ps(in + i), scale);
+        __m128 b = _mm_mul_ps(_mm_loadu_ps(in + i + 4), scale);
+        if (_dither) {
+            float d[8];
+            for (int j = 0; j < 8; j++)
+                d[j] = noise();
+            a = _mm_add_ps(a, _mm_loadu_ps(d));
+            b = _mm_add_ps(b, _mm_loadu_ps(d + 4));
+        }
+        a = _mm_min_ps(_mm_max_ps(a, lo), hi);
+        b = _mm_min_ps(_mm_max_ps(b, lo), hi);
+        __m128i v = _mm_packs_epi32(_mm_cvtps_epi32(a), _mm_cvtps_epi32(b));
+        _mm_storeu_si128((__m128i*) (out + i), v);
+    }
+#endif
+    for (; i < samples; i++) {
+        float x = in[i] * s16_scale;
+        if (_dither)
+            x += noise();
+        out[i] = (int16_t) lrintf(std::max(-32768.0f, std::min(x, 32767.0f)));
+    }
+}
+
+void
+OutputStage::toS24 (const float *in, unsigned char *out, size_t samples)
+{
+    size_t i = 0;
+#ifdef __SSE2__
+    __m128 scale = _mm_set1_ps(s24_scale);
+    __m128 lo = _mm_set1_ps(-8388608.0f);
+    __m128 hi = _mm_set1_ps(8388607.0f);
+    for (; i + 4 <= samples; i += 4) {
+        __m128 a = _mm_mul_ps(_mm_loadu_ps(in + i), scale);
+        if (_dither) {
+            float d[4];
+            for (int j = 0; j < 4; j++)
+                d[j] = noise();
+            a = _mm_add_ps(a, _mm_loadu_ps(d));
+        }
+        a = _mm_min_ps(_mm_max_ps(a, lo), hi);
+        int32_t v[4];
+        _mm_storeu_si128((__m128i*) v, _mm_cvtps_epi32(a));
+        for (int j = 0; j < 4; j++) {
+            unsigned char *p = out + (i + j) * 3;
+            p[0] = v[j] & 0xff;
+            p[1] = (v[j] >> 8) & 0xff;
+            p[2] = (v[j] >> 16) & 0xff;
+        }
+    }
+#endif
+    for (; i < samples; i++) {
+        float x = in[i] * s24_scale;
+        if (_dither)
+            x += noise();
+        int32_t v = (int32_t) lrintf(std::max(-8388608.0f, std::min(x, 8388607.0f)));
+        unsigned char *p = out + i * 3;
+        p[0] = v & 0xff;
+        p[1] = (v >> 8) & 0xff;
+        p[2] = (v >> 16) & 0xff;
+    }
+}
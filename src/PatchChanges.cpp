@@ -0,0 +1,232 @@
+#include "PatchChanges.hpp"
+
+/* most replaced voice caches waiting to be freed */
+static const size_t max_old_caches = 4;
+
+PatchChanges::Settings::Settings ()
+    : bendRange (0.0)
+    , bank (NULL)
+{
+    for (int i = 0; i < NUM_LFOS; i++) {
+        lfoWave[i] = LFO_WAVE_SINE;
+        lfoRate[i] = 0.0;
+    }
+    for (int i = 0; i < NUM_MOD_SLOTS; i++) {
+        modulation[i].source = MOD_SOURCE_NONE;
+        modulation[i].dest = MOD_DEST_NONE;
+        modulation[i].amount = 0.0;
+    }
+    for (int i = 0; i < NUM_SETTINGS; i++)
+        changes[i] = 0;
+}
+
+PatchChanges::PatchChanges ()
+    : _cache (NULL)
+    , _oldCaches (max_old_caches)
+{
+    pthread_mutex_init(&_lock, NULL);
+    for (int i = 0; i < NUM_SETTINGS; i++)
+        _applied[i] = 0;
+}
+
+PatchChanges::~PatchChanges ()
+{
+    freeOldCaches();
+    delete _cache.exchange(NULL);
+    pthread_mutex_destroy(&_lock);
+}
+
+void
+PatchChanges::publish (Setting setting)
+{
+    _settings.changes[setting]++;
+    _published.write(_settings);
+}
+
+void
+PatchChanges::freeOldCaches ()
+{
+    VoiceCache *cache;
+    while (_oldCaches.pop(cache))
+        delete cache;
+}
+
+void
+PatchChanges::setWaveForm (enum OscillatorWave wave)
+{
+    pthread_mutex_lock(&_lock);
+    _settings.patch.waveform = wave;
+    publish(SETTING_WAVEFORM);
+    pthread_mutex_unlock(&_lock);
+}
+
+void
+PatchChanges::setADSR (EnvelopeStage stage, double value)
+{
+    pthread_mutex_lock(&_lock);
+    _settings.patch.adsr[stage] = value;
+    publish((Setting) (SETTING_ADSR + stage));
+    pthread_mutex_unlock(&_lock);
+}
+
+void
+PatchChanges::setFilterADSR (EnvelopeStage stage, double value)
+{
+    pthread_mutex_lock(&_lock);
+    _settings.patch.filterADSR[stage] = value;
+    publish((Setting) (SETTING_FILTER_ADSR + stage));
+    pthread_mutex_unlock(&_lock);
+}
+
+void
+PatchChanges::setFilterCutoff (double value)
+{
+    pthread_mutex_lock(&_lock);
+    _settings.patch.cutoff = value;
+    publish(SETTING_CUTOFF);
+    pthread_mutex_unlock(&_lock);
+}
+
+void
+PatchChanges::setFilterResonance (double value)
+{
+    pthread_mutex_lock(&_lock);
+    _settings.patch.resonance = value;
+    publish(SETTING_RESONANCE);
+    pthread_mutex_unlock(&_lock);
+}
+
+void
+PatchChanges::setFilterType (FilterType type)
+{
+    pthread_mutex_lock(&_lock);
+    _settings.patch.filter = type;
+    publish(SETTING_FILTER_TYPE);
+    pthread_mutex_unlock(&_lock);
+}
+
+void
+PatchChanges::setBendRange (double semitones)
+{
+    pthread_mutex_lock(&_lock);
+    _settings.bendRange = semitones;
+    publish(SETTING_BEND_RANGE);
+    pthread_mutex_unlock(&_lock);
+}
+
+void
+PatchChanges::setSampleBank (const SampleBank *bank)
+{
+    pthread_mutex_lock(&_lock);
+    _settings.bank = bank;
+    publish(SETTING_SAMPLE_BANK);
+    pthread_mutex_unlock(&_lock);
+}
+
+void
+PatchChanges::setLfo (int lfo, enum LfoWave wave, double rate)
+{
+    if (lfo < 0 || lfo >= NUM_LFOS)
+        return;
+    pthread_mutex_lock(&_lock);
+    _settings.lfoWave[lfo] = wave;
+    _settings.lfoRate[lfo] = rate;
+    publish((Setting) (SETTING_LFO + lfo));
+    pthread_mutex_unlock(&_lock);
+}
+
+void
+PatchChanges::setModulation (int slot, ModSource source, ModDest dest, double amount)
+{
+    if (slot < 0 || slot >= NUM_MOD_SLOTS)
+        return;
+    pthread_mutex_lock(&_lock);
+    _settings.modulation[slot].source = source;
+    _settings.modulation[slot].dest = dest;
+    _settings.modulation[slot].amount = amount;
+    publish((Setting) (SETTING_MODULATION + slot));
+    pthread_mutex_unlock(&_lock);
+}
+
+void
+PatchChanges::setPreset (const Preset &preset)
+{
+    pthread_mutex_lock(&_lock);
+    _settings.patch = preset;
+    publish(SETTING_PRESET);
+    pthread_mutex_unlock(&_lock);
+}
+
+void
+PatchChanges::setVoiceCache (size_t entries, size_t limit)
+{
+    VoiceCache *cache = new VoiceCache();
+    cache->setSize(entries, limit);
+
+    pthread_mutex_lock(&_lock);
+    freeOldCaches();
+    /* one the audio thread hasn't taken yet was never used */
+    delete _cache.exchange(cache);
+    pthread_mutex_unlock(&_lock);
+}
+
+void
+PatchChanges::update (Polyphonic &polyphonic, double &volume)
+{
+    /* only swap a cache in if the one it replaces can be handed back */
+    if (_oldCaches.writable() > 0) {
+        VoiceCache *cache = _cache.exchange(NULL);
+        if (cache) {
+            polyphonic.setVoiceCache(*cache);
+            _oldCaches.push(cache);
+        }
+    }
+
+    if (!_published.read(_latest))
+        return;
+
+    const Preset &patch = _latest.patch;
+    unsigned long *changes = _latest.changes;
+
+    /* a preset sets the patch with the newest of each of its settings */
+    if (changes[SETTING_PRESET] != _applied[SETTING_PRESET]) {
+        polyphonic.setPatch(patch.waveform, patch.adsr, patch.filterADSR,
+                patch.cutoff, patch.resonance, patch.filter);
+        volume = patch.volume;
+        for (int i = SETTING_PRESET; i <= SETTING_FILTER_TYPE; i++)
+            _applied[i] = changes[i];
+    }
+
+    for (int i = SETTING_WAVEFORM; i < NUM_SETTINGS; i++) {
+        if (changes[i] == _applied[i])
+            continue;
+        _applied[i] = changes[i];
+
+        if (i == SETTING_WAVEFORM) {
+            polyphonic.setWaveForm(patch.waveform);
+        } else if (i < SETTING_FILTER_ADSR) {
+            int stage = i - SETTING_ADSR;
+            polyphonic.setADSR((EnvelopeStage) stage, patch.adsr[stage]);
+        } else if (i < SETTING_CUTOFF) {
+            int stage = i - SETTING_FILTER_ADSR;
+            polyphonic.setFilterADSR((EnvelopeStage) stage, patch.filterADSR[stage]);
+        } else if (i == SETTING_CUTOFF) {
+            polyphonic.setFilterCutoff(patch.cutoff);
+        } else if (i == SETTING_RESONANCE) {
+            polyphonic.setFilterResonance(patch.resonance);
+        } else if (i == SETTING_FILTER_TYPE) {
+            polyphonic.setFilterType(patch.filter);
+        } else if (i == SETTING_BEND_RANGE) {
+            polyphonic.setBendRange(_latest.bendRange);
+        } else if (i == SETTING_SAMPLE_BANK) {
+            polyphonic.setSampleBank(_latest.bank);
+        } else if (i < SETTING_MODULATION) {
+            int lfo = i - SETTING_LFO;
+            polyphonic.setLfo(lfo, _latest.lfoWave[lfo], _latest.lfoRate[lfo]);
+        } else {
+            int slot = i - SETTING_MODULATION;
+            const ModSlot &m = _latest.modulation[slot];
+            polyphonic.setModulation(slot, m.source, m.dest, m.amount);
+        }
+    }
+}
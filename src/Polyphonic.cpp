@@ -1,33 +1,59 @@
-#include <cassert>
 #include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <new>
 #include "Definitions.hpp"
 #include "Polyphonic.hpp"
 
 /* PolyNotes start in the active state */
 Voice::Voice (enum OscillatorWave wave,
+          const int note,
           const double frequency,
           const double velocity,
-          double ADSR[4],
+          const EnvelopeShape *envShape,
           const double cutoff,
           const double resonance,
-          double filterADSR[4])
-    : _isActive (false)
-    , _velocity (0.0)
-    , _filter (Filter(cutoff, resonance))
-    , _env (Envelope(ADSR))
-    , _filterEnv (Envelope(filterADSR))
+          const EnvelopeShape *filterEnvShape,
+          unsigned long rate,
+          const FilterCoefficients *coefficients)
+    : _velocity (0.0)
+    , _gainLeft (1.0)
+    , _gainRight (1.0)
+    , _stepLeft (0.0)
+    , _stepRight (0.0)
+    , _rampFrames (0)
+    , _tap (NULL)
+    , _env (Envelope(envShape))
+    , _filterEnv (Envelope(filterEnvShape))
+    , _filter (Filter(cutoff, resonance, coefficients))
+    , _targetLeft (1.0)
+    , _targetRight (1.0)
+    , _isActive (false)
+    , _sampled (false)
+    , _note (note)
+    , _freq (frequency)
+    , _resonance (resonance)
+    , _pitchMod (0.0)
+    , _age (0)
+    , _recording (NULL)
+    , _playing (false)
+    , _snapshot (0)
 {
     noteOn(velocity);
     _filter.setMode(FILTER_LOWPASS);
     _oscillator.setMode(wave);
+    _oscillator.setRate(rate);
     _oscillator.setFreq(frequency);
     _oscillator.unmute();
+    _sampler.setRate(rate);
+    _sampler.setFreq(frequency);
 }
 
 /* Resets the envelope and note if already active */
 void
 Voice::noteOn (const double velocity)
 {
+    diverge();
     _isActive = true;
     _velocity = velocity;
     _env.noteOn();
@@ -36,6 +62,7 @@ Voice::noteOn (const double velocity)
 void
 Voice::noteOff ()
 {
+    diverge();
     _env.noteOff();
 }
 
@@ -48,161 +75,785 @@ Voice::isActive () const
 void
 Voice::setWave (enum OscillatorWave wave)
 {
+    diverge();
     _oscillator.setMode(wave);
 }
 
 void
-Voice::setPitch (double value)
+Voice::setPitch (double ratio)
 {
-    _oscillator.setPitch(value);
+    diverge();
+    _oscillator.setPitch(ratio);
+    _sampler.setPitch(ratio);
 }
 
 void
-Voice::setADSR (EnvelopeStage stage, double value)
+Voice::setFrequency (double frequency)
 {
-    _env.setValue(stage, value);
+    diverge();
+    _freq = frequency;
+    double freq = _freq * Tuning::ratio(_pitchMod);
+    _oscillator.setFreq(freq);
+    _sampler.setFreq(freq);
 }
 
 void
 Voice::setFilterCutoff (double value)
 {
+    diverge();
     _filter.setCutoff(value);
 }
 
 void
 Voice::setFilterResonance (double value)
 {
+    diverge();
+    _resonance = value;
     _filter.setResonance(value);
 }
 
 void
-Voice::setFilterADSR (EnvelopeStage stage, double value)
+Voice::setFilterType (FilterType type)
 {
-    _filterEnv.setValue(stage, value);
+    diverge();
+    _filter.setType(type);
+}
+
+void
+Voice::setSample (const SampleZone *zone)
+{
+    diverge();
+    _sampled = true;
+    _sampler.start(zone);
+}
+
+void
+Voice::clearSample ()
+{
+    if (!_sampled)
+        return;
+    diverge();
+    _sampled = false;
+    _sampler.start(NULL);
+}
+
+int
+Voice::note () const
+{
+    return _note;
 }
 
 double
+Voice::velocity () const
+{
+    return _velocity;
+}
+
+double
+Voice::envLevel () const
+{
+    return _env.level();
+}
+
+double
+Voice::filterEnvLevel () const
+{
+    return _filterEnv.level();
+}
+
+void
+Voice::modulate (double pitch, double cutoff, double resonance,
+                 double amp, double pan)
+{
+    if (_playing) {
+        /* the recording only holds for modulation where it had it */
+        if (_age != _recording->snapshots[_snapshot - 1].age)
+            diverge();
+    } else if (_recording) {
+        if (_age != _recording->snapshots.back().age)
+            snapshot();
+        bool settled = _env.stage() >= STAGE_SUSTAIN
+                    && _filterEnv.stage() >= STAGE_SUSTAIN;
+        if (settled || _age >= _recording->limit) {
+            _recording->complete = true;
+            diverge();
+        }
+    }
+
+    /* pick up envelope changes once a block rather than as they're made */
+    _env.update();
+    _filterEnv.update();
+
+    if (pitch != _pitchMod) {
+        _pitchMod = pitch;
+        double freq = _freq * Tuning::ratio(pitch);
+        _oscillator.setFreq(freq);
+        _sampler.setFreq(freq);
+    }
+    _filter.setCutoffMod(cutoff);
+    if (resonance != 0.0 || _filter.resonance() != _resonance)
+        _filter.setResonance(clamp(_resonance + resonance, 0.0, 0.99));
+
+    /* balance law: a centered voice plays at full level in both channels */
+    double gain = std::max(1.0 + amp, 0.0);
+    pan = clamp(pan, -1.0, 1.0);
+    _targetLeft = gain * std::min(1.0, 1.0 - pan);
+    _targetRight = gain * std::min(1.0, 1.0 + pan);
+    _stepLeft = (_targetLeft - _gainLeft) / CONTROL_RATE;
+    _stepRight = (_targetRight - _gainRight) / CONTROL_RATE;
+    _rampFrames = CONTROL_RATE;
+}
+
+void
+Voice::record (VoiceRecording *recording)
+{
+    _recording = recording;
+    _recording->users++;
+    _playing = false;
+    snapshot();
+}
+
+void
+Voice::play (VoiceRecording *recording)
+{
+    _recording = recording;
+    _recording->users++;
+    _playing = true;
+    /* the first snapshot is the state the voice starts in anyway */
+    _snapshot = 1;
+}
+
+void
+Voice::diverge ()
+{
+    VoiceRecording *recording = _recording;
+    if (!recording)
+        return;
+    _recording = NULL;
+    recording->users--;
+
+    if (!_playing) {
+        /* keep up to the last snapshot, where playback can go live */
+        recording->samples.resize(recording->snapshots.back().age);
+        recording->recording = false;
+        return;
+    }
+
+    /*
+     * The voice is in the state of the last snapshot it passed, so render
+     * the samples played back since then again, live, into nothing.
+     */
+    _playing = false;
+    size_t behind = _age - recording->snapshots[_snapshot - 1].age;
+    if (behind) {
+        double left[CONTROL_RATE] = {0.0};
+        double right[CONTROL_RATE] = {0.0};
+        double gainLeft = _gainLeft;
+        double gainRight = _gainRight;
+        size_t rampFrames = _rampFrames;
+        size_t age = _age;
+        render(left, right, behind);
+        _age = age;
+        _gainLeft = gainLeft;
+        _gainRight = gainRight;
+        _rampFrames = rampFrames;
+    }
+}
+
+void
+Voice::snapshot ()
+{
+    VoiceSnapshot state = {
+        _age, _pitchMod, _oscillator, _env, _filterEnv, _filter
+    };
+    _recording->snapshots.push_back(state);
+}
+
+void
+Voice::restore (const VoiceSnapshot &state)
+{
+    _pitchMod = state.pitchMod;
+    _oscillator = state.oscillator;
+    _env = state.env;
+    _filterEnv = state.filterEnv;
+    _filter = state.filter;
+}
+
+/*
+ * The sound sources a voice's render loop is specialized for: the oscillator
+ * waves, with polyBLEP and then naive, the sampler, and lastly a recording
+ * being played back.
+ */
+static const int naive_source = 4;
+static const int sampler_source = 8;
+static const int cached_source = 9;
+static const int num_sources = 10;
+
+template <int Source, FilterType Type, FilterMode Mode>
+inline double
 Voice::next ()
 {
-    assert(_isActive);
+    if (Source == cached_source)
+        return *_tap++;
+    PROFILE_START(t);
+    _filterEnv.next();
+    double amp = _env.next();
+    PROFILE_LAP(t, PROFILE_ENVELOPES);
+    double source = Source == sampler_source ? _sampler.next()
+        : _oscillator.next<(enum OscillatorWave) (Source % naive_source),
+                           (Source >= naive_source)>();
+    PROFILE_LAP(t, PROFILE_SOURCE);
+    double out = _filter.process<Type, Mode>(source * amp * _velocity);
+    PROFILE_LAP(t, PROFILE_FILTER);
+    return out;
+}
+
+template <int Source, FilterType Type, FilterMode Mode, bool Record>
+void
+Voice::render (double *left, double *right, size_t frames)
+{
+    double gainLeft = _gainLeft;
+    double gainRight = _gainRight;
+
+    /*
+     * The gains glide over the control block however it is split into
+     * calls, so the output doesn't depend on the caller's block size. The
+     * rest of the block plays at the gains they arrive at.
+     */
+    size_t ramp = std::min(frames, _rampFrames);
+    size_t i = 0;
+    for (; i < ramp; i++) {
+        double out = next<Source, Type, Mode>();
+        if (Record)
+            *_tap++ = out;
+        _rampFrames--;
+        gainLeft = _rampFrames ? gainLeft + _stepLeft : _targetLeft;
+        gainRight = _rampFrames ? gainRight + _stepRight : _targetRight;
+        left[i] += out * gainLeft;
+        right[i] += out * gainRight;
+    }
+    for (; i < frames; i++) {
+        double out = next<Source, Type, Mode>();
+        if (Record)
+            *_tap++ = out;
+        left[i] += out * gainLeft;
+        right[i] += out * gainRight;
+    }
+
+    _gainLeft = gainLeft;
+    _gainRight = gainRight;
     _isActive = _env.isActive();
-    _filter.setCutoffMod(_filterEnv.next() * 0.8);
-    return _filter.process(_oscillator.next() * _env.next() * _velocity);
+}
+
+typedef void (Voice::*VoiceKernel)(double*, double*, size_t);
+
+#define VOICE_KERNEL_MODES(source, type) { \
+        &Voice::render<source, type, FILTER_LOWPASS>, \
+        &Voice::render<source, type, FILTER_HIGHPASS>, \
+        &Voice::render<source, type, FILTER_BANDPASS> }
+
+#define VOICE_KERNEL_TYPES(source) { \
+        VOICE_KERNEL_MODES(source, FILTER_TYPE_CASCADE), \
+        VOICE_KERNEL_MODES(source, FILTER_TYPE_SVF), \
+        VOICE_KERNEL_MODES(source, FILTER_TYPE_LADDER) }
+
+#define VOICE_RECORDER_MODES(source, type) { \
+        &Voice::render<source, type, FILTER_LOWPASS, true>, \
+        &Voice::render<source, type, FILTER_HIGHPASS, true>, \
+        &Voice::render<source, type, FILTER_BANDPASS, true> }
+
+#define VOICE_RECORDER_TYPES(source) { \
+        VOICE_RECORDER_MODES(source, FILTER_TYPE_CASCADE), \
+        VOICE_RECORDER_MODES(source, FILTER_TYPE_SVF), \
+        VOICE_RECORDER_MODES(source, FILTER_TYPE_LADDER) }
+
+void
+Voice::render (double *left, double *right, size_t frames)
+{
+    static const VoiceKernel
+        kernels[num_sources][NUM_FILTER_TYPES][NUM_FILTER_MODES] = {
+        VOICE_KERNEL_TYPES(0), VOICE_KERNEL_TYPES(1), VOICE_KERNEL_TYPES(2),
+        VOICE_KERNEL_TYPES(3), VOICE_KERNEL_TYPES(4), VOICE_KERNEL_TYPES(5),
+        VOICE_KERNEL_TYPES(6), VOICE_KERNEL_TYPES(7), VOICE_KERNEL_TYPES(8),
+        VOICE_KERNEL_TYPES(9),
+    };
+    /* only oscillator voices are recorded */
+    static const VoiceKernel
+        recorders[sampler_source][NUM_FILTER_TYPES][NUM_FILTER_MODES] = {
+        VOICE_RECORDER_TYPES(0), VOICE_RECORDER_TYPES(1),
+        VOICE_RECORDER_TYPES(2), VOICE_RECORDER_TYPES(3),
+        VOICE_RECORDER_TYPES(4), VOICE_RECORDER_TYPES(5),
+        VOICE_RECORDER_TYPES(6), VOICE_RECORDER_TYPES(7),
+    };
+
+    /* control blocks never straddle a snapshot, but don't trust that */
+    if (_playing && _age + frames > _recording->samples.size())
+        diverge();
+
+    if (_playing) {
+        _tap = &_recording->samples[_age];
+        (this->*kernels[cached_source][0][0])(left, right, frames);
+        _age += frames;
+
+        /* where the next modulation is, carry on from the recorded state */
+        const std::vector<VoiceSnapshot> &snapshots = _recording->snapshots;
+        if (_age == snapshots[_snapshot].age) {
+            restore(snapshots[_snapshot]);
+            if (++_snapshot < snapshots.size())
+                return;
+            if (_recording->complete) {
+                diverge();
+            } else {
+                /* only this voice can have the key, as it has the note */
+                _playing = false;
+                _recording->recording = true;
+            }
+        }
+        return;
+    }
+
+    /* voices never mute their oscillator, so the kernels don't check */
+    int source = _sampled ? sampler_source
+        : _oscillator.mode() + (_oscillator.naive() ? naive_source : 0);
+    if (_recording) {
+        _recording->samples.resize(_age + frames);
+        _tap = &_recording->samples[_age];
+        (this->*recorders[source][_filter.type()][_filter.mode()])(left, right,
+                                                                   frames);
+    } else {
+        (this->*kernels[source][_filter.type()][_filter.mode()])(left, right,
+                                                                 frames);
+    }
+    _age += frames;
 }
 
 Polyphonic::Polyphonic (
             double a , double d,  double s,  double r,
             double fa, double fd, double fs, double fr,
-            double cutoff, double resonance)
+            double cutoff, double resonance, unsigned long rate)
+    : _rate (rate)
+    , _filterCoefficients (rate)
+    , _filterType (FILTER_TYPE_CASCADE)
+    , _bank (NULL)
+    , _bendRange (2.0)
+    , _bendValue (0.0)
+    , _bend (1.0)
+    , _voices (NULL)
+    , _voiceCount (0)
+    , _modControl (0.0)
+    , _controlCountdown (0)
+    , _controlElapsed (0)
+    , _spawned (0)
+    , _stolen (0)
+    , _retired (0)
 {
-    _noteADSR[STAGE_ATTACK] = a;
-    _noteADSR[STAGE_DECAY] = d;
-    _noteADSR[STAGE_SUSTAIN] = s;
-    _noteADSR[STAGE_RELEASE] = r;
+    _envShape.rate = rate;
+    _filterEnvShape.rate = rate;
+    for (int i = 0; i < NUM_LFOS; i++)
+        _lfos[i].setSampleRate(rate);
+
+    _envShape.values[STAGE_ATTACK] = a;
+    _envShape.values[STAGE_DECAY] = d;
+    _envShape.values[STAGE_SUSTAIN] = s;
+    _envShape.values[STAGE_RELEASE] = r;
 
     _filterCutoff = cutoff;
     _filterResonance = resonance;
-    _filterADSR[STAGE_ATTACK]  = fa;
-    _filterADSR[STAGE_DECAY]   = fd;
-    _filterADSR[STAGE_SUSTAIN] = fs;
-    _filterADSR[STAGE_RELEASE] = fr;
+    _filterEnvShape.values[STAGE_ATTACK]  = fa;
+    _filterEnvShape.values[STAGE_DECAY]   = fd;
+    _filterEnvShape.values[STAGE_SUSTAIN] = fs;
+    _filterEnvShape.values[STAGE_RELEASE] = fr;
+
+    void *arena = NULL;
+    if (posix_memalign(&arena, alignof(Voice), MAX_VOICES * sizeof(Voice)) != 0)
+        abort();
+    _voices = (Voice*) arena;
+    for (int i = 0; i < MAX_VOICES; i++)
+        _noteVoices[i] = NULL;
+}
+
+Polyphonic::~Polyphonic ()
+{
+    for (size_t i = 0; i < _voiceCount; i++)
+        _voices[i].~Voice();
+    free(_voices);
 }
 
 void
-Polyphonic::noteOn (const int note, const double velocity)
+Polyphonic::noteOn (const int note, double velocity)
 {
-    auto it = _notes.find(note);
-    if (it != _notes.end()) {
-        /* turn note back on if it already exists */
-        it->second.noteOn(velocity);
+    /* one voice per MIDI note keeps the voice count within MAX_VOICES */
+    if (note < 0 || note >= MAX_VOICES)
+        return;
+    if (_cache.size())
+        velocity = round(velocity * 127.0) / 127.0;
+    Voice *voice = _noteVoices[note];
+    if (voice) {
+        /* turn note back on if it already exists, with the current bank */
+        if (_bank)
+            voice->setSample(_bank->find(note, velocity));
+        else
+            voice->clearSample();
+        voice->noteOn(velocity);
+        PROFILE_COUNT(_stolen);
     } else {
-        /* otherwise just create it */
-        double freq = 440.0 * pow(2.0, (note - 69.0) / 12.0);
-        _notes.insert({note, Voice(_waveform, freq, velocity, _noteADSR,
-                    _filterCutoff, _filterResonance, _filterADSR)});
+        /* otherwise just create it, in the next free slot of the arena */
+        double freq = _tuning.frequency(note);
+        voice = new (&_voices[_voiceCount++]) Voice(_waveform, note, freq,
+                velocity, &_envShape, _filterCutoff, _filterResonance,
+                &_filterEnvShape, _rate, &_filterCoefficients);
+        _noteVoices[note] = voice;
+        voice->setFilterType(_filterType);
+        voice->setPitch(_bend);
+        if (_bank)
+            voice->setSample(_bank->find(note, velocity));
+        PROFILE_COUNT(_spawned);
+
+        if (_cache.size() == 0) {
+            /* modulate the new voice before it plays its first sample */
+            _controlCountdown = 0;
+            return;
+        }
+
+        /* where the voice starts in the control block shapes its sound */
+        size_t phase = _controlCountdown ? _controlCountdown : CONTROL_RATE;
+        if (cacheable()) {
+            VoiceKey key = voiceKey(note, freq, velocity, phase);
+            VoiceRecording *recording = _cache.find(key);
+            if (recording) {
+                if (!recording->recording)
+                    voice->play(recording);
+            } else {
+                recording = _cache.record(key);
+                if (recording)
+                    voice->record(recording);
+            }
+        }
+        /* unless modulation is due now anyway */
+        if (_controlCountdown)
+            modulateVoice(*voice);
     }
 }
 
 void
 Polyphonic::noteOff (const int note)
 {
-    auto it = _notes.find(note);
     /* MIDI keyboard sometimes sends errant 'noteOff' events */
-    if (it == _notes.end())
+    if (note < 0 || note >= MAX_VOICES || !_noteVoices[note])
         return;
-    it->second.noteOff();
+    _noteVoices[note]->noteOff();
 }
 
 bool
 Polyphonic::noteActive (const int note)
 {
-    auto it = _notes.find(note);
-    if (it == _notes.end())
+    if (note < 0 || note >= MAX_VOICES || !_noteVoices[note])
         return false;
-    return it->second.isActive();
+    return _noteVoices[note]->isActive();
 }
 
 void
 Polyphonic::setWaveForm (enum OscillatorWave wave)
 {
     _waveform = wave;
-    for (auto it = _notes.begin(); it != _notes.end(); it++)
-        it->second.setWave(wave);
+    for (size_t i = 0; i < _voiceCount; i++)
+        _voices[i].setWave(wave);
 }
 
 void
 Polyphonic::setPitch (double value)
 {
-    for (auto it = _notes.begin(); it != _notes.end(); it++)
-        it->second.setPitch(value);
+    /* one ratio for every voice, rather than one pow() per voice */
+    _bendValue = value;
+    _bend = Tuning::ratio(clamp(value, -1.0, 1.0) * _bendRange);
+    for (size_t i = 0; i < _voiceCount; i++)
+        _voices[i].setPitch(_bend);
+}
+
+void
+Polyphonic::setBendRange (double semitones)
+{
+    _bendRange = semitones;
+    setPitch(_bendValue);
+}
+
+void
+Polyphonic::setTuning (const Tuning &tuning)
+{
+    _tuning = tuning;
+    for (size_t i = 0; i < _voiceCount; i++)
+        _voices[i].setFrequency(_tuning.frequency(_voices[i].note()));
 }
 
 void
 Polyphonic::setADSR (EnvelopeStage stage, double value)
 {
-    _noteADSR[stage] = value;
-    for (auto it = _notes.begin(); it != _notes.end(); it++)
-        it->second.setADSR(stage, value);
+    /* the voices catch up at their next control block */
+    _envShape.set(stage, value);
+    divergeVoices();
 }
 
 void
 Polyphonic::setFilterADSR (EnvelopeStage stage, double value)
 {
-    _filterADSR[stage] = value;
-    for (auto it = _notes.begin(); it != _notes.end(); it++)
-        it->second.setFilterADSR(stage, value);
+    _filterEnvShape.set(stage, value);
+    divergeVoices();
 }
 
 void
 Polyphonic::setFilterCutoff (double value)
 {
     _filterCutoff = value;
-    for (auto it = _notes.begin(); it != _notes.end(); it++)
-        it->second.setFilterCutoff(value);
+    for (size_t i = 0; i < _voiceCount; i++)
+        _voices[i].setFilterCutoff(value);
 }
 
 void
 Polyphonic::setFilterResonance (double value)
 {
     _filterResonance = value;
-    for (auto it = _notes.begin(); it != _notes.end(); it++)
-        it->second.setFilterResonance(value);
+    for (size_t i = 0; i < _voiceCount; i++)
+        _voices[i].setFilterResonance(value);
 }
 
-double
-Polyphonic::next ()
-{
-    double out = 0.0;
-    /* This weird construction allows removing objects while iterating */
-    for (auto it = _notes.begin(); it != _notes.end(); ) {
-        if (!it->second.isActive()) {
-            if (DEBUG)
-                printf("Removing note %2x\n", it->first);
-            it = _notes.erase(it);
-        } else {
-            out += it->second.next();
-            it++;
+void
+Polyphonic::setFilterType (FilterType type)
+{
+    _filterType = type;
+    for (size_t i = 0; i < _voiceCount; i++)
+        _voices[i].setFilterType(type);
+}
+
+void
+Polyphonic::setSampleBank (const SampleBank *bank)
+{
+    _bank = bank;
+}
+
+void
+Polyphonic::setPatch (enum OscillatorWave wave,
+                      const double ADSR[4],
+                      const double filterADSR[4],
+                      double cutoff,
+                      double resonance,
+                      FilterType filterType)
+{
+    _waveform = wave;
+    _filterType = filterType;
+    _filterCutoff = cutoff;
+    _filterResonance = resonance;
+    for (int i = 0; i < NUM_STAGES; i++) {
+        _envShape.set((EnvelopeStage) i, ADSR[i]);
+        _filterEnvShape.set((EnvelopeStage) i, filterADSR[i]);
+    }
+
+    for (size_t v = 0; v < _voiceCount; v++) {
+        Voice &voice = _voices[v];
+        voice.setWave(wave);
+        voice.setFilterType(filterType);
+        voice.setFilterCutoff(cutoff);
+        voice.setFilterResonance(resonance);
+    }
+}
+
+void
+Polyphonic::setLfo (int lfo, enum LfoWave wave, double rate)
+{
+    if (lfo < 0 || lfo >= NUM_LFOS)
+        return;
+    _lfos[lfo].setWave(wave);
+    _lfos[lfo].setRate(rate);
+}
+
+void
+Polyphonic::setModulation (int slot, ModSource source, ModDest dest, double amount)
+{
+    _matrix.setSlot(slot, source, dest, amount);
+    divergeVoices();
+}
+
+void
+Polyphonic::setModControl (double value)
+{
+    _modControl = clamp(value, 0.0, 1.0);
+}
+
+void
+Polyphonic::removeVoice (size_t index)
+{
+    Voice &voice = _voices[index];
+    voice.diverge();
+    _noteVoices[voice.note()] = NULL;
+
+    size_t last = --_voiceCount;
+    if (index != last) {
+        voice = _voices[last];
+        _noteVoices[voice.note()] = &voice;
+    }
+    _voices[last].~Voice();
+}
+
+void
+Polyphonic::divergeVoices ()
+{
+    if (_cache.size() == 0)
+        return;
+    for (size_t i = 0; i < _voiceCount; i++)
+        _voices[i].diverge();
+}
+
+void
+Polyphonic::setVoiceCache (VoiceCache &cache)
+{
+    divergeVoices();
+    _cache.swap(cache);
+}
+
+void
+Polyphonic::gatherSources (Voice &voice, size_t column, double lfo1, double lfo2)
+{
+    _sources[MOD_SOURCE_NONE][column]       = 0.0;
+    _sources[MOD_SOURCE_AMP_ENV][column]    = voice.envLevel();
+    _sources[MOD_SOURCE_FILTER_ENV][column] = voice.filterEnvLevel();
+    _sources[MOD_SOURCE_LFO1][column]       = lfo1;
+    _sources[MOD_SOURCE_LFO2][column]       = lfo2;
+    _sources[MOD_SOURCE_VELOCITY][column]   = voice.velocity();
+    _sources[MOD_SOURCE_NOTE][column]       = (voice.note() - 60) / 64.0;
+    _sources[MOD_SOURCE_CONTROL][column]    = _modControl;
+}
+
+void
+Polyphonic::updateModulation ()
+{
+    double lfo1 = _lfos[0].advance(_controlElapsed);
+    double lfo2 = _lfos[1].advance(_controlElapsed);
+    _controlElapsed = 0;
+
+    /* gather each voice's sources into a column of the source table */
+    for (size_t v = 0; v < _voiceCount; v++)
+        gatherSources(_voices[v], v, lfo1, lfo2);
+
+    _matrix.process(_sources, _dests, _voiceCount);
+
+    for (size_t v = 0; v < _voiceCount; v++) {
+        _voices[v].modulate(_dests[MOD_DEST_PITCH][v],
+                            _dests[MOD_DEST_CUTOFF][v],
+                            _dests[MOD_DEST_RESONANCE][v],
+                            _dests[MOD_DEST_AMP][v],
+                            _dests[MOD_DEST_PAN][v]);
+    }
+}
+
+void
+Polyphonic::modulateVoice (Voice &voice)
+{
+    gatherSources(voice, 0, _lfos[0].value(), _lfos[1].value());
+    _matrix.process(_sources, _dests, 1);
+    voice.modulate(_dests[MOD_DEST_PITCH][0],
+                   _dests[MOD_DEST_CUTOFF][0],
+                   _dests[MOD_DEST_RESONANCE][0],
+                   _dests[MOD_DEST_AMP][0],
+                   _dests[MOD_DEST_PAN][0]);
+}
+
+bool
+Polyphonic::cacheable () const
+{
+    if (_bank)
+        return false;
+    for (int i = 0; i < NUM_MOD_SLOTS; i++) {
+        const ModSlot &slot = _matrix.slot(i);
+        bool shared = slot.source == MOD_SOURCE_LFO1
+                   || slot.source == MOD_SOURCE_LFO2
+                   || slot.source == MOD_SOURCE_CONTROL;
+        bool shaping = slot.dest == MOD_DEST_PITCH
+                    || slot.dest == MOD_DEST_CUTOFF
+                    || slot.dest == MOD_DEST_RESONANCE;
+        if (shared && shaping && slot.amount != 0.0)
+            return false;
+    }
+    return true;
+}
+
+VoiceKey
+Polyphonic::voiceKey (int note, double frequency, double velocity,
+                      size_t phase) const
+{
+    VoiceKey key;
+    double *k = key.values;
+    *k++ = _waveform;
+    *k++ = note;
+    *k++ = frequency;
+    *k++ = velocity;
+    *k++ = _bend;
+    *k++ = phase;
+    *k++ = _filterCutoff;
+    *k++ = _filterResonance;
+    *k++ = _filterType;
+    for (int i = 0; i < NUM_STAGES; i++) {
+        *k++ = _envShape.values[i];
+        *k++ = _filterEnvShape.values[i];
+    }
+    /* snapshots hold envelopes up to date with these versions */
+    *k++ = _envShape.version;
+    *k++ = _filterEnvShape.version;
+    /* gain and pan are applied live, so slots only reaching them don't count */
+    for (int i = 0; i < NUM_MOD_SLOTS; i++) {
+        const ModSlot &slot = _matrix.slot(i);
+        bool shaping = slot.dest == MOD_DEST_PITCH
+                    || slot.dest == MOD_DEST_CUTOFF
+                    || slot.dest == MOD_DEST_RESONANCE;
+        *k++ = shaping ? slot.source : 0;
+        *k++ = shaping ? slot.dest : 0;
+        *k++ = shaping ? slot.amount : 0.0;
+    }
+    return key;
+}
+
+void
+Polyphonic::render (double *left, double *right, size_t frames)
+{
+    for (size_t i = 0; i < frames; i++)
+        left[i] = right[i] = 0.0;
+
+    size_t pos = 0;
+    while (pos < frames) {
+        if (_controlCountdown == 0) {
+            PROFILE_START(t);
+            /*
+             * Drop finished notes before the matrix counts the voices. Only
+             * here so voices retire at the same frame however the blocks
+             * are split.
+             */
+            for (size_t v = 0; v < _voiceCount; ) {
+                if (!_voices[v].isActive()) {
+                    if (DEBUG)
+                        printf("Removing note %2x\n", _voices[v].note());
+                    removeVoice(v);
+                    PROFILE_COUNT(_retired);
+                } else {
+                    v++;
+                }
+            }
+            updateModulation();
+            _controlCountdown = CONTROL_RATE;
+            PROFILE_LAP(t, PROFILE_MODULATION);
         }
+
+        size_t n = std::min(frames - pos, _controlCountdown);
+        for (size_t v = 0; v < _voiceCount; v++)
+            _voices[v].render(left + pos, right + pos, n);
+        pos += n;
+        _controlCountdown -= n;
+        _controlElapsed += n;
     }
-    return out;
+}
+
+void
+Polyphonic::profile (ProfileBlock &block) const
+{
+    block.voices = _voiceCount;
+    block.spawned = _spawned;
+    block.stolen = _stolen;
+    block.retired = _retired;
 }
@@ -0,0 +1,276 @@
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <inttypes.h>
+#include "Definitions.hpp"
+#include "Preset.hpp"
+
+/*
+ * The binary format is a fixed 52 byte record so loading a preset is a single
+ * read: the magic `LSPB', a version byte, the waveform byte, the filter type
+ * byte, a reserved byte and then eleven little-endian floats in the order of
+ * the struct. Version 1 files predate the filter type and use the cascade.
+ */
+static const char binary_magic[4] = { 'L', 'S', 'P', 'B' };
+static const unsigned char binary_version = 2;
+static const size_t binary_values = 11;
+static const size_t binary_size = 8 + binary_values * 4;
+
+static const char *wave_names[] = { "sine", "saw", "square", "triangle" };
+static const char *stage_names[] = { "attack", "decay", "sustain", "release" };
+static const char *filter_names[] = { "cascade", "svf", "ladder" };
+
+Preset::Preset ()
+    : waveform (OSCILLATOR_WAVE_SQUARE)
+    , cutoff (0.99)
+    , resonance (0.0)
+    , filter (FILTER_TYPE_CASCADE)
+    , volume (1.0)
+{
+    adsr[STAGE_ATTACK]  = 0.01;
+    adsr[STAGE_DECAY]   = 0.5;
+    adsr[STAGE_SUSTAIN] = 0.5;
+    adsr[STAGE_RELEASE] = 1.0;
+
+    filterADSR[STAGE_ATTACK]  = 0.2;
+    filterADSR[STAGE_DECAY]   = 0.2;
+    filterADSR[STAGE_SUSTAIN] = 1.0;
+    filterADSR[STAGE_RELEASE] = 1.0;
+}
+
+void
+Preset::clampValues ()
+{
+    for (int i = 0; i < NUM_STAGES; i++) {
+        adsr[i] = clamp(adsr[i], 0.01, 1.5);
+        filterADSR[i] = clamp(filterADSR[i], 0.01, 1.5);
+    }
+    cutoff = clamp(cutoff, 0.0, 0.99);
+    resonance = clamp(resonance, 0.0, 0.99);
+    volume = clamp(volume, 0.0, 1.5);
+    if ((int) waveform < OSCILLATOR_WAVE_SINE
+            || (int) waveform > OSCILLATOR_WAVE_TRIANGLE)
+        waveform = OSCILLATOR_WAVE_SQUARE;
+    if ((int) filter < FILTER_TYPE_CASCADE || (int) filter >= NUM_FILTER_TYPES)
+        filter = FILTER_TYPE_CASCADE;
+}
+
+bool
+Preset::builtin (const char *name, Preset &preset)
+{
+    Preset p;
+    if (strcmp(name, "default") == 0) {
+        double a[] = { 0.01, 0.5, 1.0, 1.0 };
+        double f[] = { 0.01, 0.5, 1.0, 1.0 };
+        memcpy(p.adsr, a, sizeof(a));
+        memcpy(p.filterADSR, f, sizeof(f));
+        p.cutoff = 0.99;
+        p.resonance = 0.0;
+    }
+    else if (strcmp(name, "acid") == 0) {
+        double a[] = { 0.01, 0.4, 0.5, 0.4 };
+        double f[] = { 0.35, 0.40, 0.01, 0.01 };
+        memcpy(p.adsr, a, sizeof(a));
+        memcpy(p.filterADSR, f, sizeof(f));
+        p.cutoff = 0.15;
+        p.resonance = 0.90;
+    }
+    else if (strcmp(name, "pluck") == 0) {
+        double a[] = { 0.01, 1.5, 0.01, 1.5 };
+        double f[] = { 0.5, 1.5, 0.01, 1.5 };
+        memcpy(p.adsr, a, sizeof(a));
+        memcpy(p.filterADSR, f, sizeof(f));
+        p.cutoff = 0.85;
+        p.resonance = 0.85;
+    }
+    else {
+        return false;
+    }
+    preset = p;
+    return true;
+}
+
+bool
+Preset::load (const char *path)
+{
+    FILE *file = fopen(path, "rb");
+    if (!file) {
+        fprintf(stderr, "Could not open preset `%s'\n", path);
+        return false;
+    }
+
+    /* presets are tiny; anything large isn't one */
+    char buf[4096];
+    size_t length = fread(buf, 1, sizeof(buf) - 1, file);
+    fclose(file);
+    buf[length] = '\0';
+
+    bool ok;
+    if (length >= sizeof(binary_magic) && memcmp(buf, binary_magic, 4) == 0)
+        ok = loadBinary((const unsigned char*) buf, length);
+    else
+        ok = loadText(buf);
+
+    if (!ok)
+        fprintf(stderr, "Could not parse preset `%s'\n", path);
+    return ok;
+}
+
+bool
+Preset::loadBinary (const unsigned char *data, size_t length)
+{
+    if (length != binary_size || data[4] < 1 || data[4] > binary_version)
+        return false;
+
+    float values[binary_values];
+    for (size_t i = 0; i < binary_values; i++) {
+        const unsigned char *p = data + 8 + i * 4;
+        uint32_t bits = p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t) p[3] << 24);
+        memcpy(&values[i], &bits, sizeof(float));
+    }
+
+    Preset p;
+    p.waveform = (enum OscillatorWave) data[5];
+    if (data[4] >= 2)
+        p.filter = (FilterType) data[6];
+    for (int i = 0; i < NUM_STAGES; i++) {
+        p.adsr[i] = values[i];
+        p.filterADSR[i] = values[NUM_STAGES + i];
+    }
+    p.cutoff = values[8];
+    p.resonance = values[9];
+    p.volume = values[10];
+    p.clampValues();
+    *this = p;
+    return true;
+}
+
+/* Finds `name' in `names', returning its index or -1 */
+static int
+lookup (const char *name, const char **names, int count)
+{
+    for (int i = 0; i < count; i++)
+        if (strcmp(name, names[i]) == 0)
+            return i;
+    return -1;
+}
+
+bool
+Preset::loadText (const char *text)
+{
+    Preset p = *this;
+    char key[64], value[64];
+
+    while (*text) {
+        const char *eol = strchr(text, '\n');
+        size_t len = eol ? (size_t)(eol - text) : strlen(text);
+        char line[256];
+        if (len >= sizeof(line))
+            return false;
+        memcpy(line, text, len);
+        line[len] = '\0';
+        text += eol ? len + 1 : len;
+
+        char *hash = strchr(line, '#');
+        if (hash)
+            *hash = '\0';
+        for (char *c = line; *c; c++)
+            if (*c == '=')
+                *c = ' ';
+
+        int n = sscanf(line, "%63s %63s", key, value);
+        if (n <= 0)
+            continue;
+        if (n != 2)
+            return false;
+
+        int i;
+        if (strcmp(key, "waveform") == 0) {
+            if ((i = lookup(value, wave_names, 4)) < 0)
+                return false;
+            p.waveform = (enum OscillatorWave) i;
+            continue;
+        }
+        if (strcmp(key, "filter") == 0) {
+            if ((i = lookup(value, filter_names, NUM_FILTER_TYPES)) < 0)
+                return false;
+            p.filter = (FilterType) i;
+            continue;
+        }
+
+        char *end;
+        double v = strtod(value, &end);
+        if (*end != '\0')
+            return false;
+
+        if ((i = lookup(key, stage_names, NUM_STAGES)) >= 0)
+            p.adsr[i] = v;
+        else if (strncmp(key, "filter_", 7) == 0
+                && (i = lookup(key + 7, stage_names, NUM_STAGES)) >= 0)
+            p.filterADSR[i] = v;
+        else if (strcmp(key, "cutoff") == 0)
+            p.cutoff = v;
+        else if (strcmp(key, "resonance") == 0)
+            p.resonance = v;
+        else if (strcmp(key, "volume") == 0)
+            p.volume = v;
+        else
+            return false;
+    }
+
+    p.clampValues();
+    *this = p;
+    return true;
+}
+
+bool
+Preset::save (const char *path, PresetFormat format) const
+{
+    FILE *file = fopen(path, "wb");
+    if (!file) {
+        fprintf(stderr, "Could not open `%s' for writing\n", path);
+        return false;
+    }
+
+    if (format == PRESET_BINARY) {
+        unsigned char data[binary_size];
+        float values[binary_values];
+        for (int i = 0; i < NUM_STAGES; i++) {
+            values[i] = adsr[i];
+            values[NUM_STAGES + i] = filterADSR[i];
+        }
+        values[8] = cutoff;
+        values[9] = resonance;
+        values[10] = volume;
+
+        memcpy(data, binary_magic, 4);
+        data[4] = binary_version;
+        data[5] = (unsigned char) waveform;
+        data[6] = (unsigned char) filter;
+        data[7] = 0;
+        for (size_t i = 0; i < binary_values; i++) {
+            uint32_t bits;
+            memcpy(&bits, &values[i], sizeof(float));
+            unsigned char *p = data + 8 + i * 4;
+            p[0] = bits & 0xff;
+            p[1] = (bits >> 8) & 0xff;
+            p[2] = (bits >> 16) & 0xff;
+            p[3] = (bits >> 24) & 0xff;
+        }
+        fwrite(data, 1, sizeof(data), file);
+    } else {
+        fprintf(file, "waveform = %s\n", wave_names[waveform]);
+        for (int i = 0; i < NUM_STAGES; i++)
+            fprintf(file, "%s = %g\n", stage_names[i], adsr[i]);
+        for (int i = 0; i < NUM_STAGES; i++)
+            fprintf(file, "filter_%s = %g\n", stage_names[i], filterADSR[i]);
+        fprintf(file, "filter = %s\n", filter_names[filter]);
+        fprintf(file, "cutoff = %g\n", cutoff);
+        fprintf(file, "resonance = %g\n", resonance);
+        fprintf(file, "volume = %g\n", volume);
+    }
+
+    bool ok = !ferror(file);
+    fclose(file);
+    return ok;
+}
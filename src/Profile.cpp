@@ -0,0 +1,5 @@
+#include "Profile.hpp"
+
+#ifdef SYNTH_PROFILE
+thread_local uint64_t profile_cycles[NUM_PROFILE_STAGES];
+#endif
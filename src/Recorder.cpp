@@ -0,0 +1,250 @@
+#include <cstdint>
+#include <cstring>
+#include <unistd.h>
+#include "Definitions.hpp"
+#include "Recorder.hpp"
+
+/* seconds of audio the ring can hold before the audio thread drops frames */
+static const unsigned int ring_seconds = 4;
+/* frames converted and written per fwrite */
+static const size_t chunk_frames = 16384;
+/* stdio buffer size for the output file */
+static const size_t file_buffer_bytes = 1 << 20;
+/* how long the I/O thread sleeps when the ring runs dry */
+static const useconds_t idle_sleep = 10000;
+
+static inline void
+put_le16 (unsigned char *p, uint16_t v)
+{
+    p[0] = v & 0xff;
+    p[1] = (v >> 8) & 0xff;
+}
+
+static inline void
+put_le32 (unsigned char *p, uint32_t v)
+{
+    p[0] = v & 0xff;
+    p[1] = (v >> 8) & 0xff;
+    p[2] = (v >> 16) & 0xff;
+    p[3] = (v >> 24) & 0xff;
+}
+
+Recorder::Recorder (const char *path,
+                    RecorderFormat format,
+                    RecorderContainer container,
+                    unsigned int rate,
+                    unsigned int channels)
+    : _file (NULL)
+    , _format (format)
+    , _container (container)
+    , _rate (rate)
+    , _channels (channels)
+    , _output (rate, channels)
+    , _ring (NULL)
+    , _chunk (NULL)
+    , _bytes (NULL)
+    , _chunkFrames (chunk_frames)
+    , _dropped (0)
+    , _written (0)
+    , _running (false)
+{
+    _output.setDither(true);
+
+    switch (_format) {
+        case RECORDER_S16:
+            _bytesPerSample = 2;
+            break;
+        case RECORDER_S24:
+            _bytesPerSample = 3;
+            break;
+        case RECORDER_FLOAT:
+        default:
+            _bytesPerSample = 4;
+            break;
+    }
+
+    _file = fopen(path, "wb");
+    if (!_file) {
+        fprintf(stderr, "Could not open `%s' for recording\n", path);
+        return;
+    }
+    setvbuf(_file, NULL, _IOFBF, file_buffer_bytes);
+
+    _ring = new RingBuffer<float>(_rate * _channels * ring_seconds);
+    _chunk = new float[_chunkFrames * _channels];
+    _bytes = new unsigned char[_chunkFrames * _channels * _bytesPerSample];
+
+    /* placeholder header, sizes are filled in when the recorder closes */
+    writeHeader();
+
+    _running = true;
+    if (pthread_create(&_thread, NULL, Recorder::io_thread, this) != 0) {
+        fprintf(stderr, "Could not create recorder thread\n");
+        _running = false;
+        fclose(_file);
+        _file = NULL;
+    }
+}
+
+Recorder::~Recorder ()
+{
+    if (_file) {
+        _running = false;
+        pthread_join(_thread, NULL);
+        while (flush() > 0)
+            ;
+        writeHeader();
+        fclose(_file);
+    }
+    delete _ring;
+    delete[] _chunk;
+    delete[] _bytes;
+}
+
+bool
+Recorder::isOpen () const
+{
+    return _file != NULL;
+}
+
+size_t
+Recorder::write (const float *buffer, size_t frames)
+{
+    if (!_file)
+        return 0;
+    size_t samples = frames * _channels;
+    /* only ever write whole frames so channels never get out of step */
+    size_t space = _ring->writable() / _channels * _channels;
+    if (samples > space)
+        samples = space;
+    _ring->write(buffer, samples);
+    size_t queued = samples / _channels;
+    if (queued < frames)
+        _dropped += frames - queued;
+    return queued;
+}
+
+void
+Recorder::writeAll (const float *buffer, size_t frames)
+{
+    if (!_file)
+        return;
+    while (frames > 0) {
+        size_t space = _ring->writable() / _channels;
+        if (space == 0) {
+            usleep(1000);
+            continue;
+        }
+        size_t n = std::min(frames, space);
+        _ring->write(buffer, n * _channels);
+        buffer += n * _channels;
+        frames -= n;
+    }
+}
+
+unsigned long
+Recorder::dropped () const
+{
+    return _dropped;
+}
+
+unsigned long
+Recorder::written () const
+{
+    return _written;
+}
+
+size_t
+Recorder::flush ()
+{
+    size_t samples = _ring->read(_chunk, _chunkFrames * _channels);
+    if (samples == 0)
+        return 0;
+
+    switch (_format) {
+        case RECORDER_S16:
+        {
+            int16_t *s = (int16_t*) _bytes;
+            _output.toS16(_chunk, s, samples);
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+            for (size_t i = 0; i < samples; i++)
+                put_le16(_bytes + i * 2, (uint16_t) s[i]);
+#endif
+            break;
+        }
+        case RECORDER_S24:
+            _output.toS24(_chunk, _bytes, samples);
+            break;
+        case RECORDER_FLOAT:
+        {
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+            for (size_t i = 0; i < samples; i++) {
+                uint32_t v;
+                memcpy(&v, &_chunk[i], sizeof(v));
+                put_le32(_bytes + i * 4, v);
+            }
+#else
+            memcpy(_bytes, _chunk, samples * sizeof(float));
+#endif
+            break;
+        }
+    }
+
+    fwrite(_bytes, _bytesPerSample, samples, _file);
+    size_t frames = samples / _channels;
+    _written += frames;
+    return frames;
+}
+
+/*
+ * Writes the 44 byte RIFF/WAVE header at the start of the file. Called once
+ * with zero sizes when opening and again on close once the sizes are known.
+ * Raw PCM files have no header at all.
+ */
+void
+Recorder::writeHeader ()
+{
+    if (_container != RECORDER_WAV)
+        return;
+
+    uint64_t dataBytes = (uint64_t) _written * _channels * _bytesPerSample;
+    /* RIFF sizes are 32 bit; very long sessions saturate like most writers */
+    if (dataBytes > 0xffffffffULL - 36)
+        dataBytes = 0xffffffffULL - 36;
+
+    unsigned char h[44];
+    memcpy(h, "RIFF", 4);
+    put_le32(h + 4, 36 + (uint32_t) dataBytes);
+    memcpy(h + 8, "WAVE", 4);
+    memcpy(h + 12, "fmt ", 4);
+    put_le32(h + 16, 16);
+    /* 1 is integer PCM, 3 is IEEE float */
+    put_le16(h + 20, _format == RECORDER_FLOAT ? 3 : 1);
+    put_le16(h + 22, _channels);
+    put_le32(h + 24, _rate);
+    put_le32(h + 28, _rate * _channels * _bytesPerSample);
+    put_le16(h + 32, _channels * _bytesPerSample);
+    put_le16(h + 34, _bytesPerSample * 8);
+    memcpy(h + 36, "data", 4);
+    put_le32(h + 40, (uint32_t) dataBytes);
+
+    long pos = ftell(_file);
+    fseek(_file, 0, SEEK_SET);
+    fwrite(h, 1, sizeof(h), _file);
+    if (pos > (long) sizeof(h))
+        fseek(_file, pos, SEEK_SET);
+}
+
+void*
+Recorder::io_thread (void *data)
+{
+    Recorder *recorder = (Recorder*) data;
+
+    while (recorder->_running) {
+        /* keep writing full chunks while there's a backlog, else nap */
+        if (recorder->flush() < recorder->_chunkFrames)
+            usleep(idle_sleep);
+    }
+
+    return NULL;
+}
@@ -0,0 +1,326 @@
+#include <cstdio>
+#include <cstdlib>
+#include <fcntl.h>
+#include <strings.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "Definitions.hpp"
+#include "SampleBank.hpp"
+
+/* seconds at the start of every sample paged in when the bank loads */
+static const double preload_seconds = 0.25;
+
+static inline uint32_t
+get_le16 (const unsigned char *p)
+{
+    return p[0] | (p[1] << 8);
+}
+
+static inline uint32_t
+get_le32 (const unsigned char *p)
+{
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t) p[3] << 24);
+}
+
+/* Strips leading and trailing whitespace in place */
+static char*
+trim (char *s)
+{
+    while (*s == ' ' || *s == '\t')
+        s++;
+    char *end = s + strlen(s);
+    while (end > s && (end[-1] == ' ' || end[-1] == '\t'
+                || end[-1] == '\r' || end[-1] == '\n'))
+        *--end = '\0';
+    return s;
+}
+
+SampleBank::SampleBank (const char *path)
+{
+    size_t len = strlen(path);
+    bool ok;
+    if (len > 4 && strcasecmp(path + len - 4, ".wav") == 0) {
+        SampleZone zone;
+        ok = loadSample(path, zone);
+        if (ok)
+            _zones.push_back(zone);
+    } else {
+        ok = loadBank(path);
+    }
+
+    if (ok && _zones.empty()) {
+        _error = "bank has no samples";
+        ok = false;
+    }
+    if (!ok)
+        _zones.clear();
+
+    for (size_t i = 0; i < _zones.size(); i++) {
+        SampleZone &z = _zones[i];
+        if (z.loopEnd > z.frames)
+            z.loopEnd = z.frames;
+        if (z.loopStart >= z.loopEnd)
+            z.loopStart = z.loopEnd = 0;
+        preload(z);
+    }
+}
+
+SampleBank::~SampleBank ()
+{
+    for (auto it = _maps.begin(); it != _maps.end(); it++)
+        munmap(it->second.address, it->second.length);
+}
+
+bool
+SampleBank::isOpen () const
+{
+    return !_zones.empty();
+}
+
+const char*
+SampleBank::error () const
+{
+    return _error.c_str();
+}
+
+size_t
+SampleBank::zones () const
+{
+    return _zones.size();
+}
+
+size_t
+SampleBank::mappedBytes () const
+{
+    size_t bytes = 0;
+    for (auto it = _maps.begin(); it != _maps.end(); it++)
+        bytes += it->second.length;
+    return bytes;
+}
+
+const SampleZone*
+SampleBank::find (int note, double velocity) const
+{
+    int v = (int) (clamp(velocity, 0.0, 1.0) * 127.0 + 0.5);
+    for (size_t i = 0; i < _zones.size(); i++) {
+        const SampleZone &z = _zones[i];
+        if (note >= z.lowKey && note <= z.highKey
+                && v >= z.lowVelocity && v <= z.highVelocity)
+            return &z;
+    }
+    return NULL;
+}
+
+const SampleBank::Mapping*
+SampleBank::map (const std::string &path)
+{
+    auto it = _maps.find(path);
+    if (it != _maps.end())
+        return &it->second;
+
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        _error = "could not open `" + path + "'";
+        return NULL;
+    }
+    struct stat st;
+    void *address = MAP_FAILED;
+    if (fstat(fd, &st) == 0 && st.st_size > 0)
+        address = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    /* the mapping keeps the file open */
+    close(fd);
+    if (address == MAP_FAILED) {
+        _error = "could not map `" + path + "'";
+        return NULL;
+    }
+
+    Mapping m;
+    m.address = address;
+    m.length = st.st_size;
+    return &(_maps[path] = m);
+}
+
+/*
+ * Fills in a zone from a WAV file, covering every note and velocity. Only
+ * the chunk headers are read; the sample data is left on disk until played.
+ */
+bool
+SampleBank::loadSample (const std::string &path, SampleZone &zone)
+{
+    const Mapping *m = map(path);
+    if (!m)
+        return false;
+
+    const unsigned char *p = (const unsigned char*) m->address;
+    const unsigned char *end = p + m->length;
+    if (m->length < 12 || memcmp(p, "RIFF", 4) != 0 || memcmp(p + 8, "WAVE", 4) != 0) {
+        _error = "`" + path + "' is not a WAV file";
+        return false;
+    }
+
+    unsigned int tag = 0, bits = 0;
+    const unsigned char *data = NULL;
+    size_t dataLength = 0;
+
+    zone.channels = 0;
+    zone.rate = 0;
+    zone.root = 60;
+    zone.lowKey = 0;
+    zone.highKey = 127;
+    zone.lowVelocity = 0;
+    zone.highVelocity = 127;
+    zone.loopStart = zone.loopEnd = 0;
+
+    for (p += 12; p + 8 <= end; ) {
+        size_t length = get_le32(p + 4);
+        const unsigned char *body = p + 8;
+        length = std::min(length, (size_t) (end - body));
+
+        if (memcmp(p, "fmt ", 4) == 0 && length >= 16) {
+            tag = get_le16(body);
+            zone.channels = get_le16(body + 2);
+            zone.rate = get_le32(body + 4);
+            bits = get_le16(body + 14);
+            /* WAVE_FORMAT_EXTENSIBLE keeps the real tag in its GUID */
+            if (tag == 0xfffe && length >= 26)
+                tag = get_le16(body + 24);
+        } else if (memcmp(p, "data", 4) == 0) {
+            data = body;
+            dataLength = length;
+        } else if (memcmp(p, "smpl", 4) == 0 && length >= 36) {
+            zone.root = get_le32(body + 12) & 0x7f;
+            if (get_le32(body + 28) > 0 && length >= 60) {
+                zone.loopStart = get_le32(body + 44);
+                /* the end is inclusive in the chunk, exclusive here */
+                zone.loopEnd = get_le32(body + 48) + 1;
+            }
+        }
+        p = body + length + (length & 1);
+    }
+
+    if (tag == 1 && bits == 16) {
+        zone.format = SAMPLE_S16;
+    } else if (tag == 1 && bits == 24) {
+        zone.format = SAMPLE_S24;
+    } else if (tag == 3 && bits == 32) {
+        zone.format = SAMPLE_FLOAT;
+    } else {
+        _error = "`" + path + "' is not 16 bit, 24 bit or float PCM";
+        return false;
+    }
+    if (!data || zone.channels == 0 || zone.rate == 0) {
+        _error = "`" + path + "' has no sample data";
+        return false;
+    }
+
+    zone.data = data;
+    zone.bytesPerFrame = zone.channels * (bits / 8);
+    zone.frames = dataLength / zone.bytesPerFrame;
+    return true;
+}
+
+bool
+SampleBank::loadBank (const char *path)
+{
+    FILE *file = fopen(path, "r");
+    if (!file) {
+        _error = std::string("could not open `") + path + "'";
+        return false;
+    }
+
+    std::string dir = path;
+    size_t slash = dir.rfind('/');
+    dir = slash == std::string::npos ? "" : dir.substr(0, slash + 1);
+
+    char line[1024];
+    int lineno = 0;
+    bool ok = true;
+    SampleZone *zone = NULL;
+
+    while (ok && fgets(line, sizeof(line), file)) {
+        lineno++;
+        char *hash = strchr(line, '#');
+        if (hash)
+            *hash = '\0';
+        char *s = trim(line);
+        if (*s == '\0')
+            continue;
+
+        char *eq = strchr(s, '=');
+        if (!eq) {
+            ok = false;
+            break;
+        }
+        *eq = '\0';
+        char *key = trim(s);
+        char *value = trim(eq + 1);
+
+        if (strcmp(key, "sample") == 0) {
+            std::string sample = value[0] == '/' ? value : dir + value;
+            SampleZone z;
+            if (!loadSample(sample, z)) {
+                fclose(file);
+                return false;
+            }
+            _zones.push_back(z);
+            zone = &_zones.back();
+            continue;
+        }
+
+        char *end;
+        long v = strtol(value, &end, 10);
+        if (!zone || *end != '\0' || v < 0) {
+            ok = false;
+        } else if (strcmp(key, "root") == 0) {
+            zone->root = v;
+        } else if (strcmp(key, "low_key") == 0) {
+            zone->lowKey = v;
+        } else if (strcmp(key, "high_key") == 0) {
+            zone->highKey = v;
+        } else if (strcmp(key, "low_velocity") == 0) {
+            zone->lowVelocity = v;
+        } else if (strcmp(key, "high_velocity") == 0) {
+            zone->highVelocity = v;
+        } else if (strcmp(key, "loop_start") == 0) {
+            zone->loopStart = v;
+        } else if (strcmp(key, "loop_end") == 0) {
+            zone->loopEnd = v;
+        } else {
+            ok = false;
+        }
+    }
+    fclose(file);
+
+    if (!ok) {
+        char msg[64];
+        snprintf(msg, sizeof(msg), ":%d: bad line", lineno);
+        _error = path + std::string(msg);
+        return false;
+    }
+    return true;
+}
+
+/*
+ * Page in the start of a sample now, so the audio thread doesn't fault on
+ * the attack of a note. Everything after it is left to be paged in lazily
+ * as it plays.
+ */
+void
+SampleBank::preload (const SampleZone &zone)
+{
+    size_t frames = std::min(zone.frames, (size_t) (preload_seconds * zone.rate));
+    if (frames == 0)
+        return;
+
+    uintptr_t page = sysconf(_SC_PAGESIZE);
+    uintptr_t start = (uintptr_t) zone.data & ~(page - 1);
+    uintptr_t end = (uintptr_t) zone.data + frames * zone.bytesPerFrame;
+    madvise((void*) start, end - start, MADV_WILLNEED);
+
+    /* the advice is only a hint; touching each page makes sure */
+    unsigned char sum = 0;
+    for (uintptr_t p = start; p < end; p += page)
+        sum += *(volatile const unsigned char*) p;
+    (void) sum;
+}
@@ -0,0 +1,83 @@
+#include <cmath>
+#include "Definitions.hpp"
+#include "Sampler.hpp"
+#include "Tuning.hpp"
+
+Sampler::Sampler ()
+    : _zone (NULL)
+    , _position (0.0)
+    , _increment (0.0)
+    , _freq (0.0)
+    , _rootFreq (440.0)
+    , _pitch (1.0)
+    , _rate (44100)
+{ }
+
+void
+Sampler::start (const SampleZone *zone)
+{
+    _zone = zone;
+    _position = 0.0;
+    if (zone)
+        _rootFreq = 440.0 * Tuning::ratio(zone->root - 69.0);
+    setIncrement();
+}
+
+void
+Sampler::setFreq (double freq)
+{
+    _freq = freq;
+    setIncrement();
+}
+
+void
+Sampler::setPitch (double pitch)
+{
+    _pitch = pitch;
+    setIncrement();
+}
+
+void
+Sampler::setRate (unsigned long rate)
+{
+    _rate = rate;
+    setIncrement();
+}
+
+/*
+ * Step through the sample at the ratio of the note's frequency to the root
+ * note's, scaled by the sample's rate against the output rate.
+ */
+void
+Sampler::setIncrement ()
+{
+    if (!_zone)
+        return;
+    _increment = (_freq * _pitch / _rootFreq)
+            * ((double) _zone->rate / _rate);
+}
+
+double
+Sampler::next ()
+{
+    if (!_zone)
+        return 0.0;
+
+    const SampleZone &z = *_zone;
+    bool looping = z.loopEnd > z.loopStart;
+    if (looping && _position >= z.loopEnd)
+        _position = z.loopStart + fmod(_position - z.loopStart, z.loopEnd - z.loopStart);
+    else if (!looping && _position >= z.frames)
+        return 0.0;
+
+    size_t i = (size_t) _position;
+    double frac = _position - i;
+    size_t j = i + 1;
+    if (looping && j == z.loopEnd)
+        j = z.loopStart;
+
+    double a = z.value(i);
+    double b = j < z.frames ? z.value(j) : 0.0;
+    _position += _increment;
+    return a + frac * (b - a);
+}
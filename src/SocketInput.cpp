@@ -0,0 +1,297 @@
+#include <cerrno>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <netdb.h>
+#include <poll.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include "SocketInput.hpp"
+#include "EventQueue.hpp"
+#include "Definitions.hpp"
+
+static const unsigned char socket_magic[socket_header_size] = {'S', 'Y', 'N', 1};
+
+/* How long the receive thread waits for data before checking it should stop */
+static const int poll_timeout_ms = 100;
+
+/*
+ * Resolves `unix:<path>' or `udp:[<host>:]<port>' into a socket address.
+ * Returns the socket's domain, or -1 if the address isn't understood.
+ */
+static int
+resolve (const char *address, struct sockaddr_storage &addr, socklen_t &len)
+{
+    memset(&addr, 0, sizeof(addr));
+
+    if (strncmp(address, "unix:", 5) == 0) {
+        struct sockaddr_un *un = (struct sockaddr_un*) &addr;
+        const char *path = address + 5;
+        if (*path == '\0' || strlen(path) >= sizeof(un->sun_path))
+            return -1;
+        un->sun_family = AF_UNIX;
+        strcpy(un->sun_path, path);
+        len = sizeof(*un);
+        return AF_UNIX;
+    }
+
+    if (strncmp(address, "udp:", 4) == 0) {
+        char host[256] = "127.0.0.1";
+        const char *port = strrchr(address + 4, ':');
+        if (port) {
+            size_t n = port - (address + 4);
+            if (n >= sizeof(host))
+                return -1;
+            memcpy(host, address + 4, n);
+            host[n] = '\0';
+            port++;
+        } else {
+            port = address + 4;
+        }
+
+        struct addrinfo hints, *info;
+        memset(&hints, 0, sizeof(hints));
+        hints.ai_family = AF_UNSPEC;
+        hints.ai_socktype = SOCK_DGRAM;
+        if (getaddrinfo(host, port, &hints, &info) != 0)
+            return -1;
+        memcpy(&addr, info->ai_addr, info->ai_addrlen);
+        len = info->ai_addrlen;
+        int domain = info->ai_family;
+        freeaddrinfo(info);
+        return domain;
+    }
+
+    return -1;
+}
+
+/* Decodes one event, returning false for messages the synth doesn't play */
+static bool
+decode (const unsigned char *p, MidiEvent &event)
+{
+    if (!midi_decode(p, 3, event))
+        return false;
+    event.frame = p[4] | (p[5] << 8) | (p[6] << 16) | ((uint32_t) p[7] << 24);
+    return true;
+}
+
+/* Encodes one event, returning false for events with no message */
+static bool
+encode (const MidiEvent &event, unsigned char *p)
+{
+    int status, data1 = 0, data2 = 0;
+
+    switch (event.type) {
+        case MIDI_NOTEON:
+            status = 0x90;
+            data1 = event.note;
+            data2 = clamp(round(event.velocity * 127.0), 1.0, 127.0);
+            break;
+        case MIDI_NOTEOFF:
+            status = 0x80;
+            data1 = event.note;
+            break;
+        case MIDI_CONTROL:
+            status = 0xb0;
+            data1 = event.note;
+            data2 = clamp(round(event.control * 127.0), 0.0, 127.0);
+            break;
+        case MIDI_PITCHBEND:
+        {
+            int bend = clamp(round(event.pitch * 8192.0) + 8192.0, 0.0, 16383.0);
+            status = 0xe0;
+            data1 = bend & 0x7f;
+            data2 = bend >> 7;
+            break;
+        }
+        default:
+            return false;
+    }
+
+    uint32_t offset = std::min(event.frame, (uint64_t) UINT32_MAX);
+    p[0] = status | (event.channel & 0x0f);
+    p[1] = data1 & 0x7f;
+    p[2] = data2 & 0x7f;
+    p[3] = 0;
+    p[4] = offset & 0xff;
+    p[5] = (offset >> 8) & 0xff;
+    p[6] = (offset >> 16) & 0xff;
+    p[7] = offset >> 24;
+    return true;
+}
+
+SocketInput::SocketInput (const char *address, EventQueue *events)
+    : _socket (-1)
+    , _events (events)
+    , _running (false)
+{
+    struct sockaddr_storage addr;
+    socklen_t len;
+    int domain = resolve(address, addr, len);
+    if (domain < 0) {
+        fprintf(stderr, "Could not resolve socket address `%s'\n", address);
+        return;
+    }
+
+    _socket = socket(domain, SOCK_DGRAM, 0);
+    if (_socket < 0) {
+        fprintf(stderr, "Could not create socket: %s\n", strerror(errno));
+        return;
+    }
+
+    /* a socket left behind by an earlier run would stop the bind */
+    if (domain == AF_UNIX) {
+        const char *path = ((struct sockaddr_un*) &addr)->sun_path;
+        struct stat st;
+        if (stat(path, &st) == 0 && S_ISSOCK(st.st_mode))
+            unlink(path);
+    }
+
+    if (bind(_socket, (struct sockaddr*) &addr, len) < 0) {
+        fprintf(stderr, "Could not bind `%s': %s\n", address, strerror(errno));
+        close(_socket);
+        _socket = -1;
+        return;
+    }
+    if (domain == AF_UNIX)
+        _path = ((struct sockaddr_un*) &addr)->sun_path;
+
+    _running = true;
+    if (pthread_create(&_thread, NULL, SocketInput::receive_thread, this) != 0) {
+        fprintf(stderr, "Could not create socket thread\n");
+        _running = false;
+        close(_socket);
+        _socket = -1;
+    }
+}
+
+SocketInput::~SocketInput ()
+{
+    if (_running) {
+        _running = false;
+        pthread_join(_thread, NULL);
+    }
+    if (_socket >= 0)
+        close(_socket);
+    if (!_path.empty())
+        unlink(_path.c_str());
+}
+
+bool
+SocketInput::isOpen () const
+{
+    return _socket >= 0;
+}
+
+void*
+SocketInput::receive_thread (void *data)
+{
+    ((SocketInput*) data)->receive();
+    return NULL;
+}
+
+/*
+ * Wait for a datagram, then take every other datagram already waiting too
+ * and insert the lot at once, so a burst costs the audio thread one lock.
+ */
+void
+SocketInput::receive ()
+{
+    static const size_t max_batch = 4 * socket_max_events;
+    MidiEvent batch[max_batch];
+    unsigned char buf[socket_header_size
+        + socket_max_events * socket_event_size];
+
+    struct pollfd fd;
+    fd.fd = _socket;
+    fd.events = POLLIN;
+
+    while (_running) {
+        if (poll(&fd, 1, poll_timeout_ms) <= 0)
+            continue;
+
+        size_t count = 0;
+        while (count + socket_max_events <= max_batch) {
+            ssize_t len = recv(_socket, buf, sizeof(buf), MSG_DONTWAIT);
+            if (len < 0)
+                break;
+
+            /*
+             * every event in a datagram is timed from its arrival, which the
+             * queue puts on the sample clock
+             */
+            uint64_t now = monotonic_ns();
+            if ((size_t) len < socket_header_size
+                    || memcmp(buf, socket_magic, socket_header_size) != 0
+                    || (len - socket_header_size) % socket_event_size != 0)
+                continue;
+
+            for (size_t i = socket_header_size; i < (size_t) len;
+                    i += socket_event_size) {
+                if (decode(buf + i, batch[count])) {
+                    batch[count].time = now;
+                    count++;
+                }
+            }
+        }
+
+        if (count > 0)
+            _events->input(batch, count);
+    }
+}
+
+SocketClient::SocketClient (const char *address)
+    : _socket (-1)
+    , _addressLen (0)
+{
+    int domain = resolve(address, _address, _addressLen);
+    if (domain < 0) {
+        fprintf(stderr, "Could not resolve socket address `%s'\n", address);
+        return;
+    }
+
+    _socket = socket(domain, SOCK_DGRAM, 0);
+    if (_socket < 0)
+        fprintf(stderr, "Could not create socket: %s\n", strerror(errno));
+}
+
+SocketClient::~SocketClient ()
+{
+    if (_socket >= 0)
+        close(_socket);
+}
+
+bool
+SocketClient::isOpen () const
+{
+    return _socket >= 0;
+}
+
+bool
+SocketClient::send (const MidiEvent *events, size_t count)
+{
+    unsigned char buf[socket_header_size
+        + socket_max_events * socket_event_size];
+    memcpy(buf, socket_magic, socket_header_size);
+
+    size_t i = 0;
+    while (i < count) {
+        size_t len = socket_header_size;
+        for (size_t n = 0; i < count && n < socket_max_events; i++) {
+            if (encode(events[i], buf + len)) {
+                len += socket_event_size;
+                n++;
+            }
+        }
+        if (len == socket_header_size)
+            break;
+        if (sendto(_socket, buf, len, 0, (struct sockaddr*) &_address,
+                    _addressLen) < 0) {
+            fprintf(stderr, "Could not send events: %s\n", strerror(errno));
+            return false;
+        }
+    }
+    return true;
+}
@@ -1,29 +1,123 @@
+#include <cfenv>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <unistd.h>
+#ifdef __SSE__
+#include <xmmintrin.h>
+#endif
 #include "Definitions.hpp"
 #include "Synth.hpp"
 
+/* rate used when there's no device to ask */
+static const unsigned int default_rate = 44100;
+/* most events that can take effect within a single block */
+static const size_t max_block_events = 512;
+/* longest block rendered in one go; longer requests are split */
+static const size_t max_block_frames = 1024;
+/* volume changes glide over this many frames, however long the blocks are */
+static const size_t volume_glide_frames = 256;
+/*
+ * How far each block pulls the clock timing live events towards when it
+ * actually started. A block a whole period out resets the clock instead.
+ */
+static const double clock_tracking = 1.0 / 16.0;
+/* longest start of a note the voice cache records, in seconds */
+static const double voice_cache_seconds = 1.0;
+/* how often a lost audio device is reopened, in microseconds */
+static const unsigned long audio_retry_us = 1000000;
+
+/*
+ * Pins the floating point environment while a block renders in deterministic
+ * mode, restoring the thread's own afterwards.
+ */
+class FloatEnvironment {
+public:
+    FloatEnvironment (bool pin)
+        : _pinned (pin)
+    {
+#ifdef __SSE__
+        _csr = _mm_getcsr();
+        /* round to nearest, exceptions masked, flush-to-zero, denormals-are-zero */
+        if (_pinned)
+            _mm_setcsr(0x1f80 | 0x8000 | 0x0040);
+#else
+        _round = fegetround();
+        if (_pinned)
+            fesetround(FE_TONEAREST);
+#endif
+    }
+
+    ~FloatEnvironment ()
+    {
+        if (!_pinned)
+            return;
+#ifdef __SSE__
+        _mm_setcsr(_csr);
+#else
+        fesetround(_round);
+#endif
+    }
+
+private:
+    bool _pinned;
+#ifdef __SSE__
+    unsigned int _csr;
+#else
+    int _round;
+#endif
+};
+
 Synth::Synth ()
 {
-    init(NULL);
+    init(SYNTH_DRIVER_ALSA, NULL, default_rate);
 }
 
 Synth::Synth (const char *midiDevice)
 {
-    init(midiDevice);
+    init(SYNTH_DRIVER_ALSA, midiDevice, default_rate);
 }
 
 Synth::Synth (const std::string midiDevice)
 {
-    init(midiDevice.c_str());
+    init(SYNTH_DRIVER_ALSA, midiDevice.c_str(), default_rate);
+}
+
+Synth::Synth (SynthDriver driver)
+{
+    init(driver, NULL, default_rate);
+}
+
+Synth::Synth (SynthDriver driver, unsigned int rate)
+{
+    init(driver, NULL, rate);
 }
 
 Synth::~Synth ()
 {
-    _running = false;
-    pthread_join(_thread, NULL);
+    if (_running) {
+        _running = false;
+        pthread_join(_thread, NULL);
+    }
+    delete _jack;
+    delete _recorder.exchange(NULL);
     delete _audio;
     delete _midi;
+    delete _socket;
+    delete _events;
+    delete _controls;
     delete _polyphonic;
+    delete _effects;
+    delete _output;
     delete[] _samples;
+    delete[] _mix;
+    delete[] _pending;
+    delete[] _left;
+    delete[] _right;
+    delete[] _gains;
+    delete[] _block;
+    delete _patch;
+    delete _tunings;
 }
 
 void
@@ -35,79 +129,168 @@ Synth::setVolume (const double value)
 void
 Synth::setWaveform (const OscillatorWave wave)
 {
-    _polyphonic->setWaveForm(wave);
+    _patch->setWaveForm(wave);
 }
 
 void
 Synth::setAttack (const double value) const
 {
-    _polyphonic->setADSR(STAGE_ATTACK, clamp(value, 0.01, 1.5));
+    _patch->setADSR(STAGE_ATTACK, clamp(value, 0.01, 1.5));
 }
 
 void
 Synth::setDecay (const double value) const
 {
-    _polyphonic->setADSR(STAGE_DECAY, clamp(value, 0.01, 1.5));
+    _patch->setADSR(STAGE_DECAY, clamp(value, 0.01, 1.5));
 }
 
 void
 Synth::setSustain (const double value) const
 {
-    _polyphonic->setADSR(STAGE_SUSTAIN, clamp(value, 0.01, 1.5));
+    _patch->setADSR(STAGE_SUSTAIN, clamp(value, 0.01, 1.5));
 }
 
 void
 Synth::setRelease (const double value) const
 {
-    _polyphonic->setADSR(STAGE_RELEASE, clamp(value, 0.01, 1.5));
+    _patch->setADSR(STAGE_RELEASE, clamp(value, 0.01, 1.5));
 }
 
 void
 Synth::setCutoff (const double value) const
 {
-    _polyphonic->setFilterCutoff(clamp(value, 0.0, 0.99));
+    _patch->setFilterCutoff(clamp(value, 0.0, 0.99));
+}
+
+void
+Synth::setCutoffHz (const double hz) const
+{
+    _patch->setFilterCutoff(Filter::hzToCutoff(hz));
 }
 
 void
 Synth::setResonance (const double value) const
 {
-    _polyphonic->setFilterResonance(clamp(value, 0.0, 0.99));
+    _patch->setFilterResonance(clamp(value, 0.0, 0.99));
 }
 
 void
 Synth::setFilterAttack (const double value) const
 {
-    _polyphonic->setFilterADSR(STAGE_ATTACK, clamp(value, 0.01, 1.5));
+    _patch->setFilterADSR(STAGE_ATTACK, clamp(value, 0.01, 1.5));
 }
 
 void
 Synth::setFilterDecay (const double value) const
 {
-    _polyphonic->setFilterADSR(STAGE_DECAY, clamp(value, 0.01, 1.5));
+    _patch->setFilterADSR(STAGE_DECAY, clamp(value, 0.01, 1.5));
 }
 
 void
 Synth::setFilterSustain (const double value) const
 {
-    _polyphonic->setFilterADSR(STAGE_SUSTAIN, clamp(value, 0.01, 1.5));
+    _patch->setFilterADSR(STAGE_SUSTAIN, clamp(value, 0.01, 1.5));
 }
 
 void
 Synth::setFilterRelease (const double value) const
 {
-    _polyphonic->setFilterADSR(STAGE_RELEASE, clamp(value, 0.01, 1.5));
+    _patch->setFilterADSR(STAGE_RELEASE, clamp(value, 0.01, 1.5));
+}
+
+void
+Synth::setFilterType (FilterType type) const
+{
+    if (type < FILTER_TYPE_CASCADE || type >= NUM_FILTER_TYPES)
+        return;
+    _patch->setFilterType(type);
+}
+
+void
+Synth::setPreset (const Preset &preset)
+{
+    Preset p = preset;
+    p.clampValues();
+    /* if the audio thread hasn't taken the last one yet, this replaces it */
+    _patch->setPreset(p);
+}
+
+void
+Synth::setTuning (const Tuning &tuning)
+{
+    _tunings->write(tuning);
+}
+
+void
+Synth::setPitchBendRange (double semitones) const
+{
+    _patch->setBendRange(clamp(semitones, 0.0, 48.0));
+}
+
+void
+Synth::setSampleBank (const SampleBank *bank) const
+{
+    _patch->setSampleBank(bank);
+}
+
+void
+Synth::setVoiceCache (size_t entries) const
+{
+    _patch->setVoiceCache(entries, voice_cache_seconds * _rate);
+}
+
+void
+Synth::setLfo (int lfo, LfoWave wave, double rate) const
+{
+    _patch->setLfo(lfo, wave, rate);
+}
+
+void
+Synth::setModulation (int slot, ModSource source, ModDest dest, double amount) const
+{
+    _patch->setModulation(slot, source, dest, amount);
+}
+
+void
+Synth::setChorus (double rate, double depth, double mix) const
+{
+    _effects->setChorus(rate, depth, mix);
+}
+
+void
+Synth::setDelay (double time, double feedback, double mix) const
+{
+    _effects->setDelay(time, feedback, mix);
+}
+
+void
+Synth::setReverb (double size, double damping, double mix) const
+{
+    _effects->setReverb(size, damping, mix);
+}
+
+void
+Synth::setOutputClip (OutputClip clip) const
+{
+    _output->setClip(clip);
+}
+
+ControlMap&
+Synth::controls ()
+{
+    return *_controls;
 }
 
 void
 Synth::noteOn (const int note, const double velocity) const
 {
-    _midi->input(MidiEvent(MIDI_NOTEON, note, 0.0, clamp(velocity, 0.0, 1.0), 0.0));
+    _events->input(MidiEvent(MIDI_NOTEON, note, 0.0, clamp(velocity, 0.0, 1.0), 0.0));
 }
 
 void
 Synth::noteOff (const int note) const
 {
-    _midi->input(MidiEvent(MIDI_NOTEOFF, note, 0.0, 0.0, 0.0));
+    _events->input(MidiEvent(MIDI_NOTEOFF, note, 0.0, 0.0, 0.0));
 }
 
 bool
@@ -116,19 +299,220 @@ Synth::noteActive (const int note) const
     return _polyphonic->noteActive(note);
 }
 
+bool
+Synth::startRecording (const char *path,
+                       RecorderFormat format,
+                       RecorderContainer container)
+{
+    Recorder *recorder = new Recorder(path, format, container, getRate(), 2);
+    if (!recorder->isOpen()) {
+        delete recorder;
+        return false;
+    }
+    stopRecording();
+    _recorder = recorder;
+    return true;
+}
+
+void
+Synth::stopRecording ()
+{
+    Recorder *recorder = _recorder.exchange(NULL);
+    if (!recorder)
+        return;
+    /*
+     * Whichever thread renders may have grabbed the recorder just before it
+     * was swapped out. One that starts writing after can only see NULL, so
+     * once none is writing it can't be using it.
+     */
+    while (_recordWriters > 0)
+        usleep(100);
+    delete recorder;
+}
+
+void
+Synth::connectMidi (const char *device) const
+{
+    if (_midi)
+        _midi->addDevice(device);
+}
+
+void
+Synth::disconnectMidi (const char *device) const
+{
+    if (_midi)
+        _midi->removeDevice(device);
+}
+
+DeviceStatus
+Synth::audioStatus () const
+{
+    if (_jack)
+        return _jack->status();
+    if (!_audio)
+        return DEVICE_STATUS_NONE;
+    if (!_running)
+        return DEVICE_STATUS_FAILED;
+    return _audio->status();
+}
+
+DeviceStatus
+Synth::midiStatus () const
+{
+    /* JACK's MIDI comes with its audio */
+    if (_jack)
+        return _jack->status();
+    if (!_midi)
+        return DEVICE_STATUS_NONE;
+    return _midi->status();
+}
+
+std::string
+Synth::deviceError () const
+{
+    if (_jack && _jack->status() != DEVICE_STATUS_OK)
+        return _jack->error();
+    if (_audio && audioStatus() != DEVICE_STATUS_OK)
+        return _running ? _audio->error() : "Could not create audio thread";
+    if (_midi && _midi->status() != DEVICE_STATUS_OK)
+        return _midi->error();
+    return "";
+}
+
+unsigned int
+Synth::getRate () const
+{
+    return _rate;
+}
+
+uint64_t
+Synth::frame () const
+{
+    return _frame;
+}
+
+void
+Synth::setDeterministic (bool deterministic)
+{
+    _deterministic = deterministic;
+}
+
+bool
+Synth::setProfiler (ProfileCallback callback, void *data)
+{
+#ifdef SYNTH_PROFILE
+    _profiler = NULL;
+    _profilerData = data;
+    _profiler = callback;
+    return true;
+#else
+    return false;
+#endif
+}
+
+bool
+Synth::setAudioBuffer (size_t periodFrames, size_t bufferFrames)
+{
+    if (_driver != SYNTH_DRIVER_ALSA)
+        return false;
+
+    if (_running) {
+        _running = false;
+        pthread_join(_thread, NULL);
+    }
+    delete _audio;
+    delete[] _samples;
+    delete[] _mix;
+    openAudio(periodFrames, bufferFrames);
+    _events->setLatency(_samplesLen / 2);
+    startAudio();
+    return audioStatus() == DEVICE_STATUS_OK;
+}
+
 void
-Synth::init (const char *midiDevice)
+Synth::setOutputMonitor (OutputMonitor monitor, void *data)
+{
+    _monitor = NULL;
+    _monitorData = data;
+    _monitor = monitor;
+}
+
+void
+Synth::schedule (const MidiEvent &event) const
+{
+    _events->input(event);
+}
+
+void
+Synth::setInputLatency (double seconds) const
+{
+    _events->setLatency(clamp(seconds, 0.0, 1.0) * getRate());
+}
+
+bool
+Synth::listen (const char *address)
 {
+    delete _socket;
+    _socket = new SocketInput(address, _events);
+    if (_socket->isOpen())
+        return true;
+    delete _socket;
+    _socket = NULL;
+    return false;
+}
+
+void
+Synth::init (SynthDriver driver, const char *midiDevice, unsigned int rate)
+{
+    _driver = driver;
+    _rate = rate;
     _volume = 1.0;
-    _audio = new AudioDevice();
+    _gain = _volume;
+    _gainStep = 0.0;
+    _gainTarget = _volume;
+    _gainFrames = 0;
+    _deterministic = false;
+    _patch = new PatchChanges();
+    _tunings = new TripleBuffer<Tuning>();
+    _recorder = NULL;
+    _profiler = NULL;
+    _profilerData = NULL;
+    _monitor = NULL;
+    _monitorData = NULL;
+    _recordWriters = 0;
+    _frame = 0;
+    _running = false;
+    _audio = NULL;
+    _jack = NULL;
+    _midi = NULL;
+    _socket = NULL;
+    _samples = NULL;
+    _mix = NULL;
+    _samplesLen = 0;
+    _pending = new MidiEvent[max_block_events];
+    _left = new double[max_block_frames];
+    _right = new double[max_block_frames];
+    _gains = new double[max_block_frames];
+    _block = new float[max_block_frames * 2];
+    _events = new EventQueue();
+    _controls = new ControlMap();
 
-    size_t rate = _audio->getRate();
-    _samplesLen = _audio->getPeriodSamples();
-    _samples = new int16_t[_samplesLen];
+    if (_driver == SYNTH_DRIVER_ALSA) {
+        openAudio(AUDIO_PERIOD_FRAMES, AUDIO_BUFFER_FRAMES);
+        _rate = _audio->getRate();
+    }
+
+    /* JACK runs at whatever rate its server does */
+    if (_driver == SYNTH_DRIVER_JACK) {
+        _jack = new JackDevice("synth", Synth::jack_render, this);
+        if (_jack->status() == DEVICE_STATUS_OK)
+            _rate = _jack->getRate();
+    }
 
-    Oscillator::setRate(rate);
-    Envelope::setRate(rate);
-    _midi = new MidiController(midiDevice);
+    if (_driver == SYNTH_DRIVER_ALSA) {
+        _events->setLatency(_samplesLen / 2);
+        _midi = new MidiController(midiDevice, _events);
+    }
 
     /* 
      * A simple default. Short attack, medium decay and sustain, long
@@ -138,69 +522,306 @@ Synth::init (const char *midiDevice)
     _polyphonic = new Polyphonic(
                         0.01, 0.5, 0.5, 1.0,
                         0.2, 0.2, 1.0, 1.0,
-                        0.99, 0.0);
+                        0.99, 0.0, _rate);
     _polyphonic->setWaveForm(OSCILLATOR_WAVE_SQUARE);
+    _effects = new Effects(_rate);
+    _output = new OutputStage(_rate, 2);
+    _output->setDither(true);
+
+    if (_driver == SYNTH_DRIVER_ALSA)
+        startAudio();
+
+    if (_jack)
+        _jack->start();
+}
+
+void
+Synth::openAudio (size_t periodFrames, size_t bufferFrames)
+{
+    _audio = new AudioDevice(periodFrames, bufferFrames);
+    _samplesLen = _audio->getPeriodSamples();
+    _samples = new int16_t[_samplesLen];
+    _mix = new float[_samplesLen];
+}
 
+void
+Synth::startAudio ()
+{
     _running = true;
-    CHK(pthread_create(&_thread, NULL, Synth::audio_thread, this),
-            "Could not create audio thread");
+    if (pthread_create(&_thread, NULL, Synth::audio_thread, this) != 0) {
+        fprintf(stderr, "Could not create audio thread\n");
+        _running = false;
+    }
 }
 
-/* 
- * Converts a double value into a 16bit signed integer value, clipping any
- * out-of-range values.
+void
+Synth::dispatch (const MidiEvent &e)
+{
+    switch (e.type) {
+        case MIDI_NOTEON:
+            _polyphonic->noteOn(e.note, e.velocity);
+            break;
+        case MIDI_NOTEOFF:
+            _polyphonic->noteOff(e.note);
+            break;
+        case MIDI_PITCHBEND:
+            _polyphonic->setPitch(e.pitch);
+            break;
+        case MIDI_CONTROL:
+        {
+            const ControlMapping &m = _controls->find(e.channel, e.note);
+            if (m.param != PARAM_NONE)
+                setParam(m.param, m.scale(e.control));
+            break;
+        }
+        default:
+            break;
+    }
+}
+
+void
+Synth::setParam (SynthParam param, double value)
+{
+    switch (param) {
+        case PARAM_ATTACK:
+        case PARAM_DECAY:
+        case PARAM_SUSTAIN:
+        case PARAM_RELEASE:
+            _polyphonic->setADSR((EnvelopeStage)(param - PARAM_ATTACK),
+                    clamp(value, 0.01, 1.5));
+            break;
+        case PARAM_FILTER_ATTACK:
+        case PARAM_FILTER_DECAY:
+        case PARAM_FILTER_SUSTAIN:
+        case PARAM_FILTER_RELEASE:
+            _polyphonic->setFilterADSR((EnvelopeStage)(param - PARAM_FILTER_ATTACK),
+                    clamp(value, 0.01, 1.5));
+            break;
+        case PARAM_CUTOFF:
+            _polyphonic->setFilterCutoff(clamp(value, 0.0, 0.99));
+            break;
+        case PARAM_RESONANCE:
+            _polyphonic->setFilterResonance(clamp(value, 0.0, 0.99));
+            break;
+        case PARAM_VOLUME:
+            _volume = clamp(value, 0.0, 1.5);
+            break;
+        case PARAM_MOD_CONTROL:
+            _polyphonic->setModControl(value);
+            break;
+        default:
+            break;
+    }
+}
+
+void
+Synth::render (float *buffer, size_t frames)
+{
+    FloatEnvironment environment(_deterministic);
+
+    while (frames > 0) {
+        size_t n = std::min(frames, max_block_frames);
+        renderBlock(buffer, n, NULL, 0, 0);
+        buffer += n * 2;
+        frames -= n;
+    }
+}
+
+void
+Synth::render (float **out, size_t frames, const MidiEvent *events, size_t count)
+{
+    FloatEnvironment environment(_deterministic);
+
+    /* the host's events are timed from the start of this call */
+    uint64_t base = _frame;
+    size_t first = 0;
+    for (size_t done = 0; done < frames; ) {
+        size_t n = std::min(frames - done, max_block_frames);
+        size_t last = first;
+        while (last < count && (events[last].frame < done + n || done + n == frames))
+            last++;
+
+        renderBlock(_block, n, events + first, last - first, base);
+        for (size_t i = 0; i < n; i++) {
+            out[0][done + i] = _block[i * 2];
+            out[1][done + i] = _block[i * 2 + 1];
+        }
+        first = last;
+        done += n;
+    }
+}
+
+void
+Synth::renderBlock (float *buffer, size_t frames,
+                    const MidiEvent *events, size_t eventCount, uint64_t base)
+{
+#ifdef SYNTH_PROFILE
+    uint64_t blockStart = profile_clock();
+    for (int i = 0; i < NUM_PROFILE_STAGES; i++)
+        profile_cycles[i] = 0;
+#endif
+
+    uint64_t start = _frame;
+    size_t count = _events->drain(_pending, max_block_events, start + frames);
+    size_t next = 0;
+    size_t nextEvent = 0;
+
+    _controls->update();
+
+    /* only the newest of each setting matters if several arrived */
+    _patch->update(*_polyphonic, _volume);
+
+    if (_tunings->read(_tuning))
+        _polyphonic->setTuning(_tuning);
+
+    /*
+     * Render in runs between events so each event is played on the exact
+     * frame it was scheduled for. Queued events go before the caller's
+     * where they fall on the same frame.
+     */
+    size_t pos = 0;
+    while (pos < frames) {
+        while (next < count && _pending[next].frame <= start + pos)
+            dispatch(_pending[next++]);
+        while (nextEvent < eventCount
+                && base + events[nextEvent].frame <= start + pos)
+            dispatch(events[nextEvent++]);
+        size_t end = frames;
+        if (next < count)
+            end = std::min(end, (size_t)(_pending[next].frame - start));
+        if (nextEvent < eventCount)
+            end = std::min(end, (size_t)(base + events[nextEvent].frame - start));
+        _polyphonic->render(_left + pos, _right + pos, end - pos);
+        glideVolume(pos, end);
+        pos = end;
+    }
+    while (next < count)
+        dispatch(_pending[next++]);
+    while (nextEvent < eventCount)
+        dispatch(events[nextEvent++]);
+
+    PROFILE_START(t);
+    _effects->process(_left, _right, frames);
+    PROFILE_LAP(t, PROFILE_EFFECTS);
+
+    for (size_t i = 0; i < frames; i++) {
+        buffer[i * 2] = _gains[i] * _left[i];
+        buffer[i * 2 + 1] = _gains[i] * _right[i];
+    }
+
+    _output->process(buffer, frames);
+    PROFILE_LAP(t, PROFILE_OUTPUT);
+
+    _frame = start + frames;
+
+    _recordWriters++;
+    Recorder *recorder = _recorder;
+    if (recorder)
+        recorder->write(buffer, frames);
+    _recordWriters--;
+
+#ifdef SYNTH_PROFILE
+    ProfileCallback profiler = _profiler;
+    if (profiler) {
+        ProfileBlock block;
+        block.frame = start;
+        block.frames = frames;
+        for (int i = 0; i < NUM_PROFILE_STAGES; i++)
+            block.cycles[i] = profile_cycles[i];
+        block.total = profile_clock() - blockStart;
+        _polyphonic->profile(block);
+        profiler(block, _profilerData);
+    }
+#endif
+}
+
+/*
+ * Work out the gain for frames `from' to `to' of the block, starting a glide
+ * on the frame the volume was changed on, so where a change falls doesn't
+ * depend on how the blocks do.
  */
-static inline int16_t
-clip (double x)
+void
+Synth::glideVolume (size_t from, size_t to)
 {
-    if (x > 1.0)
-        x = 1.0;
-    else if (x < -1.0)
-        x = -1.0;
-    return static_cast<int16_t>(32767.0 * x);
+    double target = _volume;
+    if (target != _gainTarget) {
+        _gainTarget = target;
+        _gainStep = (target - _gain) / volume_glide_frames;
+        _gainFrames = volume_glide_frames;
+    }
+
+    double gain = _gain;
+    for (size_t i = from; i < to; i++) {
+        if (_gainFrames > 0)
+            gain = --_gainFrames > 0 ? gain + _gainStep : _gainTarget;
+        _gains[i] = gain;
+    }
+    _gain = gain;
+}
+
+void
+Synth::jack_render (float **out, size_t frames,
+                    const MidiEvent *events, size_t count, void *data)
+{
+    ((Synth*) data)->render(out, frames, events, count);
 }
 
 void*
 Synth::audio_thread (void *data)
 {
     Synth *synth = (Synth*) data;
-    Polyphonic *polyphonic = synth->_polyphonic;
-    MidiController *midi = synth->_midi;
     AudioDevice *audio = synth->_audio;
     int16_t *samples = synth->_samples;
+    float *mix = synth->_mix;
     size_t samplesLen = synth->_samplesLen;
+    unsigned int rate = synth->getRate();
+    unsigned long periodUs = samplesLen / 2 * 1000000UL / rate;
+    unsigned long waitedUs = 0;
+    double periodNs = samplesLen / 2 * 1e9 / rate;
+    double origin = 0.0;
 
     while (synth->_running) {
-        for (unsigned i = 0; i < samplesLen; i += 2) {
-            MidiEvent e = midi->nextEvent();
-            switch (e.type) {
-                case MIDI_NOTEON:
-                    polyphonic->noteOn(e.note, e.velocity);
-                    break;
-                case MIDI_NOTEOFF:
-                    polyphonic->noteOff(e.note);
-                    break;
-                case MIDI_PITCHBEND:
-                    polyphonic->setPitch(e.pitch);
-                    break;
-                case MIDI_CONTROL:
-                    if (e.note <= 4)
-                        /* minus 1 because control params start at 1 */
-                        polyphonic->setADSR((EnvelopeStage)(e.note - 1), e.control);
-                    else if (e.note == 5)
-                        polyphonic->setFilterCutoff(e.control);
-                    else if (e.note == 6)
-                        polyphonic->setFilterResonance(e.control);
-                    else if (e.note <= 10)
-                        /* minus 6 because stages are 1 through 4 */
-                        polyphonic->setFilterADSR((EnvelopeStage)(e.note - 6), e.control);
-                    break;
-                default:
-                    break;
+        /*
+         * Blocks are rendered as the device makes room for them, once a
+         * period give or take scheduling. Smooth that into when frame 0 was
+         * rendered, which times the live events against the sample clock.
+         */
+        double now = monotonic_ns();
+        double due = origin + synth->_frame * 1e9 / rate;
+        if (origin == 0.0 || fabs(now - due) > periodNs)
+            origin = now - synth->_frame * 1e9 / rate;
+        else
+            origin += (now - due) * clock_tracking;
+        synth->_events->setClock(origin, rate);
+
+        synth->render(mix, samplesLen / 2);
+        synth->_output->toS16(mix, samples, samplesLen);
+        if (audio->status() == DEVICE_STATUS_OK && audio->play(samples, samplesLen)) {
+            OutputMonitor monitor = synth->_monitor;
+            if (monitor) {
+                OutputBlock block;
+                block.written = monotonic_ns();
+                block.samples = mix;
+                block.frames = samplesLen / 2;
+                block.frame = synth->_frame - block.frames;
+                block.queued = audio->queued();
+                monitor(block, synth->_monitorData);
             }
-            samples[i] = samples[i + 1] = clip(synth->_volume * polyphonic->next());
+            continue;
+        }
+
+        /*
+         * The device is gone. Keep the clock, events and any recording
+         * going in real time and try the device again every so often.
+         */
+        if (audio->status() == DEVICE_STATUS_OK)
+            audio->close();
+        usleep(periodUs);
+        waitedUs += periodUs;
+        if (waitedUs >= audio_retry_us) {
+            waitedUs = 0;
+            audio->open();
         }
-        audio->play(samples, samplesLen);
     }
 
     return NULL;
@@ -0,0 +1,238 @@
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+#include "Definitions.hpp"
+#include "Tuning.hpp"
+
+/*
+ * 2^(c / 1200) for every cent of an octave. Intervals are split into whole
+ * octaves, applied by exponent, and cents, interpolated from the table.
+ */
+struct CentTable {
+    double ratio[1201];
+
+    CentTable ()
+    {
+        for (int i = 0; i <= 1200; i++)
+            ratio[i] = pow(2.0, i / 1200.0);
+    }
+};
+
+static const CentTable cents;
+
+double
+Tuning::ratio (double semitones)
+{
+    double c = semitones * 100.0;
+    double octaves = floor(c / 1200.0);
+    c -= octaves * 1200.0;
+    int i = std::min((int) c, 1199);
+    double frac = c - i;
+    double r = cents.ratio[i] + frac * (cents.ratio[i + 1] - cents.ratio[i]);
+    return ldexp(r, (int) octaves);
+}
+
+Tuning::Tuning (double reference)
+    : _reference (reference)
+    , _referenceNote (69)
+    , _fineTune (0.0)
+{
+    for (int note = 0; note < TUNING_NOTES; note++)
+        _cents[note] = (note - _referenceNote) * 100.0;
+    update();
+}
+
+/*
+ * Reads the next line of a Scala file that isn't a comment, without its
+ * newline. Blank lines count, since a scale's description may be empty.
+ */
+static bool
+read_line (FILE *file, char *line, size_t size)
+{
+    while (fgets(line, size, file)) {
+        line[strcspn(line, "\r\n")] = '\0';
+        if (line[0] != '!')
+            return true;
+    }
+    return false;
+}
+
+/*
+ * A pitch line of a .scl file: cents if it has a decimal point, otherwise a
+ * ratio like `3/2' or `2'. Anything after the number is a comment.
+ */
+static bool
+parse_pitch (const char *line, double &cents)
+{
+    const char *p = line + strspn(line, " \t");
+    size_t len = strcspn(p, " \t");
+    if (len == 0)
+        return false;
+
+    char *end;
+    if (memchr(p, '.', len)) {
+        cents = strtod(p, &end);
+        return end == p + len;
+    }
+
+    long num = strtol(p, &end, 10);
+    long den = 1;
+    if (*end == '/')
+        den = strtol(end + 1, &end, 10);
+    if (end != p + len || num <= 0 || den <= 0)
+        return false;
+    cents = 1200.0 * log2((double) num / den);
+    return true;
+}
+
+/* The next whole number of a .kbm file, or -1 for an unmapped key, `x' */
+static bool
+parse_key (FILE *file, long &value)
+{
+    char line[256];
+    if (!read_line(file, line, sizeof(line)))
+        return false;
+    const char *p = line + strspn(line, " \t");
+    if (*p == 'x') {
+        value = -1;
+        return true;
+    }
+    char *end;
+    value = strtol(p, &end, 10);
+    return end != p;
+}
+
+/* Distance of a degree of the scale from degree 0, the scale repeating */
+static double
+degree_cents (const std::vector<double> &scale, long degree)
+{
+    long size = scale.size();
+    long period = degree >= 0 ? degree / size : -((size - 1 - degree) / size);
+    return period * scale.back() + (degree == period * size
+            ? 0.0 : scale[degree - period * size - 1]);
+}
+
+bool
+Tuning::load (const char *scale, const char *keyboard)
+{
+    FILE *file = fopen(scale, "r");
+    if (!file) {
+        fprintf(stderr, "Could not open scale `%s'\n", scale);
+        return false;
+    }
+
+    /* a description, the number of pitches, then the pitches */
+    char line[256];
+    std::vector<double> pitches;
+    long count = 0;
+    bool ok = read_line(file, line, sizeof(line))
+        && read_line(file, line, sizeof(line))
+        && (count = strtol(line, NULL, 10)) > 0 && count <= 1024;
+    for (long i = 0; ok && i < count; i++) {
+        double cents;
+        ok = read_line(file, line, sizeof(line)) && parse_pitch(line, cents);
+        pitches.push_back(cents);
+    }
+    fclose(file);
+    if (!ok || pitches.back() <= 0.0) {
+        fprintf(stderr, "Could not parse scale `%s'\n", scale);
+        return false;
+    }
+
+    /* the mapping Scala assumes without a .kbm file */
+    long mapSize = 0, first = 0, last = TUNING_NOTES - 1, middle = 60;
+    long referenceNote = 69, octaveDegree = 0;
+    double reference = _reference;
+    std::vector<long> map;
+
+    if (keyboard) {
+        file = fopen(keyboard, "r");
+        if (!file) {
+            fprintf(stderr, "Could not open keyboard map `%s'\n", keyboard);
+            return false;
+        }
+        ok = parse_key(file, mapSize) && parse_key(file, first)
+            && parse_key(file, last) && parse_key(file, middle)
+            && parse_key(file, referenceNote)
+            && read_line(file, line, sizeof(line))
+            && (reference = strtod(line, NULL)) > 0.0
+            && parse_key(file, octaveDegree)
+            && mapSize >= 0 && mapSize <= TUNING_NOTES
+            && referenceNote >= 0 && referenceNote < TUNING_NOTES;
+        for (long i = 0; ok && i < mapSize; i++) {
+            long degree;
+            /* a map may end early, leaving the rest of its keys unmapped */
+            if (!parse_key(file, degree))
+                degree = -1;
+            map.push_back(degree);
+        }
+        fclose(file);
+        if (!ok) {
+            fprintf(stderr, "Could not parse keyboard map `%s'\n", keyboard);
+            return false;
+        }
+    }
+
+    /* each key's distance from degree 0, NAN where no degree is mapped */
+    double cents[TUNING_NOTES];
+    for (long note = 0; note < TUNING_NOTES; note++) {
+        long key = note - middle;
+        if (note < first || note > last) {
+            cents[note] = NAN;
+        } else if (mapSize == 0) {
+            cents[note] = degree_cents(pitches, key);
+        } else {
+            long octave = key >= 0 ? key / mapSize
+                : -((mapSize - 1 - key) / mapSize);
+            long degree = map[key - octave * mapSize];
+            cents[note] = degree < 0 ? NAN : octave
+                * degree_cents(pitches, octaveDegree)
+                + degree_cents(pitches, degree);
+        }
+    }
+
+    if (std::isnan(cents[referenceNote])) {
+        fprintf(stderr, "Keyboard map `%s' leaves out its reference note\n",
+                keyboard);
+        return false;
+    }
+
+    _reference = reference;
+    _referenceNote = referenceNote;
+    for (int note = 0; note < TUNING_NOTES; note++)
+        _cents[note] = std::isnan(cents[note])
+            ? (note - referenceNote) * 100.0
+            : cents[note] - cents[referenceNote];
+    update();
+    return true;
+}
+
+void
+Tuning::setFineTune (double cents)
+{
+    _fineTune = cents;
+    update();
+}
+
+double
+Tuning::fineTune () const
+{
+    return _fineTune;
+}
+
+double
+Tuning::reference () const
+{
+    return _reference;
+}
+
+void
+Tuning::update ()
+{
+    for (int note = 0; note < TUNING_NOTES; note++)
+        _frequencies[note] = _reference
+                * pow(2.0, (_cents[note] + _fineTune) / 1200.0);
+}
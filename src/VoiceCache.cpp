@@ -0,0 +1,103 @@
+#include <cstring>
+#include <algorithm>
+#include "Modulation.hpp"
+#include "VoiceCache.hpp"
+
+uint64_t
+VoiceKey::hash () const
+{
+    /* FNV-1a over the bytes, so equal keys always hash the same */
+    const unsigned char *bytes = (const unsigned char*) values;
+    uint64_t h = 14695981039346656037ULL;
+    for (size_t i = 0; i < sizeof(values); i++) {
+        h ^= bytes[i];
+        h *= 1099511628211ULL;
+    }
+    return h;
+}
+
+bool
+VoiceKey::operator== (const VoiceKey &other) const
+{
+    return memcmp(values, other.values, sizeof(values)) == 0;
+}
+
+VoiceCache::VoiceCache ()
+    : _clock (0)
+{ }
+
+VoiceCache::~VoiceCache ()
+{
+    setSize(0, 0);
+}
+
+void
+VoiceCache::setSize (size_t entries, size_t limit)
+{
+    for (size_t i = 0; i < _entries.size(); i++)
+        delete _entries[i];
+    _entries.clear();
+
+    /* all allocated here so recording never allocates on the audio thread */
+    for (size_t i = 0; i < entries; i++) {
+        VoiceRecording *entry = new VoiceRecording();
+        entry->samples.reserve(limit + CONTROL_RATE);
+        entry->snapshots.reserve(limit / CONTROL_RATE + 2);
+        entry->limit = limit;
+        _entries.push_back(entry);
+    }
+}
+
+void
+VoiceCache::swap (VoiceCache &other)
+{
+    _entries.swap(other._entries);
+    std::swap(_clock, other._clock);
+}
+
+size_t
+VoiceCache::size () const
+{
+    return _entries.size();
+}
+
+VoiceRecording*
+VoiceCache::find (const VoiceKey &key)
+{
+    uint64_t hash = key.hash();
+    for (size_t i = 0; i < _entries.size(); i++) {
+        VoiceRecording *entry = _entries[i];
+        /* a recording that ended before its first control block is empty */
+        if (!entry->recording && entry->snapshots.size() < 2)
+            continue;
+        if (entry->hash == hash && entry->key == key) {
+            entry->lastUsed = ++_clock;
+            return entry;
+        }
+    }
+    return NULL;
+}
+
+VoiceRecording*
+VoiceCache::record (const VoiceKey &key)
+{
+    VoiceRecording *entry = NULL;
+    for (size_t i = 0; i < _entries.size(); i++) {
+        VoiceRecording *e = _entries[i];
+        if (e->users > 0)
+            continue;
+        if (!entry || e->lastUsed < entry->lastUsed)
+            entry = e;
+    }
+    if (!entry)
+        return NULL;
+
+    entry->key = key;
+    entry->hash = key.hash();
+    entry->samples.clear();
+    entry->snapshots.clear();
+    entry->recording = true;
+    entry->complete = false;
+    entry->lastUsed = ++_clock;
+    return entry;
+}